@@ -0,0 +1,118 @@
+// var-archive:  print the samples in a poll_<n>.var archive written by var -a.
+#include <stdio.h>          // printf(3)
+#include <stdlib.h>         // exit(3), calloc(3)
+#include <stdint.h>         // uint64_t etc.
+#include <inttypes.h>       // PRIu64 etc.
+#include <string.h>         // strchr(3)
+#include <getopt.h>         // getopt(3)
+#include <assert.h>         // assert(3)
+#include "archive_utils.h"
+#include "int_utils.h"      // safe_strtoull()
+
+static const char usage[] =
+    "Usage:  var-archive [-i] <archive> [<first>[:<last>]]\n"
+    "  Print the samples in <archive> as text, one row per sample, preceded\n"
+    "  by a row of column names.  If the archive has a tsc column, <first>\n"
+    "  and <last> are TSC values and only the blocks that overlap them are\n"
+    "  decoded; otherwise they are sample numbers.\n"
+    "  -i  Print the header and block index instead of the samples.\n";
+
+static void print_index( const struct poll_archive *ar ){
+    const struct archive_header *h = ar->header;
+    printf( "# version %"PRIu32" msr %#"PRIx32" cpu %"PRIu16" flags %#"PRIx16" samples %"PRIu64" blocks %"PRIu32" of %"PRIu32"\n",
+            h->version, h->msr, h->cpu, h->flags, h->sample_count, h->block_count, h->block_samples );
+    printf( "# columns" );
+    for( archive_column_t c = 0; c < NUM_ARCHIVE_COLUMNS; c++ ){
+        if( h->column_mask & ( 1U << c ) ){
+            printf( " %s", archivecolumn2str[c] );
+        }
+    }
+    printf( "\nblock offset bytes first_sample samples first_tsc last_tsc\n" );
+    for( uint32_t blk = 0; blk < h->block_count; blk++ ){
+        const struct archive_block *b = &ar->index[blk];
+        printf( "%"PRIu32" %"PRIu64" %"PRIu32" %"PRIu64" %"PRIu32" %"PRIu64" %"PRIu64"\n",
+                blk, b->offset, b->bytes, b->first_sample, b->samples, b->first_tsc, b->last_tsc );
+    }
+}
+
+int main( int argc, char **argv ){
+    bool index_only = false;
+    int opt;
+    while( -1 != ( opt = getopt( argc, argv, "hi" ) ) ){
+        switch( opt ){
+            case 'i':   index_only = true;          break;
+            case 'h':   printf( "%s", usage );      exit(0);
+            default:    printf( "%s", usage );      exit(-1);
+        }
+    }
+    if( optind >= argc ){
+        printf( "%s", usage );
+        exit(-1);
+    }
+
+    struct poll_archive *ar = open_poll_archive( argv[ optind ] );
+    const struct archive_header *h = ar->header;
+    if( index_only ){
+        print_index( ar );
+        close_poll_archive( ar );
+        return 0;
+    }
+
+    uint64_t first = 0, last = UINT64_MAX;
+    if( optind + 1 < argc ){
+        char *range = argv[ optind + 1 ];
+        char *colon = strchr( range, ':' );
+        if( colon ){
+            *colon = '\0';
+            last = safe_strtoull( colon + 1 );
+        }
+        first = safe_strtoull( range );
+    }
+    bool by_tsc = h->column_mask & ( 1U << ARCHIVE_TSC );
+
+    // One block of every column at a time.
+    static char outbuf[ 1 << 20 ];
+    setvbuf( stdout, outbuf, _IOFBF, sizeof( outbuf ) );
+    uint64_t *columns[ NUM_ARCHIVE_COLUMNS ] = { NULL };
+    printf( "sample" );
+    for( archive_column_t c = 0; c < NUM_ARCHIVE_COLUMNS; c++ ){
+        if( h->column_mask & ( 1U << c ) ){
+            columns[c] = calloc( h->block_samples, sizeof( uint64_t ) );
+            assert( columns[c] );
+            printf( " %s", archivecolumn2str[c] );
+        }
+    }
+    printf( "\n" );
+
+    size_t blk = by_tsc ? find_archive_block( ar, first ) : first / ( h->block_samples ? h->block_samples : 1 );
+    for( ; blk < h->block_count; blk++ ){
+        const struct archive_block *b = &ar->index[blk];
+        if( ( by_tsc ? b->first_tsc : b->first_sample ) > last ){
+            break;
+        }
+        for( archive_column_t c = 0; c < NUM_ARCHIVE_COLUMNS; c++ ){
+            if( columns[c] ){
+                decode_archive_column( ar, blk, c, columns[c] );
+            }
+        }
+        for( uint32_t s = 0; s < b->samples; s++ ){
+            uint64_t key = by_tsc ? columns[ ARCHIVE_TSC ][s] : b->first_sample + s;
+            if( key < first || key > last ){
+                continue;
+            }
+            printf( "%"PRIu64, b->first_sample + s );
+            for( archive_column_t c = 0; c < NUM_ARCHIVE_COLUMNS; c++ ){
+                if( columns[c] ){
+                    printf( " %"PRIu64, columns[c][s] );
+                }
+            }
+            printf( "\n" );
+        }
+    }
+
+    for( archive_column_t c = 0; c < NUM_ARCHIVE_COLUMNS; c++ ){
+        free( columns[c] );
+    }
+    close_poll_archive( ar );
+    return 0;
+}
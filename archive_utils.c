@@ -0,0 +1,320 @@
+#define _GNU_SOURCE        // madvise(2)
+#include <stdio.h>          // fopen(3), fwrite(3)
+#include <stdlib.h>         // calloc(3), exit(3)
+#include <stdint.h>         // uint64_t etc.
+#include <inttypes.h>       // PRIu32 etc.
+#include <string.h>         // memcmp(3), memcpy(3)
+#include <assert.h>         // assert(3)
+#include <fcntl.h>          // open(2)
+#include <unistd.h>         // close(2)
+#include <sys/mman.h>       // mmap(2)
+#include <sys/stat.h>       // fstat(2)
+#include "archive_utils.h"
+#include "msr_utils.h"      // struct msr_batch_op, OP_*
+
+//////////////////////////////////////////////////////////////////////////////////
+// Varints
+//////////////////////////////////////////////////////////////////////////////////
+
+// Map small negative and positive numbers to small unsigned ones:  0, -1, 1, -2, ...
+static inline uint64_t zigzag( int64_t x ){
+    return ( (uint64_t)x << 1 ) ^ (uint64_t)( x >> 63 );
+}
+
+static inline int64_t unzigzag( uint64_t x ){
+    return (int64_t)( x >> 1 ) ^ -(int64_t)( x & 1 );
+}
+
+static inline uint8_t* put_varint( uint8_t *p, uint64_t x ){
+    while( x >= 0x80 ){
+        *p++ = (uint8_t)( x | 0x80 );
+        x >>= 7;
+    }
+    *p++ = (uint8_t)x;
+    return p;
+}
+
+// Returns NULL if the varint runs past <end> or past 64 bits.
+static inline const uint8_t* get_varint( const uint8_t *p, const uint8_t *end, uint64_t *x ){
+    if( p < end && *p < 0x80 ){     // Most deltas fit in one byte.
+        *x = *p;
+        return p + 1;
+    }
+    uint64_t v = 0;
+    for( unsigned shift = 0; p < end && shift < 64; shift += 7 ){
+        uint8_t b = *p++;
+        v |= (uint64_t)( b & 0x7f ) << shift;
+        if( b < 0x80 ){
+            *x = v;
+            return p;
+        }
+    }
+    return NULL;
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+// Writer
+//////////////////////////////////////////////////////////////////////////////////
+
+static constexpr const size_t MAX_VARINT_BYTES = 10;
+
+static uint8_t* encode_column( uint8_t *p, const uint64_t *v, uint32_t n, archive_encoding_t encoding ){
+    // Unsigned arithmetic so counters that wrap (or go backwards) still round trip.
+    p = put_varint( p, v[0] );
+    uint64_t previous_delta = 0;
+    for( uint32_t s = 1; s < n; s++ ){
+        uint64_t delta = v[s] - v[s-1];
+        p = put_varint( p, zigzag( (int64_t)( ARCHIVE_DELTA == encoding ? delta : delta - previous_delta ) ) );
+        previous_delta = delta;
+    }
+    return p;
+}
+
+static void write_or_die( const void *buf, size_t len, FILE *fp, const char *filename ){
+    if( len && 1 != fwrite( buf, len, 1, fp ) ){
+        perror("");
+        fprintf( stderr, "%s:%d:%s Error writing %zu bytes to %s.  Bye!\n", __FILE__, __LINE__, __func__, len, filename );
+        exit(-1);
+    }
+}
+
+void write_poll_archive( const char *filename, const struct poll_config *p ){
+
+    const struct poll_samples *smp = &p->samples;
+    const uint64_t *sources[ NUM_ARCHIVE_COLUMNS ] = {
+        [ARCHIVE_MSRDATA]  = smp->msrdata,
+        [ARCHIVE_MSRDATA2] = smp->msrdata2,
+        [ARCHIVE_TSC]      = smp->tsc,
+        [ARCHIVE_MPERF]    = smp->mperf,
+        [ARCHIVE_APERF]    = smp->aperf,
+        [ARCHIVE_THERM]    = smp->therm,
+        [ARCHIVE_PTHERM]   = smp->ptherm,
+        [ARCHIVE_TAG]      = NULL,      // uint8_t; widened below.
+    };
+
+    struct archive_header h = {
+        .version        = ARCHIVE_VERSION,
+        .msr            = p->msr,
+        .cpu            = (uint16_t)( p->poll_op->cpu ),
+        .flags          = p->flags,
+        .column_mask    = 1U << ARCHIVE_TAG,
+        .sample_count   = smp->count,
+        .block_samples  = ARCHIVE_BLOCK_SAMPLES,
+        .block_count    = (uint32_t)( ( smp->count + ARCHIVE_BLOCK_SAMPLES - 1 ) / ARCHIVE_BLOCK_SAMPLES ),
+        .index_offset   = 0 };
+    memcpy( h.magic, ARCHIVE_MAGIC, sizeof( h.magic ) );
+    for( archive_column_t c = 0; c < NUM_ARCHIVE_COLUMNS; c++ ){
+        if( sources[c] ){
+            h.column_mask |= 1U << c;
+        }
+    }
+
+    FILE *fp = fopen( filename, "w" );
+    if( NULL == fp ){
+        perror("");
+        fprintf( stderr, "%s:%d:%s Error opening file %s.  Bye!\n", __FILE__, __LINE__, __func__, filename );
+        exit(-1);
+    }
+
+    // Header first (rewritten once the index offset is known), then the blocks.
+    struct archive_block *index = calloc( h.block_count ? h.block_count : 1, sizeof( struct archive_block ) );
+    uint64_t *tags              = calloc( ARCHIVE_BLOCK_SAMPLES, sizeof( uint64_t ) );
+    uint8_t *delta              = calloc( ARCHIVE_BLOCK_SAMPLES, MAX_VARINT_BYTES );
+    uint8_t *delta2             = calloc( ARCHIVE_BLOCK_SAMPLES, MAX_VARINT_BYTES );
+    assert( index && tags && delta && delta2 );
+    write_or_die( &h, sizeof( h ), fp, filename );
+    uint64_t offset = sizeof( h );
+
+    for( uint32_t blk = 0; blk < h.block_count; blk++ ){
+        uint64_t first = (uint64_t)blk * ARCHIVE_BLOCK_SAMPLES;
+        uint32_t n = (uint32_t)( ( smp->count - first < ARCHIVE_BLOCK_SAMPLES ) ? smp->count - first : ARCHIVE_BLOCK_SAMPLES );
+        index[blk] = (struct archive_block){
+            .offset       = offset,
+            .first_sample = first,
+            .first_tsc    = smp->tsc ? smp->tsc[ first ]         : 0,
+            .last_tsc     = smp->tsc ? smp->tsc[ first + n - 1 ] : 0,
+            .samples      = n,
+            .bytes        = 0 };
+        for( uint32_t s = 0; s < n; s++ ){
+            tags[s] = smp->tag[ first + s ];
+        }
+
+        for( archive_column_t c = 0; c < NUM_ARCHIVE_COLUMNS; c++ ){
+            if( !( h.column_mask & ( 1U << c ) ) ){
+                continue;
+            }
+            const uint64_t *v = ( ARCHIVE_TAG == c ) ? tags : &sources[c][ first ];
+            // Counters sampled at a steady rate do better as deltas of deltas;
+            // energy and temperature usually don't.  Try both.
+            size_t len1 = (size_t)( encode_column( delta,  v, n, ARCHIVE_DELTA )          - delta  );
+            size_t len2 = (size_t)( encode_column( delta2, v, n, ARCHIVE_DELTA_OF_DELTA ) - delta2 );
+            uint8_t encoding            = ( len2 < len1 ) ? ARCHIVE_DELTA_OF_DELTA : ARCHIVE_DELTA;
+            const uint8_t *data         = ( len2 < len1 ) ? delta2 : delta;
+            size_t len                  = ( len2 < len1 ) ? len2 : len1;
+            uint32_t column_bytes = (uint32_t)( sizeof( uint32_t ) + sizeof( uint8_t ) + len );
+            write_or_die( &column_bytes, sizeof( column_bytes ), fp, filename );
+            write_or_die( &encoding, sizeof( encoding ), fp, filename );
+            write_or_die( data, len, fp, filename );
+            index[blk].bytes += column_bytes;
+        }
+        offset += index[blk].bytes;
+    }
+
+    h.index_offset = offset;
+    write_or_die( index, h.block_count * sizeof( struct archive_block ), fp, filename );
+    if( 0 != fseek( fp, 0, SEEK_SET ) ){
+        perror("");
+        fprintf( stderr, "%s:%d:%s Error rewinding %s.  Bye!\n", __FILE__, __LINE__, __func__, filename );
+        exit(-1);
+    }
+    write_or_die( &h, sizeof( h ), fp, filename );
+    fclose( fp );
+    free( index );
+    free( tags );
+    free( delta );
+    free( delta2 );
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+// Reader
+//////////////////////////////////////////////////////////////////////////////////
+
+static void corrupt( const char *what ){
+    fprintf( stderr, "%s:%d:%s Archive is corrupt (%s).  Bye!\n", __FILE__, __LINE__, __func__, what );
+    exit(-1);
+}
+
+struct poll_archive* open_poll_archive( const char *filename ){
+    struct poll_archive *ar = calloc( 1, sizeof( struct poll_archive ) );
+    assert( ar );
+    ar->fd = open( filename, O_RDONLY );
+    if( -1 == ar->fd ){
+        perror("");
+        fprintf( stderr, "%s:%d:%s Error opening file %s.  Bye!\n", __FILE__, __LINE__, __func__, filename );
+        exit(-1);
+    }
+    struct stat st;
+    assert( 0 == fstat( ar->fd, &st ) );
+    ar->len = (size_t)st.st_size;
+    if( ar->len < sizeof( struct archive_header ) ){
+        corrupt( "short header" );
+    }
+    ar->map = mmap( NULL, ar->len, PROT_READ, MAP_PRIVATE, ar->fd, 0 );
+    if( MAP_FAILED == ar->map ){
+        perror("");
+        fprintf( stderr, "%s:%d:%s Error mapping %s.  Bye!\n", __FILE__, __LINE__, __func__, filename );
+        exit(-1);
+    }
+    madvise( (void*)ar->map, ar->len, MADV_SEQUENTIAL );
+
+    ar->header = (const struct archive_header*)ar->map;
+    if( 0 != memcmp( ar->header->magic, ARCHIVE_MAGIC, sizeof( ARCHIVE_MAGIC ) ) ){
+        corrupt( "bad magic" );
+    }
+    if( ARCHIVE_VERSION != ar->header->version ){
+        fprintf( stderr, "%s:%d:%s %s is archive version %"PRIu32", expected %"PRIu32".  Bye!\n",
+                __FILE__, __LINE__, __func__, filename, ar->header->version, ARCHIVE_VERSION );
+        exit(-1);
+    }
+    if( ar->header->index_offset > ar->len
+     || ( ar->len - ar->header->index_offset ) / sizeof( struct archive_block ) < ar->header->block_count ){
+        corrupt( "index past end of file" );
+    }
+    ar->index = (const struct archive_block*)( ar->map + ar->header->index_offset );
+    for( uint32_t blk = 0; blk < ar->header->block_count; blk++ ){
+        const struct archive_block *b = &ar->index[blk];
+        if( b->samples > ar->header->block_samples ){
+            corrupt( "block too long" );
+        }
+        if( b->offset < sizeof( struct archive_header ) ){
+            corrupt( "block inside header" );
+        }
+        // Written so that offset + bytes can't overflow.
+        if( b->bytes > ar->header->index_offset || b->offset > ar->header->index_offset - b->bytes ){
+            corrupt( "block past index" );
+        }
+    }
+    return ar;
+}
+
+void close_poll_archive( struct poll_archive *ar ){
+    munmap( (void*)ar->map, ar->len );
+    close( ar->fd );
+    free( ar );
+}
+
+size_t find_archive_block( const struct poll_archive *ar, uint64_t tsc ){
+    // The first block that ends at or after <tsc>; block_count if none does.
+    size_t lo = 0, hi = ar->header->block_count;
+    while( lo < hi ){
+        size_t mid = lo + ( hi - lo ) / 2;
+        if( ar->index[mid].last_tsc < tsc ){
+            lo = mid + 1;
+        }else{
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+uint32_t decode_archive_column( const struct poll_archive *ar, size_t block, archive_column_t column, uint64_t *out ){
+    // Fills out[0 .. samples-1] and returns samples, or returns 0 if the
+    // archive doesn't have this column.
+    assert( block < ar->header->block_count );
+    if( !( ar->header->column_mask & ( 1U << column ) ) ){
+        return 0;
+    }
+    const struct archive_block *b = &ar->index[ block ];
+    const uint8_t *p   = ar->map + b->offset;
+    const uint8_t *end = p + b->bytes;
+
+    // Skip the columns in front of this one.
+    uint32_t column_bytes = 0;
+    for( archive_column_t c = 0; c <= column; c++ ){
+        if( !( ar->header->column_mask & ( 1U << c ) ) ){
+            continue;
+        }
+        if( (size_t)( end - p ) < sizeof( column_bytes ) ){
+            corrupt( "column past end of block" );
+        }
+        memcpy( &column_bytes, p, sizeof( column_bytes ) );
+        if( column_bytes < sizeof( column_bytes ) + 1 || column_bytes > (size_t)( end - p ) ){
+            corrupt( "bad column length" );
+        }
+        if( c < column ){
+            p += column_bytes;
+        }
+    }
+    end = p + column_bytes;
+    uint8_t encoding = p[ sizeof( column_bytes ) ];
+    p += sizeof( column_bytes ) + 1;
+
+    uint64_t x;
+    if( NULL == ( p = get_varint( p, end, &x ) ) ){
+        corrupt( "truncated column" );
+    }
+    out[0] = x;
+    uint64_t delta = 0;
+    if( ARCHIVE_DELTA == encoding ){
+        for( uint32_t s = 1; s < b->samples; s++ ){
+            if( NULL == ( p = get_varint( p, end, &x ) ) ){
+                corrupt( "truncated column" );
+            }
+            out[s] = out[s-1] + (uint64_t)unzigzag( x );
+        }
+    }else if( ARCHIVE_DELTA_OF_DELTA == encoding ){
+        for( uint32_t s = 1; s < b->samples; s++ ){
+            if( NULL == ( p = get_varint( p, end, &x ) ) ){
+                corrupt( "truncated column" );
+            }
+            delta += (uint64_t)unzigzag( x );
+            out[s] = out[s-1] + delta;
+        }
+    }else{
+        corrupt( "unknown encoding" );
+    }
+    if( p != end ){
+        corrupt( "trailing bytes in column" );
+    }
+    return b->samples;
+}
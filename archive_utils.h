@@ -0,0 +1,62 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include "job.h"
+
+// -a/--archive writes each poll to poll_<n>.var instead of poll_<n>.raw and
+// poll_<n>_<msr>.tsv.  Samples are cut into blocks of ARCHIVE_BLOCK_SAMPLES.  Within
+// a block each column is stored as its first value followed by zigzag varints
+// of either successive deltas or deltas of deltas, whichever is smaller.  The
+// block index at the end of the file lets a reader go straight to a TSC range.
+// All integers are little-endian; like the rest of var, x86 only.
+
+static constexpr const uint32_t ARCHIVE_VERSION       = 1;
+static constexpr const uint32_t ARCHIVE_BLOCK_SAMPLES = 4096;
+static const char ARCHIVE_MAGIC[8] = { 'V', 'A', 'R', 'P', 'O', 'L', 'L', '\0' };
+
+typedef enum{                                   ARCHIVE_MSRDATA, ARCHIVE_MSRDATA2, ARCHIVE_TSC, ARCHIVE_MPERF, ARCHIVE_APERF, ARCHIVE_THERM, ARCHIVE_PTHERM, ARCHIVE_TAG, NUM_ARCHIVE_COLUMNS } archive_column_t;
+static const char * const archivecolumn2str[] = { "msrdata",       "msrdata2",       "tsc",       "mperf",       "aperf",       "therm",       "ptherm",       "tag"                        };
+
+typedef enum : uint8_t{ ARCHIVE_DELTA = 1, ARCHIVE_DELTA_OF_DELTA = 2 } archive_encoding_t;
+
+struct archive_header{
+    char                        magic[8];
+    uint32_t                    version;
+    uint32_t                    msr;
+    uint16_t                    cpu;
+    uint16_t                    flags;          // The poll's OP_* flags.
+    uint32_t                    column_mask;    // 1 << archive_column_t for each column present.
+    uint64_t                    sample_count;
+    uint32_t                    block_samples;
+    uint32_t                    block_count;
+    uint64_t                    index_offset;   // struct archive_block[ block_count ] lives here.
+};
+
+// A block is, for each column in column_mask order:  a uint32_t byte count
+// (including itself and the encoding byte), an archive_encoding_t, the first
+// value as a varint, and then samples-1 zigzag varints.
+struct archive_block{
+    uint64_t                    offset;         // From the start of the file.
+    uint64_t                    first_sample;
+    uint64_t                    first_tsc;      // 0 without a tsc column.
+    uint64_t                    last_tsc;       //  "
+    uint32_t                    samples;
+    uint32_t                    bytes;
+};
+
+struct poll_archive{
+    int                         fd;
+    const uint8_t               *map;
+    size_t                      len;
+    const struct archive_header *header;
+    const struct archive_block  *index;
+};
+
+// Writer
+void write_poll_archive( const char *filename, const struct poll_config *p );
+
+// Reader
+struct poll_archive* open_poll_archive( const char *filename );
+void close_poll_archive( struct poll_archive *ar );
+size_t find_archive_block( const struct poll_archive *ar, uint64_t tsc );
+uint32_t decode_archive_column( const struct poll_archive *ar, size_t block, archive_column_t column, uint64_t *out );
@@ -0,0 +1,152 @@
+#define _GNU_SOURCE
+#include <stdio.h>          // fprintf(3)
+#include <stdlib.h>         // exit(3), qsort(3)
+#include <errno.h>          // errno
+#include <assert.h>         // assert(3)
+#include <inttypes.h>       // PRIu64 etc.
+#include <sched.h>          // sched_setaffinity(2)
+#include <x86intrin.h>      // __rdtsc()
+#include "msr_backend.h"    // msr_batch()
+#include "powercap_utils.h" // read_powercap_op()
+#include "cadence_utils.h"
+
+// Give up if the value hasn't changed CADENCE_UPDATES times by then.
+static const struct timespec cadence_timeout = { .tv_sec = 2, .tv_nsec = 0 };
+
+// nanosleep(2)s timed to see how late the poll thread wakes up.
+static constexpr const size_t WAKE_SAMPLES = 8;
+
+static int compare_uint64( const void *a, const void *b ){
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return ( x > y ) - ( x < y );
+}
+
+static void calibrate_poll_cadence( struct poll_config *p, size_t i, int fd ){
+    // Runs on the control cpu, as the poll thread will.
+    assert( 0 == sched_setaffinity( 0, sizeof( cpu_set_t ), &( p->control_cpu ) ) );
+    struct poll_cadence *c = &p->cadence;
+    struct msr_batch_op op = *( p->poll_op );
+    op.op |= OP_TSC;
+    struct msr_batch_array batch = { .numops = 1, .version = p->poll_batch->version, .ops = &op };
+
+    // The TSC of each change.  A change that happens between two polls is
+    // missed, so some deltas span two (or more) updates.
+    uint64_t change[ CADENCE_UPDATES + 1 ];
+    size_t n = 0;
+    uint64_t give_up = __rdtsc() + timespec2tsc( &cadence_timeout );
+    while( n < CADENCE_UPDATES + 1 && __rdtsc() < give_up ){
+        errno = 0;
+        op.err = 0;
+        int rc = p->powercap ? read_powercap_op( p->powercap_fd, &op ) : msr_batch( fd, &batch );
+        if( -1 == rc ){
+            perror("");
+            fprintf( stderr, "%s:%d:%s Reading poll %zu (%s) failed, op err=%"PRId32".  Bye!\n",
+                    __FILE__, __LINE__, __func__, i, p->local_optarg, op.err );
+            exit(-1);
+        }
+        if( op.msrdata2 != op.msrdata ){
+            change[ n++ ] = op.tsc;
+        }
+    }
+    if( n < 8 ){
+        fprintf( stderr, "%s:%d:%s Poll %zu (%s) saw only %zu updates in %lds; it can't use an auto interval.  Bye!\n",
+                __FILE__, __LINE__, __func__, i, p->local_optarg, n, (long)cadence_timeout.tv_sec );
+        exit(-1);
+    }
+
+    // The median delta is one update, even with a few missed.  Count each
+    // delta as the nearest whole number of those.
+    uint64_t delta[ CADENCE_UPDATES ], sorted[ CADENCE_UPDATES ];
+    for( size_t k = 0; k + 1 < n; k++ ){
+        delta[k] = sorted[k] = change[ k + 1 ] - change[k];
+    }
+    qsort( sorted, n - 1, sizeof( uint64_t ), compare_uint64 );
+    uint64_t median = sorted[ ( n - 1 ) / 2 ];
+    uint64_t total = 0, updates = 0;
+    c->skipped = 0;
+    for( size_t k = 0; k + 1 < n; k++ ){
+        uint64_t m = ( delta[k] + median / 2 ) / median;
+        m = m ? m : 1;
+        c->skipped += ( m > 1 );
+        total   += delta[k];
+        updates += m;
+    }
+    c->updates    = n;
+    c->period_tsc = total / updates;
+    c->jitter_tsc = 0;
+    for( size_t k = 0; k + 1 < n; k++ ){
+        uint64_t m = ( delta[k] + median / 2 ) / median;
+        uint64_t expected = ( m ? m : 1 ) * c->period_tsc;
+        uint64_t off = delta[k] > expected ? delta[k] - expected : expected - delta[k];
+        c->jitter_tsc = off > c->jitter_tsc ? off : c->jitter_tsc;
+    }
+
+    // How late does a sleep for half a period end?
+    uint64_t half = tsc2ns( c->period_tsc / 2 );
+    struct timespec t = { .tv_sec = (time_t)( half / 1'000'000'000ULL ), .tv_nsec = (long)( half % 1'000'000'000ULL ) };
+    c->wake_tsc = 0;
+    for( size_t k = 0; k < WAKE_SAMPLES; k++ ){
+        uint64_t before = __rdtsc();
+        nanosleep( &t, NULL );
+        uint64_t late = __rdtsc() - before;
+        late = late > c->period_tsc / 2 ? late - c->period_tsc / 2 : 0;
+        c->wake_tsc = late > c->wake_tsc ? late : c->wake_tsc;
+    }
+
+    // Early enough to be spinning in OP_POLL when an update as early as any
+    // seen so far arrives, but never so early that a sample spans most of a
+    // period.
+    c->lead_tsc = 2 * c->jitter_tsc + c->wake_tsc;
+    c->lead_tsc = c->lead_tsc < c->period_tsc / 2 ? c->lead_tsc : c->period_tsc / 2;
+
+    uint64_t ns = tsc2ns( c->period_tsc );
+    p->interval.tv_sec  = (time_t)( ns / 1'000'000'000ULL );
+    p->interval.tv_nsec = (long)( ns % 1'000'000'000ULL );
+    fprintf( stderr, "%s:%d:%s Poll %zu updates every %"PRIu64" ns, jitter %"PRIu64" ns; waking %"PRIu64" ns early.\n",
+            __FILE__, __LINE__, __func__, i, ns, tsc2ns( c->jitter_tsc ), tsc2ns( c->lead_tsc ) );
+}
+
+void calibrate_poll_cadences( struct job *job ){
+    int fd = -1;
+    for( size_t i = 0; i < job->poll_count; i++ ){
+        if( !job->polls[i]->auto_interval ){
+            continue;
+        }
+        // Powercap polls pread(2) their zone and never touch the fd.
+        if( -1 == fd && !job->polls[i]->powercap ){
+            fd = msr_batch_open();
+            assert( -1 != fd );
+        }
+        calibrate_poll_cadence( job->polls[i], i, fd );
+    }
+    if( -1 != fd ){
+        msr_batch_close( fd );
+    }
+}
+
+void print_poll_cadences( FILE *fp, const struct job *job ){
+    bool header = false;
+    for( size_t i = 0; i < job->poll_count; i++ ){
+        const struct poll_config *p = job->polls[i];
+        if( !p->auto_interval ){
+            continue;
+        }
+        if( !header ){
+            fprintf( fp, "# auto poll intervals (measured update cadence)\n" );
+            fprintf( fp, "#\t%-6s %12s %12s %12s %8s %8s %10s %10s\n",
+                    "poll", "period_ns", "jitter_ns", "lead_ns", "updates", "skipped", "samples", "no_update" );
+            header = true;
+        }
+        // Samples where OP_POLL gave up before the value changed.
+        size_t stale = 0;
+        for( size_t b = 0; b < p->samples.count; b++ ){
+            stale += ( p->samples.msrdata2[b] == p->samples.msrdata[b] );
+        }
+        fprintf( fp, "#\t%-6zu %12"PRIu64" %12"PRIu64" %12"PRIu64" %8zu %8zu %10zu %10zu\n",
+                i, tsc2ns( p->cadence.period_tsc ), tsc2ns( p->cadence.jitter_tsc ), tsc2ns( p->cadence.lead_tsc ),
+                p->cadence.updates, p->cadence.skipped, p->samples.count, stale );
+    }
+    if( header ){
+        fprintf( fp, "#\n" );
+    }
+}
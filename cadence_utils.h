@@ -0,0 +1,38 @@
+#pragma once
+#include <stdio.h>
+#include <time.h>
+#include "job.h"
+#include "tsc_utils.h"      // tsc2ns()
+#define MSR_SAFE_USERSPACE
+#include "msr_safe.h"
+#undef MSR_SAFE_USERSPACE
+
+// -p ...:auto:...  RAPL energy counters (and the powercap files built on them)
+// update roughly, but not exactly, every millisecond.  Before the run, back to
+// back OP_POLLs time CADENCE_UPDATES changes of the value to measure the real
+// update period and its jitter.  During the run each sample is timed to start
+// lead_tsc before the next expected update, so OP_POLL returns just after it.
+
+static constexpr const size_t CADENCE_UPDATES = 64;
+
+void calibrate_poll_cadences( struct job *job );
+void print_poll_cadences( FILE *fp, const struct job *job );
+
+// Poll thread, in place of nanosleep( interval ).  *next_update is 0 at the
+// start of a run.
+static inline void sleep_until_next_update( const struct poll_cadence *c, const struct msr_batch_op *op, uint64_t *next_update ){
+    uint64_t now = __rdtsc();
+    if( op->msrdata2 != op->msrdata ){
+        // OP_POLL saw the update happen.
+        *next_update = ( ( op->op & OP_TSC ) ? op->tsc : now ) + c->period_tsc;
+    }else{
+        // It gave up first; stay on the old schedule.
+        *next_update = ( *next_update ? *next_update : now ) + c->period_tsc;
+    }
+    uint64_t wake = *next_update - c->lead_tsc;
+    if( wake > now ){
+        uint64_t ns = tsc2ns( wake - now );
+        struct timespec t = { .tv_sec = (time_t)( ns / 1'000'000'000ULL ), .tv_nsec = (long)( ns % 1'000'000'000ULL ) };
+        nanosleep( &t, NULL );
+    }
+}
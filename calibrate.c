@@ -0,0 +1,177 @@
+#define _GNU_SOURCE
+#include <stdlib.h>         // calloc(3), exit(3)
+#include <stdio.h>          // fprintf(3)
+#include <string.h>         // memset(3)
+#include <assert.h>         // assert(3)
+#include <stdint.h>         // uint64_t etc.
+#include <inttypes.h>       // PRIu64 etc.
+#include <sched.h>          // sched_setaffinity(2)
+#include <x86intrin.h>      // __rdtsc()
+#include "msr_version.h"    // MSR_SAFE_VERSION_u32
+#include "msr_utils.h"      // struct msr_batch_op, fprintf_flags(), MAX_POLL_ATTEMPTS
+#include "msr_backend.h"    // msr_batch()
+#include "tsc_utils.h"      // tsc2ns()
+#include "calibrate.h"
+
+// Log-linear buckets in the style of HdrHistogram with two significant
+// figures:  values below 128ns are exact, and every power of two above that
+// is split into 64 sub-buckets, so a bucket is never wider than 1/64 of its
+// value.
+static constexpr const size_t LINEAR_BUCKETS = 128;
+static constexpr const size_t SUB_BUCKETS = 64;
+static constexpr const size_t HISTOGRAM_BUCKETS = LINEAR_BUCKETS + 57 * SUB_BUCKETS;
+
+// Batches issued (and discarded) before timing, to warm caches and the IPI path.
+static constexpr const size_t WARMUP_BATCHES = 100;
+
+struct histogram{
+    uint64_t    counts[ HISTOGRAM_BUCKETS ];
+    uint64_t    total;
+    uint64_t    min;
+    uint64_t    max;
+    double      sum;
+};
+
+static const op_flag_t calibrated_flags[] = {
+    OP_READ,
+    OP_READ | OP_TSC,
+    OP_READ | OP_THERM | OP_PTHERM,
+    OP_READ | OP_ALL_MODS,
+    OP_POLL,
+    OP_POLL | OP_TSC,
+    OP_POLL | OP_ALL_MODS,
+};
+
+static size_t value2bucket( uint64_t v ){
+    if( v < LINEAR_BUCKETS ){
+        return v;
+    }
+    size_t shift = ( 63 - __builtin_clzll( v ) ) - 6;
+    return LINEAR_BUCKETS + ( shift - 1 ) * SUB_BUCKETS + ( ( v >> shift ) - SUB_BUCKETS );
+}
+
+static uint64_t bucket2value( size_t idx ){
+    // Highest value that lands in the bucket.
+    if( idx < LINEAR_BUCKETS ){
+        return idx;
+    }
+    size_t shift = ( idx - LINEAR_BUCKETS ) / SUB_BUCKETS + 1;
+    uint64_t sub = ( idx - LINEAR_BUCKETS ) % SUB_BUCKETS + SUB_BUCKETS;
+    return ( ( sub + 1 ) << shift ) - 1;
+}
+
+static void record( struct histogram *h, uint64_t v ){
+    size_t idx = value2bucket( v );
+    assert( idx < HISTOGRAM_BUCKETS );
+    h->counts[ idx ]++;
+    h->total++;
+    h->min = v < h->min ? v : h->min;
+    h->max = v > h->max ? v : h->max;
+    h->sum += v;
+}
+
+static void fprintf_histogram( FILE *fp, struct histogram *h ){
+    // Same columns as HdrHistogram's percentile distribution output.
+    fprintf( fp, "%12s %14s %10s %14s\n", "Value(ns)", "Percentile", "TotalCount", "1/(1-Percentile)" );
+    uint64_t cumulative = 0;
+    for( size_t idx = 0; idx < HISTOGRAM_BUCKETS; idx++ ){
+        if( 0 == h->counts[ idx ] ){
+            continue;
+        }
+        cumulative += h->counts[ idx ];
+        double percentile = (double)cumulative / h->total;
+        uint64_t value = bucket2value( idx ) < h->max ? bucket2value( idx ) : h->max;
+        if( cumulative == h->total ){
+            fprintf( fp, "%12"PRIu64" %14.12lf %10"PRIu64" %14s\n", value, percentile, cumulative, "inf" );
+        }else{
+            fprintf( fp, "%12"PRIu64" %14.12lf %10"PRIu64" %14.2lf\n", value, percentile, cumulative, 1.0 / ( 1.0 - percentile ) );
+        }
+    }
+    double mean = h->sum / h->total;
+    fprintf( fp, "#[Mean    = %12.3lf]\n", mean );
+    fprintf( fp, "#[Min     = %12"PRIu64", Max            = %12"PRIu64"]\n", h->min, h->max );
+    fprintf( fp, "#[Total count    = %12"PRIu64", Max samples/s = %12.0lf]\n", h->total, 1e9 / mean );
+}
+
+static void calibrate_one( FILE *fp, struct job *job, int fd, uint16_t control_cpu, uint16_t polled_cpu, op_flag_t flags ){
+
+    struct msr_batch_op op = {
+        .cpu      = polled_cpu,
+        .op       = flags,
+        .poll_max = MAX_POLL_ATTEMPTS,
+        .msr      = job->calibrate->msr,
+    };
+    struct msr_batch_array batch = { .numops = 1, .version = MSR_SAFE_VERSION_u32, .ops = &op };
+
+    fprintf( fp, "# control cpu %"PRIu16", polled cpu %"PRIu16", msr %#"PRIx32", flags ", control_cpu, polled_cpu, job->calibrate->msr );
+    fprintf_flags( fp, flags );
+    fprintf( fp, "\n" );
+
+    for( size_t w = 0; w < WARMUP_BATCHES; w++ ){
+        msr_batch( fd, &batch );
+    }
+    if( op.err ){
+        fprintf( fp, "# skipped:  op failed with err %"PRId32"\n\n", op.err );
+        return;
+    }
+
+    struct histogram *h = calloc( 1, sizeof( struct histogram ) );
+    assert( h );
+    h->min = UINT64_MAX;
+    size_t failures = 0;
+    for( size_t s = 0; s < job->calibrate->samples; s++ ){
+        uint64_t t0 = __rdtsc();
+        msr_batch( fd, &batch );
+        uint64_t t1 = __rdtsc();
+        if( op.err ){
+            failures++;
+            continue;
+        }
+        record( h, tsc2ns( t1 - t0 ) );
+    }
+    if( failures ){
+        fprintf( fp, "# %zu failed batches not recorded\n", failures );
+    }
+    if( h->total ){
+        fprintf_histogram( fp, h );
+    }
+    fprintf( fp, "\n" );
+    free( h );
+}
+
+void run_calibration( struct job *job ){
+
+    // Back-to-back single-op batches from each control cpu to each polled cpu,
+    // for each flag combination.  The reciprocal of the mean is the fastest
+    // a --poll could sample with that placement and those flags.
+    get_tsc_hz();
+    FILE *fp = fopen( "./calibrate.out", "w" );
+    if( fp == NULL ){
+        perror("");
+        fprintf( stderr, "%s:%d:%s Error opening file ./calibrate.out.  Bye!\n", __FILE__, __LINE__, __func__ );
+        exit(-1);
+    }
+    int fd = msr_batch_open();
+    assert( -1 != fd );
+    for( uint16_t control_cpu = 0; control_cpu < CPU_SETSIZE; control_cpu++ ){
+        if( !CPU_ISSET( control_cpu, &job->calibrate->control_cpus ) ){
+            continue;
+        }
+        cpu_set_t control;
+        CPU_ZERO( &control );
+        CPU_SET( control_cpu, &control );
+        assert( 0 == sched_setaffinity( 0, sizeof( cpu_set_t ), &control ) );
+        for( uint16_t polled_cpu = 0; polled_cpu < CPU_SETSIZE; polled_cpu++ ){
+            if( !CPU_ISSET( polled_cpu, &job->calibrate->polled_cpus ) ){
+                continue;
+            }
+            for( size_t f = 0; f < sizeof( calibrated_flags ) / sizeof( calibrated_flags[0] ); f++ ){
+                fprintf( stderr, "%s:%d:%s control cpu %"PRIu16", polled cpu %"PRIu16", flags %#x.\n",
+                        __FILE__, __LINE__, __func__, control_cpu, polled_cpu, (unsigned int)calibrated_flags[f] );
+                calibrate_one( fp, job, fd, control_cpu, polled_cpu, calibrated_flags[f] );
+            }
+        }
+    }
+    msr_batch_close( fd );
+    fclose( fp );
+}
@@ -0,0 +1,4 @@
+#pragma once
+#include "job.h"
+
+void run_calibration( struct job *job );
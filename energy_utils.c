@@ -0,0 +1,237 @@
+#define _GNU_SOURCE
+#include <stdlib.h>         // calloc(3)
+#include <string.h>         // memcpy(3)
+#include <assert.h>         // assert(3)
+#include <stdint.h>         // uint64_t etc.
+#include <inttypes.h>       // PRIu64 etc.
+#include <stdio.h>          // fprintf(3)
+#include <time.h>           // nanosleep(2)
+#include <pthread.h>        // pthread_[create|join](3p)
+#include <cpuid.h>          // __get_cpuid(3)
+#include "msr_utils.h"      // msr_t, struct msr_batch_array
+#include "msr_backend.h"    // msr_batch()
+#include "msr_version.h"    // MSR_SAFE_VERSION_u32
+#include "timespec_utils.h" // timespec_division()
+#include "topology_utils.h" // cpu2package()
+#include "energy_utils.h"
+
+// RAPL energy status registers are 32 bits wide; everything above is reserved.
+static constexpr const uint64_t ENERGY_STATUS_MASK = 0xFFFFFFFFULL;
+
+// How often the background reader checks for a halt request.
+static const struct timespec energy_tick = { .tv_sec = 0, .tv_nsec = 10'000'000L };
+
+static const char * energy_msr2str( uint32_t msr ){
+    switch( msr ){
+        case PKG_ENERGY_STATUS:         return "PKG";
+        case DRAM_ENERGY_STATUS:        return "DRAM";
+        case PP0_ENERGY_STATUS:         return "PP0";
+        case PP1_ENERGY_STATUS:         return "PP1";
+        case PLATFORM_ENERGY_COUNTER:   return "PLATFORM";
+        default:                        return "UNKNOWN";
+    }
+}
+
+static void accumulate( struct longitudinal_config *lng, size_t k, uint64_t msrdata ){
+    // Unsigned subtraction modulo 2^32 is correct so long as we read at least
+    // once per wrap, which is what the background reader is for.
+    msrdata &= ENERGY_STATUS_MASK;
+    lng->energy_total[k] += ( msrdata - lng->energy_prev[k] ) & ENERGY_STATUS_MASK;
+    lng->energy_prev[k]   = msrdata;
+}
+
+static void* energy_thread_start( void *v ){
+
+    // Inherits the main thread's affinity, so this runs on main_cpu.
+    struct longitudinal_config *lng = v;
+    struct timespec tick = energy_tick;
+    if( timespec_division( &lng->energy_interval, &tick ) == 0 ){
+        tick = lng->energy_interval;
+    }
+    size_t ticks_per_read = timespec_division( &lng->energy_interval, &tick );
+
+    int fd = msr_batch_open();
+    assert( -1 != fd );
+    for( size_t t = 1; !(lng->energy_halt); t++ ){
+        nanosleep( &tick, NULL );
+        if( t % ticks_per_read ){
+            continue;
+        }
+        // Ignore the return code; unsupported domains (e.g., PP1 on servers)
+        // fail individually and are skipped below.
+        msr_batch( fd, lng->energy_batch );
+        for( size_t k = 0; k < lng->energy_batch->numops; k++ ){
+            if( 0 == lng->energy_batch->ops[k].err ){
+                accumulate( lng, k, lng->energy_batch->ops[k].msrdata );
+            }
+        }
+        lng->energy_reads++;
+    }
+    msr_batch_close( fd );
+    return NULL;
+}
+
+void start_energy_accumulators( struct job *job ){
+    // Called right after the START batches have run; their values are the baseline.
+    // With -w/--sweep this is once per trial, so drop the last trial's totals.
+    teardown_energy_accumulators( job );
+    for( size_t i = 0; i < job->longitudinal_count; i++ ){
+        struct longitudinal_config *lng = job->longitudinals[i];
+        if( lng->longitudinal_type != ENERGY_COUNTERS || NULL == lng->batches[ START ] ){
+            continue;
+        }
+        size_t n = lng->batches[ START ]->numops;
+        lng->energy_batch       = calloc( 1, sizeof( struct msr_batch_array ) );
+        assert( lng->energy_batch );
+        lng->energy_batch->numops  = n;
+        lng->energy_batch->version = lng->batches[ START ]->version;
+        lng->energy_batch->ops     = calloc( n, sizeof( struct msr_batch_op ) );
+        lng->energy_prev        = calloc( n, sizeof( uint64_t ) );
+        lng->energy_total       = calloc( n, sizeof( uint64_t ) );
+        assert( lng->energy_batch->ops && lng->energy_prev && lng->energy_total );
+        memcpy( lng->energy_batch->ops, lng->batches[ START ]->ops, n * sizeof( struct msr_batch_op ) );
+        for( size_t k = 0; k < n; k++ ){
+            lng->energy_prev[k] = lng->batches[ START ]->ops[k].msrdata & ENERGY_STATUS_MASK;
+        }
+        lng->energy_halt  = false;
+        lng->energy_reads = 0;
+        assert( 0 == pthread_create( &( lng->energy_thread ), NULL, energy_thread_start, lng ) );
+    }
+}
+
+void stop_energy_accumulators( struct job *job ){
+    for( size_t i = 0; i < job->longitudinal_count; i++ ){
+        struct longitudinal_config *lng = job->longitudinals[i];
+        if( lng->longitudinal_type != ENERGY_COUNTERS || NULL == lng->energy_batch ){
+            continue;
+        }
+        lng->energy_halt = true;
+        assert( 0 == pthread_join( lng->energy_thread, NULL ) );
+    }
+}
+
+void finalize_energy_accumulators( struct job *job ){
+    // Called after the READ batches have run.  Fold in the final reading for
+    // each START op, matched by cpu and msr.
+    for( size_t i = 0; i < job->longitudinal_count; i++ ){
+        struct longitudinal_config *lng = job->longitudinals[i];
+        if( lng->longitudinal_type != ENERGY_COUNTERS || NULL == lng->energy_batch || NULL == lng->batches[ READ ] ){
+            continue;
+        }
+        for( size_t k = 0; k < lng->energy_batch->numops; k++ ){
+            struct msr_batch_op *s = &( lng->batches[ START ]->ops[k] );
+            for( size_t r = 0; r < lng->batches[ READ ]->numops; r++ ){
+                struct msr_batch_op *o = &( lng->batches[ READ ]->ops[r] );
+                if( o->cpu == s->cpu && o->msr == s->msr && 0 == o->err ){
+                    accumulate( lng, k, o->msrdata );
+                    break;
+                }
+            }
+        }
+    }
+}
+
+static bool has_fixed_dram_energy_unit( void ){
+    // Server parts use a fixed 15.3uJ DRAM energy unit regardless of what
+    // RAPL_POWER_UNIT says.  (Same list as the kernel's intel_rapl driver.)
+    unsigned int eax, ebx, ecx, edx;
+    if( 0 == __get_cpuid( 1, &eax, &ebx, &ecx, &edx ) || ( ( eax >> 8 ) & 0xF ) != 6 ){
+        return false;
+    }
+    unsigned int model = ( ( eax >> 4 ) & 0xF ) | ( ( eax >> 12 ) & 0xF0 );
+    switch( model ){
+        case 0x3F:  // Haswell-X
+        case 0x4F:  // Broadwell-X
+        case 0x56:  // Broadwell-DE
+        case 0x55:  // Skylake-X, Cascade Lake, Cooper Lake
+        case 0x57:  // Knights Landing
+        case 0x85:  // Knights Mill
+        case 0x6A:  // Ice Lake-X
+        case 0x6C:  // Ice Lake-D
+        case 0x8F:  // Sapphire Rapids
+        case 0xCF:  // Emerald Rapids
+            return true;
+        default:
+            return false;
+    }
+}
+
+static double joules_per_count( struct longitudinal_config *lng, uint16_t cpu, uint32_t msr ){
+    // Energy status units are RAPL_POWER_UNIT[12:8], 1/2^ESU joules.
+    if( msr == DRAM_ENERGY_STATUS && has_fixed_dram_energy_unit() ){
+        return 1.0 / ( 1ULL << 16 );
+    }
+    struct msr_batch_array *b = lng->batches[ READ ];
+    for( size_t r = 0; b && r < b->numops; r++ ){
+        if( b->ops[r].cpu == cpu && b->ops[r].msr == RAPL_POWER_UNIT && 0 == b->ops[r].err ){
+            return 1.0 / ( 1ULL << ( ( b->ops[r].msrdata >> 8 ) & 0x1F ) );
+        }
+    }
+    return 0.0;
+}
+
+double read_joules_per_count( uint16_t cpu, uint32_t msr ){
+    // Same as above, for callers without a longitudinal READ batch to look in.
+    if( msr == DRAM_ENERGY_STATUS && has_fixed_dram_energy_unit() ){
+        return 1.0 / ( 1ULL << 16 );
+    }
+    struct msr_batch_op op = { .cpu = cpu, .op = OP_READ, .msr = RAPL_POWER_UNIT };
+    struct msr_batch_array b = { .numops = 1, .version = MSR_SAFE_VERSION_u32, .ops = &op };
+    int fd = msr_batch_open();
+    if( -1 == fd ){
+        return 0.0;
+    }
+    int rc = msr_batch( fd, &b );
+    msr_batch_close( fd );
+    if( -1 == rc || op.err ){
+        return 0.0;
+    }
+    return 1.0 / ( 1ULL << ( ( op.msrdata >> 8 ) & 0x1F ) );
+}
+
+void dump_energy_accumulators( struct job *job ){
+    for( size_t i = 0; i < job->longitudinal_count; i++ ){
+        struct longitudinal_config *lng = job->longitudinals[i];
+        if( lng->longitudinal_type != ENERGY_COUNTERS || NULL == lng->energy_batch ){
+            continue;
+        }
+        static char filename[2048];
+        snprintf( filename, 2047, "./longitudinal_%zu_%s_JOULES.out", i, longitudinaltype2str[ lng->longitudinal_type ] );
+        FILE *fp = fopen( filename, "w" );
+        if( fp == NULL ){
+            perror("");
+            fprintf( stderr, "%s:%d:%s Error opening file %s.  Bye!\n", __FILE__, __LINE__, __func__, filename );
+            exit(-1);
+        }
+        fprintf( fp, "# %zu background reads every ", lng->energy_reads );
+        fprintf_timespec( fp, &( lng->energy_interval ) );
+        fprintf( fp, "\n" );
+        fprintf( fp, "cpu package domain msr count joules\n" );
+        for( size_t k = 0; k < lng->energy_batch->numops; k++ ){
+            struct msr_batch_op *s = &( lng->batches[ START ]->ops[k] );
+            if( 0 != s->err ){
+                continue;   // Domain not present on this processor.
+            }
+            fprintf( fp, "%"PRIu16" %u %s %#"PRIx32" %"PRIu64" %.6lf\n",
+                    (uint16_t)s->cpu, cpu2package( s->cpu ), energy_msr2str( s->msr ), (uint32_t)s->msr,
+                    lng->energy_total[k], lng->energy_total[k] * joules_per_count( lng, s->cpu, s->msr ) );
+        }
+        fclose( fp );
+    }
+}
+
+void teardown_energy_accumulators( struct job *job ){
+    for( size_t i = 0; i < job->longitudinal_count; i++ ){
+        struct longitudinal_config *lng = job->longitudinals[i];
+        if( NULL == lng->energy_batch ){
+            continue;
+        }
+        free( lng->energy_batch->ops );
+        free( lng->energy_batch );
+        free( lng->energy_prev );
+        free( lng->energy_total );
+        lng->energy_batch = NULL;
+        lng->energy_prev  = NULL;
+        lng->energy_total = NULL;
+    }
+}
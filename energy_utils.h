@@ -0,0 +1,9 @@
+#pragma once
+#include "job.h"
+
+void start_energy_accumulators( struct job *job );
+void stop_energy_accumulators( struct job *job );
+void finalize_energy_accumulators( struct job *job );
+void dump_energy_accumulators( struct job *job );
+void teardown_energy_accumulators( struct job *job );
+double read_joules_per_count( uint16_t cpu, uint32_t msr );
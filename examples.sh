@@ -16,3 +16,78 @@
 
 
 
+
+# Same, letting var place the benchmarks on the most isolated socket and
+# the main and poll control threads on cores of the other one.
+#./var -m auto \
+#    --benchmark=ABXOR:auto:1:0:0 \
+#    --poll=0x611:OP_POLL+OP_TSC+DELTA_TSC+OP_THERM+OP_PTHERM+DELTA_THERM+DELTA_PTHERM:500us:auto:8 \
+#    --time=10m \
+#    --abTime=100ms
+
+# An hour-long run, written as a compact archive (poll_0.var) rather than text.
+# Build the reader with "make archive", then e.g. ./var-archive poll_0.var
+#./var -m 0 \
+#    --benchmark=ABXOR:9-14:1:0:0 \
+#    --poll=0x611:OP_POLL+OP_TSC+OP_MPERF+OP_APERF:1ms:2:8 \
+#    --archive \
+#    --time=1h \
+#    --abTime=100ms
+
+# Watch a run while it goes:  publish it with --live and, from another shell,
+# run "./var-top /var-run 1s" (build it with "make top").
+#./var -m 0 \
+#    --benchmark=ABXOR:9-14:1:0:0 \
+#    --poll=0x611:OP_POLL+OP_TSC+OP_THERM:1ms:2:8 \
+#    --live=/var-run \
+#    --time=10m \
+#    --abTime=100ms
+
+# Four trials in one process (a|b times x poll intervals), each written to its
+# own trial_<k>/ directory; sweep.out lists them.  --sweep=@file reads one trial
+# per line instead, e.g. "param1=hw8 abTime=50ms".
+#./var -m 0 \
+#    --benchmark=ABXOR:9-14:1:0:0 \
+#    --poll=0x611:OP_POLL+OP_TSC:1ms:2:8 \
+#    --sweep=abTime=50ms,100ms/interval=1ms,2ms \
+#    --time=1m
+
+# Let var find the RAPL update period and poll just after each update; the
+# measured period and jitter are at the end of job.out.
+#./var -m 0 \
+#    --benchmark=ABXOR:9-14:1:0:0 \
+#    --poll=0x611:OP_POLL+OP_TSC:auto:2:8 \
+#    --time=1m \
+#    --abTime=100ms
+
+# A balanced random a|b order (four a and four b in every eight phases), then
+# the same phases again from the schedule.out the first run wrote.
+#./var -m 0 \
+#    --benchmark=ABXOR:9-14:1:0:0 \
+#    --poll=0x611:OP_POLL+OP_TSC:1ms:2:8 \
+#    --abSequence=balanced:8:42 \
+#    --time=1m \
+#    --abTime=100ms
+#./var -m 0 \
+#    --benchmark=ABXOR:9-14:1:0:0 \
+#    --poll=0x611:OP_POLL+OP_TSC:1ms:2:8 \
+#    --abSequence=replay:schedule.out
+
+# Four working-set sizes interleaved in one run (phases A-D), in a random
+# order that visits each of them four times in every 16 phases.
+#./var -m 0 \
+#    --benchmark=ABXOR:9-14:1,8,64,512:0:0 \
+#    --poll=0x611:OP_POLL+OP_TSC:1ms:2:8 \
+#    --abSequence=balanced \
+#    --time=10m \
+#    --abTime=100ms
+
+# Let each benchmark thread switch phases itself on precomputed TSC deadlines,
+# rather than waiting to see the main thread's write; phases.out shows how
+# closely the threads agree.
+#./var -m 0 \
+#    --benchmark=ABSHIFT:9-14:hw8:hw56:1 \
+#    --poll=0x611:OP_POLL+OP_TSC:1ms:2:8 \
+#    --selfTimed=256 \
+#    --time=1m \
+#    --abTime=10ms
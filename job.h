@@ -8,8 +8,13 @@
 typedef enum{                                      SPIN,   ABSHIFT,   ABXOR  } benchmark_t;
 static const char * const benchmarktype2str[] = { "SPIN", "ABSHIFT", "ABXOR" };
 
-typedef enum{                                        FIXED_FUNCTION_COUNTERS,   ALL_ALLOWED, NUM_LONGITUDINAL_FUNCTIONS, } longitudinal_t;
-static const char * const longitudinaltype2str[] = {"FIXED_FUNCTION_COUNTERS", "ALL_ALLOWED"                             };
+typedef enum{                                        FIXED_FUNCTION_COUNTERS,   ALL_ALLOWED,   GENERAL_PURPOSE_COUNTERS,   ENERGY_COUNTERS,   CAPFREQUENCY,   COLDSTART,   ZEROAMPERF, NUM_LONGITUDINAL_FUNCTIONS, } longitudinal_t;
+static const char * const longitudinaltype2str[] = {"FIXED_FUNCTION_COUNTERS", "ALL_ALLOWED", "GENERAL_PURPOSE_COUNTERS", "ENERGY_COUNTERS", "CAPFREQUENCY", "COLDSTART", "ZEROAMPERF"                             };
+
+constexpr static const size_t MAX_GENERAL_PURPOSE_COUNTERS = 8;
+
+// Phases are A, B, C, ... up to this many; see struct job.
+constexpr static const size_t MAX_PHASES = 8;
 
 typedef enum{
     // For longitudinal recipes like fixed function performance counters, we want
@@ -23,18 +28,71 @@ typedef enum{
 static const char * const longitudinalslot2str[] = {"SETUP", "START", "STOP", "READ", "TEARDOWN"                                  };
 
 
+struct start_barrier{
+    // Poll and benchmark threads increment arrived and then spin until
+    // release_tsc is nonzero and has passed.  See start_barrier_wait().
+    size_t                      arrived;
+    uint64_t                    release_tsc;
+};
+
+// getrusage(RUSAGE_THREAD) differences from just before the start barrier to
+// the end of the measured interval.  See thread_usage_[start|stop]().
+struct thread_usage{
+    long                        minflt;
+    long                        majflt;
+    long                        nvcsw;
+    long                        nivcsw;
+};
+
+// Poll samples as columns, one entry per sample.  Only the columns the poll's
+// flags fill in are allocated; the rest stay NULL.  The cpu, msr, flags, etc.
+// are the same for every sample and live in the poll's template op.
+struct poll_samples{
+    size_t                      count;          // Samples actually taken.
+    uint64_t                    *msrdata;       // Always.
+    uint64_t                    *msrdata2;      // OP_POLL
+    uint64_t                    *tsc;           // OP_TSC
+    uint64_t                    *mperf;         // OP_MPERF
+    uint64_t                    *aperf;         // OP_APERF
+    uint64_t                    *therm;         // OP_THERM
+    uint64_t                    *ptherm;        // OP_PTHERM
+    uint8_t                     *tag;           // ( phase << 1 ) | valid
+};
+
+// What calibrate_poll_cadence() measured for a poll with an auto interval.
+struct poll_cadence{
+    size_t                      updates;        // Value changes timed.
+    size_t                      skipped;        // Deltas that spanned more than one update.
+    uint64_t                    period_tsc;     // Mean time between updates.
+    uint64_t                    jitter_tsc;     // Largest deviation from a whole number of periods.
+    uint64_t                    wake_tsc;       // Largest nanosleep(2) overshoot.
+    uint64_t                    lead_tsc;       // Start polling this long before an expected update.
+};
+
 struct poll_config{
     char *                      local_optarg;
     uint32_t                    msr;
     uint16_t                    flags;
     struct timespec             interval;
+    bool                        auto_interval;  // <timespec> was auto:  interval is the measured
+    struct poll_cadence         cadence;        //   update period.  See cadence_utils.h.
     cpu_set_t                   control_cpu;
     cpu_set_t                   polled_cpu;
     size_t                      total_ops;      // 1 cpu x 1024 polls/sec * expected seconds
-    struct msr_batch_array      *poll_batches;
-    struct msr_batch_op         *poll_ops;      // Each batch points to a single op (the POLL instruction)
+    struct msr_batch_array      *poll_batch;    // Reissued for every sample...
+    struct msr_batch_op         *poll_op;       // ...and points to this single op (the POLL instruction).
+    struct poll_samples         samples;        // What poll_op returned, sample by sample.
+    struct live_poll            *live;          // -L/--live ring; NULL otherwise.
     pthread_t                   poll_thread;
-    pthread_mutex_t             poll_mutex;
+    uint64_t                    start_tsc;      // TSC when this thread left the start barrier.
+    struct thread_usage         usage;
+
+    // <msr_address>@powercap:  pread(2) the matching powercap zone's energy_uj
+    // instead of issuing batches.  msrdata is then in uJ.
+    bool                        powercap;
+    char                        *powercap_zone;         // Zone directory.
+    int                         powercap_fd;            // Held open on energy_uj.
+    uint64_t                    powercap_max_range;     // max_energy_range_uj; counts wrap past this.
 
     // The idea here is that we want to capture the current "encrypted" output at each
     // sample without using synchronization.  All benchmark threads will be moving their
@@ -48,57 +106,227 @@ struct poll_config{
 
 };
 
+// -D/--selfTimed:  a benchmark thread's place in the phase schedule, which it
+// follows on its own; see advance_phase_cursor().
+struct phase_cursor{
+    const uint64_t              *offset_tsc;    // The schedule's, from base_tsc.
+    const uint8_t               *selector;      //  "
+    size_t                      count;          // Phases in the schedule.
+    size_t                      next;           // The next one to start.
+    uint64_t                    base_tsc;       // The start barrier's release TSC.
+    uint64_t                    next_tsc;       // When it starts; UINT64_MAX after the last.
+    size_t                      transitions;    // Phase changes so far, as the main thread counts them.
+    uint8_t                     phase;          // The one running now.
+};
+
 struct benchmark_config{
     // NOTE:  There is a benchmark config per benchmark per thread.
     benchmark_t                 benchmark_type;
     cpu_set_t                   execution_cpu;
-    uint64_t                    benchmark_param1;
-    uint64_t                    benchmark_param2;
-    uint64_t                    benchmark_param3;
-    uint64_t                    executed_loops[2];
+    uint64_t                    phase_param[ MAX_PHASES ][3];  // <param1..3> for each phase.
+    uint8_t                     phase_param_count[3];       // Values given for each of <param1..3>:
+                                                            //   1 (the same in every phase) or the job's phases.
+    uint64_t                    executed_loops[ MAX_PHASES ];
+    _Atomic uint64_t            *live_loops;    // -L/--live:  this thread's row of loop counts; NULL otherwise.
     pthread_t                   benchmark_thread;
-    pthread_mutex_t             benchmark_mutex;
+    uint64_t                    start_tsc;      // TSC when this thread left the start barrier.
+    struct thread_usage         usage;
     volatile bool               *halt;
-    volatile bool               *ab_selector;   // See notes in struct job.
+    volatile uint8_t            *phase;         // See notes in struct job; &cursor.phase if self-timed.
+    struct phase_cursor         cursor;         // -D/--selfTimed only.
+    uint64_t                    check_loops;    //  "  Loops between TSC reads.
+    volatile size_t             *phase_transition_count;    // See notes in struct job.
+    uint64_t                    *phase_tsc;     // TSC at which this thread first observed each
+                                                //   phase change, indexed by transition.
+                                                //   Zero if the change was never observed.
 
+    const uint64_t              *abxor_table;   // ABXOR:  the replica on this thread's NUMA node.
     uint64_t                    key;
     uint64_t                    single_output;
 };
 
+// One perf_event_open(2) group per sample cpu:  instructions (the leader),
+// cycles and ref-cycles, in FIXED_CTR0..2 order.
+constexpr static const size_t PERF_GROUP_EVENTS = 3;
+struct perf_group{
+    uint16_t                    cpu;
+    int                         fd                                   [ PERF_GROUP_EVENTS ];
+    void                        *mmap_page                           [ PERF_GROUP_EVENTS ];  // struct perf_event_mmap_page
+};
+
+// One sample cpu's share of a longitudinal's READ batch, sampled periodically.
+// values holds snapshot_max rows of nops values; tsc holds one entry per row
+// (the TSC of that cpu's first op).
+struct snapshot_series{
+    uint16_t                    cpu;
+    size_t                      nops;
+    size_t                      *op_idx;        // Indices into snapshot_batch->ops.
+    uint64_t                    *tsc;
+    uint64_t                    *values;
+};
+
 struct longitudinal_config{
     longitudinal_t              longitudinal_type;
     cpu_set_t                   sample_cpus;
+    char                        *params;        // Optional third field of -l, type-specific.
+
+    // GENERAL_PURPOSE_COUNTERS:  raw IA32_PERFEVTSELx values (umask << 8 | event,
+    // plus any of INV/EDGE/CMASK), one per programmable counter.
+    uint64_t                    events                               [ MAX_GENERAL_PURPOSE_COUNTERS ];
+    size_t                      event_count;
+
+    // ENERGY_COUNTERS:  a background thread on the main cpu re-reads the START
+    // batch every energy_interval so that no 32-bit wrap goes unnoticed.
+    // energy_total[k] is the wrap-corrected count for START op k.
+    struct timespec             energy_interval;
+    pthread_t                   energy_thread;
+    volatile bool               energy_halt;
+    struct msr_batch_array      *energy_batch;
+    uint64_t                    *energy_prev;
+    uint64_t                    *energy_total;
+    size_t                      energy_reads;       // Number of background reads taken.
+
+    // CAPFREQUENCY:  the ratio PERF_CTL (and HWP_REQUEST, where supported) is
+    // pinned to between SETUP and TEARDOWN.
+    uint64_t                    ratio;
+
+    // COLDSTART:  after SETUP, wait up to coldstart_timeout for every sample cpu
+    // to be at least coldstart_margin degrees C below its TCC activation point.
+    struct timespec             coldstart_timeout;
+    uint64_t                    coldstart_margin;
+    struct timespec             coldstart_waited;
+    bool                        coldstart_reached;
+
+    // --snapshot:  a thread on snapshot_cpu re-issues a copy of the READ batch
+    // every snapshot_interval between START and STOP.  A zero interval means
+    // no snapshots.
+    struct timespec             snapshot_interval;
+    cpu_set_t                   snapshot_cpu;
+    pthread_t                   snapshot_thread;
+    volatile bool               snapshot_halt;
+    struct msr_batch_array      *snapshot_batch;
+    struct snapshot_series      *snapshot_series;
+    size_t                      snapshot_series_count;
+    size_t                      snapshot_max;       // Rows preallocated per series.
+    size_t                      snapshot_count;     // Rows filled.
+
+    // FIXED_FUNCTION_COUNTERS:<sample_cpus>:perf counts instructions, cycles and
+    // ref-cycles with one perf_event_open(2) group per sample cpu instead of
+    // programming the fixed counters through msr-safe.  The READ batch is
+    // still built (and dumped) as usual, but filled in from the groups.
+    bool                        use_perf;
+    struct perf_group           *perf_groups;
+    size_t                      perf_group_count;
+
+    // Recipes built at runtime from the parameters above.  When runtime_recipe
+    // is set, these replace longitudinal_recipes[ longitudinal_type ][ slot ]
+    // for every slot.
+    bool                        runtime_recipe;
+    struct msr_batch_op         *runtime_ops                         [ NUM_LONGITUDINAL_EXECUTION_SLOTS ];
+    size_t                      runtime_op_count                     [ NUM_LONGITUDINAL_EXECUTION_SLOTS ];
 
     size_t                      longitudinal_batch_count_per_type[ NUM_LONGITUDINAL_EXECUTION_SLOTS ];
     //struct msr_batch_array*     longitudinal_batches             [ NUM_LONGITUDINAL_EXECUTION_SLOTS ];
 
     struct msr_batch_array*     batches                              [ NUM_LONGITUDINAL_EXECUTION_SLOTS ];
 
+    // Only used with --parallelLongitudinal, and only for START and STOP.  One
+    // batch per package, indexed by package id, pointing into batches[ slot ]->ops
+    // (which are reordered so that each package's ops are contiguous).  A package
+    // with no ops in this longitudinal has numops == 0.
+    struct msr_batch_array*     socket_batches                       [ NUM_LONGITUDINAL_EXECUTION_SLOTS ];
+
+    // max - min of the per-op TSCs after START and STOP.
+    uint64_t                    spread_tsc                           [ NUM_LONGITUDINAL_EXECUTION_SLOTS ];
+
 };
 
 
+// --calibrate:  time single-op batches from each control cpu to each polled cpu
+// instead of running a job.
+struct calibrate_config{
+    uint32_t                    msr;
+    cpu_set_t                   control_cpus;
+    cpu_set_t                   polled_cpus;
+    size_t                      samples;
+};
+
+// An MSR the setup-time probe could not read on one cpu type, and which was
+// therefore stripped from every longitudinal op on cpus of that type.
+struct dropped_msr{
+    uint32_t                    msr;
+    unsigned int                cpu_type;       // cpu_type_t, see topology_utils.h.
+    uint16_t                    probe_cpu;
+    int32_t                     err;
+};
+
 struct job{
 
     // Job
     cpu_set_t                   main_cpu;
     struct timespec             duration;           // (seconds:nanoseconds) main sleeps this long (nanosleep is thread-safe).
-    bool                        ab_randomized;      // If true, randomly select whether to run A or B next.  False alternates.
+    struct phase_schedule       *schedule;          // Which of A or B runs when; see phase_utils.h.
     struct timespec             ab_duration;        // (seconds:nanoseconds) how long each A|B instance executes.
 
     // Internal
     volatile bool               halt;               // The big red off button.
-    volatile bool               ab_selector;        // Select whether we're running workload A or B
+    size_t                      phases;             // How many workloads (A, B, C, ...) the benchmarks run.
+    bool                        self_timed;         // -D/--selfTimed:  benchmarks switch on TSC deadlines.
+    uint64_t                    check_loops;        //   Loops between their TSC reads; 0 for each type's default.
+    volatile uint8_t            phase;              // Select which of them is running now.
                                                     //   WRITTEN TO by the main thread.
                                                     //   READ BY the benchmark thread and the polling thread.
-    volatile bool               valid;              // Set invalid during A->B or B->A transition, as the
+    volatile bool               valid;              // Set invalid at each phase transition, as the
                                                     //   polling sample will straddle portions of both.
                                                     //   WRITTEN TO by the main thread and the polling thread.
                                                     //   READ BY the polling thread
 
+    // Start barrier shared by the poll and benchmark threads.
+    struct start_barrier        start;
+    uint64_t                    main_start_tsc;     // TSC when the main thread began the a|b loop.
+    struct thread_usage         main_usage;
+
+    // -z/--zeroFault:  poll buffers are huge-page backed and prefaulted on the
+    // control cpu's node, and all memory is locked before START.
+    bool                        zero_fault;
+    bool                        memory_locked;      // mlockall(2) succeeded.
+
+    // -a/--archive:  polls are written as poll_<n>.var; see archive_utils.h.
+    bool                        archive;
+
+    // -L/--live:  samples and phase published in this POSIX shared-memory
+    // object while the run goes; see live_utils.h.
+    char                        *live_name;
+    struct live_header          *live;
+    size_t                      live_len;
+
+    // -w/--sweep:  run trial_count trials back to back with the same threads;
+    // see sweep_utils.h.  Without it there's a single trial.
+    char                        *sweep_spec;
+    struct sweep                *sweep;
+    volatile size_t             trial;              // The one running; trial_count once they're done.
+    size_t                      trial_count;
+
+    // -F/--fifo:  main, poll and benchmark threads run SCHED_FIFO at these
+    // priorities (and memory is locked as for zero_fault).
+    bool                        fifo;
+    int                         main_priority;
+    int                         poll_priority;
+    int                         benchmark_priority;
+
+    // Phase transition log.  The main thread records the TSC of every phase
+    // change before making it visible; benchmark threads use the count to index
+    // their own per-thread logs.  All arrays hold max_phase_transitions entries.
+    uint64_t                    *phase_tsc;         // TSC of each phase change.
+    uint8_t                     *phase_selector;    // Value of phase after each change.
+    volatile size_t             phase_transition_count;
+    size_t                      max_phase_transitions;
+
 
     // Polls
     struct poll_config          **polls;
     size_t                      poll_count;         // The number of -p/--poll options parsed on the command line.
+    char                        *powercap_root;     // Where to find intel-rapl zones for @powercap polls.
 
     // Benchmarks
     struct benchmark_config     **benchmarks;
@@ -107,6 +335,12 @@ struct job{
     // Longitudinals
     struct longitudinal_config  **longitudinals;
     size_t                      longitudinal_count; // The number of -l/--longitudinal options parsed on the command line.
+    bool                        parallel_longitudinals; // Issue START/STOP from one helper thread per package.
+    size_t                      package_count;      // max package id + 1 across longitudinal sample cpus.
+    struct calibrate_config     *calibrate;         // NULL unless --calibrate.
+    struct dropped_msr          *dropped;           // Filled by the setup-time probe.
+    size_t                      dropped_count;
+    size_t                      dropped_op_count;   // Ops removed from the longitudinal batches.
 
 
 };
@@ -0,0 +1,144 @@
+#define _GNU_SOURCE
+#include <stdio.h>          // fprintf(3)
+#include <stdlib.h>         // exit(3)
+#include <string.h>         // memcpy(3)
+#include <fcntl.h>          // O_* constants
+#include <unistd.h>         // ftruncate(2), close(2), getpid(2)
+#include <sys/mman.h>       // shm_open(3), mmap(2)
+#include "msr_utils.h"      // PKG_ENERGY_STATUS etc.
+#include "tsc_utils.h"      // get_tsc_hz()
+#include "energy_utils.h"   // read_joules_per_count()
+#include "live_utils.h"
+
+static size_t round_up_64( size_t x ){
+    return ( x + 63 ) & ~(size_t)63;
+}
+
+static bool is_energy_msr( uint32_t msr ){
+    return msr == PKG_ENERGY_STATUS
+        || msr == PP0_ENERGY_STATUS
+        || msr == PP1_ENERGY_STATUS
+        || msr == DRAM_ENERGY_STATUS
+        || msr == PLATFORM_ENERGY_COUNTER;
+}
+
+void setup_live( struct job *job ){
+    if( NULL == job->live_name ){
+        return;
+    }
+    // Each benchmark's row of loop counts is a cache line of its own.
+    size_t loops_offset = round_up_64( sizeof( struct live_header ) + job->benchmark_count * sizeof( uint64_t ) );
+    size_t poll_offset  = round_up_64( loops_offset + job->benchmark_count * MAX_PHASES * sizeof( uint64_t ) );
+    size_t poll_stride = round_up_64( sizeof( struct live_poll ) + LIVE_RING_SLOTS * sizeof( struct live_slot ) );
+    job->live_len = poll_offset + job->poll_count * poll_stride;
+
+    int fd = shm_open( job->live_name, O_CREAT | O_TRUNC | O_RDWR, 0644 );
+    if( -1 == fd ){
+        perror("");
+        fprintf( stderr, "%s:%d:%s Unable to create shared memory object %s.  Bye!\n", __FILE__, __LINE__, __func__, job->live_name );
+        exit(-1);
+    }
+    if( -1 == ftruncate( fd, (off_t)job->live_len ) ){
+        perror("");
+        fprintf( stderr, "%s:%d:%s Unable to size %s to %zu bytes.  Bye!\n", __FILE__, __LINE__, __func__, job->live_name, job->live_len );
+        exit(-1);
+    }
+    struct live_header *h = mmap( NULL, job->live_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+    if( MAP_FAILED == h ){
+        perror("");
+        fprintf( stderr, "%s:%d:%s Unable to map %s.  Bye!\n", __FILE__, __LINE__, __func__, job->live_name );
+        exit(-1);
+    }
+    close( fd );
+
+    h->version          = LIVE_VERSION;
+    h->ring_slots       = LIVE_RING_SLOTS;
+    h->poll_count       = (uint32_t)job->poll_count;
+    h->benchmark_count  = (uint32_t)job->benchmark_count;
+    h->poll_offset      = poll_offset;
+    h->poll_stride      = poll_stride;
+    h->tsc_hz           = get_tsc_hz();
+    h->duration_ns      = (uint64_t)job->duration.tv_sec * 1'000'000'000ULL + (uint64_t)job->duration.tv_nsec;
+    h->pid              = (uint64_t)getpid();
+    h->phases           = job->phases;
+    h->loops_offset     = loops_offset;
+
+    for( size_t b = 0; b < job->benchmark_count; b++ ){
+        job->benchmarks[b]->live_loops = get_live_loops( h, b );
+    }
+
+    for( size_t i = 0; i < job->poll_count; i++ ){
+        struct poll_config *pll = job->polls[i];
+        struct live_poll *p = get_live_poll( h, i );
+        p->msr          = pll->msr;
+        p->cpu          = (uint16_t)pll->poll_op->cpu;
+        p->flags        = pll->flags;
+        p->interval_ns  = (uint64_t)pll->interval.tv_sec * 1'000'000'000ULL + (uint64_t)pll->interval.tv_nsec;
+        if( pll->powercap ){
+            p->joules_per_count = 1e-6;
+            p->wrap             = pll->powercap_max_range + 1;
+        }else if( is_energy_msr( pll->msr ) ){
+            p->joules_per_count = read_joules_per_count( p->cpu, pll->msr );
+            p->wrap             = 1ULL << 32;
+        }
+        pll->live = p;
+    }
+
+    // Readers check the magic last.
+    atomic_thread_fence( memory_order_release );
+    memcpy( h->magic, LIVE_MAGIC, sizeof( h->magic ) );
+    job->live = h;
+    fprintf( stderr, "%s:%d:%s Live telemetry in shared memory object %s.\n", __FILE__, __LINE__, __func__, job->live_name );
+}
+
+void publish_live_status( struct job *job ){
+    // Main thread only.
+    struct live_header *h = job->live;
+    if( NULL == h ){
+        return;
+    }
+    uint64_t seq = atomic_load_explicit( &h->seq, memory_order_relaxed );
+    atomic_store_explicit( &h->seq, seq + 1, memory_order_relaxed );
+    atomic_thread_fence( memory_order_release );
+
+    size_t t = job->phase_transition_count;
+    h->start_tsc            = job->main_start_tsc;
+    h->phase_tsc            = t ? job->phase_tsc[ t - 1 ] : 0;
+    h->phase_transitions    = t;
+    h->phase                = job->phase;
+    h->halted               = job->halt && job->trial + 1 >= job->trial_count;  // The last trial.
+    for( size_t b = 0; b < job->benchmark_count; b++ ){
+        // The newest transition this benchmark has timestamped.  Only moves
+        // forward within a trial.  SPIN never looks at the selector.
+        if( SPIN == job->benchmarks[b]->benchmark_type ){
+            continue;
+        }
+        const uint64_t *seen = job->benchmarks[b]->phase_tsc;
+        if( h->observed[b] > t ){
+            h->observed[b] = 0;     // A new -w/--sweep trial.
+        }
+        for( size_t k = t; seen && k > h->observed[b]; k-- ){
+            if( seen[ k - 1 ] ){
+                h->observed[b] = k;
+                break;
+            }
+        }
+    }
+
+    atomic_store_explicit( &h->seq, seq + 2, memory_order_release );
+}
+
+void teardown_live( struct job *job ){
+    if( NULL == job->live ){
+        return;
+    }
+    for( size_t i = 0; i < job->poll_count; i++ ){
+        job->polls[i]->live = NULL;
+    }
+    for( size_t b = 0; b < job->benchmark_count; b++ ){
+        job->benchmarks[b]->live_loops = NULL;
+    }
+    munmap( job->live, job->live_len );
+    shm_unlink( job->live_name );   // Readers still attached keep their mapping.
+    job->live = NULL;
+}
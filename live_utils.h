@@ -0,0 +1,116 @@
+#pragma once
+#include <stdint.h>
+#include <stdatomic.h>
+#include "job.h"
+
+// -L/--live publishes each poll's samples, the current a|b phase, how far
+// each benchmark has followed it and how many loops it has run into a POSIX
+// shared-memory object that var-top (or anything else) can map read-only
+// while the run is going.
+//
+// Layout:  struct live_header, then uint64_t observed[ benchmark_count ], then
+// benchmark_count rows of MAX_PHASES loop counts at loops_offset, then
+// poll_count struct live_poll at poll_offset, poll_stride bytes apart.
+//
+// Each benchmark thread stores its own row of loop counts, relaxed, every so
+// often and when it stops; the counts are for the current -w/--sweep trial.
+//
+// The header's status fields are guarded by a seqlock:  the main thread makes
+// seq odd, writes, then makes it even again.  Each ring slot has its own
+// sequence number, 2n+2 once sample n is completely written there, so a
+// reader can tell a stale or half-written slot from the one it wants.  Writers
+// never wait for readers; a reader that falls LIVE_RING_SLOTS behind just
+// loses samples.
+
+static constexpr const uint32_t LIVE_VERSION    = 2;
+static constexpr const uint32_t LIVE_RING_SLOTS = 4096;    // Power of 2.
+static const char LIVE_MAGIC[8] = { 'V', 'A', 'R', 'L', 'I', 'V', 'E', '\0' };
+
+struct live_slot{
+    _Atomic uint64_t            seq;
+    uint64_t                    tsc;            // op->tsc with OP_TSC, otherwise read after the sample.
+    uint64_t                    msrdata;        // The last value seen:  msrdata2 with OP_POLL.
+    uint64_t                    therm;
+    uint64_t                    ptherm;
+    uint64_t                    tag;            // ( phase << 1 ) | valid
+};
+
+struct live_poll{
+    uint32_t                    msr;
+    uint16_t                    cpu;
+    uint16_t                    flags;
+    double                      joules_per_count;   // 0 if msrdata isn't energy.
+    uint64_t                    wrap;           // msrdata wraps modulo this; 0 if it doesn't.
+    uint64_t                    interval_ns;
+    _Atomic uint64_t            head;           // Samples published so far.
+    struct live_slot            ring[];         // LIVE_RING_SLOTS
+};
+
+struct live_header{
+    char                        magic[8];
+    uint32_t                    version;
+    uint32_t                    ring_slots;
+    uint32_t                    poll_count;
+    uint32_t                    benchmark_count;
+    uint64_t                    poll_offset;
+    uint64_t                    poll_stride;
+    uint64_t                    tsc_hz;
+    uint64_t                    duration_ns;
+    uint64_t                    pid;
+    uint64_t                    phases;         // Loop counts per benchmark that mean anything.
+    uint64_t                    loops_offset;
+
+    // Written by the main thread under seq.
+    _Atomic uint64_t            seq;
+    uint64_t                    start_tsc;      // 0 until the run starts.
+    uint64_t                    phase_tsc;      // When the current phase began.
+    uint64_t                    phase_transitions;
+    uint64_t                    phase;          // 0 for A, 1 for B, ...
+    uint64_t                    halted;
+    uint64_t                    observed[];     // Transitions each benchmark has seen so far.
+};
+
+static inline struct live_poll* get_live_poll( const struct live_header *h, size_t i ){
+    return (struct live_poll*)( (char*)h + h->poll_offset + i * h->poll_stride );
+}
+
+static inline _Atomic uint64_t* get_live_loops( const struct live_header *h, size_t b ){
+    return (_Atomic uint64_t*)( (char*)h + h->loops_offset ) + b * MAX_PHASES;
+}
+
+// Writer (var)
+void setup_live( struct job *job );
+void publish_live_status( struct job *job );
+void teardown_live( struct job *job );
+
+static inline void publish_live_sample( struct live_poll *p, uint64_t tsc, uint64_t msrdata, uint64_t therm, uint64_t ptherm, uint8_t tag ){
+    // One writer per ring, so plain loads of head are fine here.
+    uint64_t n = atomic_load_explicit( &p->head, memory_order_relaxed );
+    struct live_slot *s = &p->ring[ n & ( LIVE_RING_SLOTS - 1 ) ];
+    atomic_store_explicit( &s->seq, 2 * n + 1, memory_order_relaxed );
+    atomic_thread_fence( memory_order_release );
+    s->tsc     = tsc;
+    s->msrdata = msrdata;
+    s->therm   = therm;
+    s->ptherm  = ptherm;
+    s->tag     = tag;
+    atomic_store_explicit( &s->seq, 2 * n + 2, memory_order_release );
+    atomic_store_explicit( &p->head, n + 1, memory_order_release );
+}
+
+// Reader side of a slot:  false if sample n has been overwritten or is still
+// being written.
+static inline bool read_live_sample( const struct live_poll *p, uint64_t n, struct live_slot *out ){
+    const struct live_slot *s = &p->ring[ n & ( LIVE_RING_SLOTS - 1 ) ];
+    uint64_t seq = atomic_load_explicit( &s->seq, memory_order_acquire );
+    if( seq != 2 * n + 2 ){
+        return false;
+    }
+    out->tsc     = s->tsc;
+    out->msrdata = s->msrdata;
+    out->therm   = s->therm;
+    out->ptherm  = s->ptherm;
+    out->tag     = s->tag;
+    atomic_thread_fence( memory_order_acquire );
+    return seq == atomic_load_explicit( &s->seq, memory_order_relaxed );
+}
@@ -1,7 +1,7 @@
 #define _GNU_SOURCE     // CPU_SET(3) (affecting sched.h)
 #include <errno.h>      // errno
 #include <assert.h>     // discount error checking
-#include <pthread.h>    // PTHREAD_MUTEX_INITIALIZER, pthread_mutex_[lock|unlock](3p)
+#include <pthread.h>    // pthread_[create|join](3p)
 #include <sched.h>      // cpu_set_t and friends, CPU_SETSIZE, sched_[get|set]affinity(2)
 #include <getopt.h>     // getopt_long(3)
 #include <stdlib.h>     // exit(3), malloc(3), random(3), srandom(3)
@@ -15,6 +15,7 @@
 #include <fcntl.h>      // open(2)
 #include <unistd.h>     // close(2)
 #include <sys/ioctl.h>  // ioctl(2)
+#include <x86intrin.h>  // __rdtsc()
 #include "msr_safe.h"   // struct msr_batch_array, struct msr_batch_op, X86_IOC_MSR_BATCH
 #include "msr_version.h" //MSR_SAFE_VERSION_u32
 #include "spin.h"       // the spin benchmark
@@ -25,7 +26,18 @@
 #include "cpuset_utils.h"       // str2cpuset()
 #include "int_utils.h"          // safe_strtoull()
 #include "msr_utils.h"          // setup_msrsafe_batches()
+#include "msr_backend.h"        // msr_batch()
 #include "options.h"            // parse_options()
+#include "tsc_utils.h"          // start_barrier_[wait|release]()
+#include "calibrate.h"          // run_calibration()
+#include "powercap_utils.h"     // read_powercap_op()
+#include "sample_utils.h"       // store_poll_sample()
+#include "live_utils.h"         // publish_live_sample() etc.
+#include "memory_utils.h"       // measurement_alloc(), thread_usage_[start|stop]()
+#include "sched_utils.h"        // set_fifo_priority(), check_isolation()
+#include "sweep_utils.h"        // setup_sweep(), apply_sweep_trial() etc.
+#include "cadence_utils.h"      // sleep_until_next_update()
+#include "phase_utils.h"        // build_phase_schedule(), sleep_until_phase() etc.
 
 static void sizeof_check( void ){
         assert( 4 == sizeof( int ) );
@@ -37,8 +49,14 @@ static void sizeof_check( void ){
 }
 static struct job job;
 
+// Poll and benchmark threads wait at trial_end after each trial and at
+// trial_next while the main thread writes its output and sets up the next one.
+static pthread_barrier_t trial_end, trial_next;
+
 static void cleanup( void ){
-    free( job.polls[0]->benchmark_output );
+    if( job.poll_count ){
+        measurement_free( job.polls[0]->benchmark_output );
+    }
     for( size_t i = 0; i < job.poll_count; i++ ){
         free( job.polls[i]->local_optarg );
         free( job.polls[i] );
@@ -49,6 +67,7 @@ static void cleanup( void ){
 
     // benchmarks
     for( size_t i = 0; i < job.benchmark_count; i++ ){
+        free( job.benchmarks[i]->phase_tsc );
         free( job.benchmarks[i] );
     }
     free( job.benchmarks );
@@ -56,11 +75,71 @@ static void cleanup( void ){
 
     // longitudinals
     for( size_t i = 0; i < job.longitudinal_count; i++ ){
+        free( job.longitudinals[i]->params );
         free( job.longitudinals[i] );
         job.longitudinals[i] = NULL;
     }
     free( job.longitudinals );
     job.longitudinals = NULL;
+    free( job.dropped );
+    job.dropped = NULL;
+    free( job.calibrate );
+    job.calibrate = NULL;
+    free( job.live_name );
+    job.live_name = NULL;
+    teardown_sweep( &job );
+    free( job.sweep_spec );
+    job.sweep_spec = NULL;
+    teardown_phase_schedule( &job );
+
+    // phase transition log
+    free( job.phase_tsc );
+    free( job.phase_selector );
+    job.phase_tsc = NULL;
+    job.phase_selector = NULL;
+}
+
+static void set_phase( uint8_t next ){
+    // Log the transition before making it visible to the benchmark threads.
+    if( job.phase_transition_count < job.max_phase_transitions ){
+        job.phase_tsc     [ job.phase_transition_count ] = __rdtsc();
+        job.phase_selector[ job.phase_transition_count ] = next;
+        job.phase_transition_count++;
+    }
+    job.phase = next;
+    publish_live_status( &job );
+}
+
+static bool wait_for_next_trial( void ){
+    // Poll and benchmark threads, after each trial.  The main thread runs STOP
+    // and READ, writes the output and resets everything between the two.
+    pthread_barrier_wait( &trial_end );
+    pthread_barrier_wait( &trial_next );
+    return job.trial < job.trial_count;
+}
+
+static void reset_trial( void ){
+    // Main thread, between trials:  put back what the last trial used up.  The
+    // threads are parked in wait_for_next_trial().
+    job.halt                    = false;
+    job.phase                   = 0;
+    job.valid                   = false;
+    job.phase_transition_count  = 0;
+    job.main_start_tsc          = 0;
+    job.start.arrived           = 0;
+    job.start.release_tsc       = 0;
+    memset( job.phase_tsc,      0, job.max_phase_transitions * sizeof( uint64_t ) );
+    memset( job.phase_selector, 0, job.max_phase_transitions * sizeof( uint8_t ) );
+    memset( &job.main_usage,    0, sizeof( job.main_usage ) );
+    for( size_t i = 0; i < job.poll_count; i++ ){
+        job.polls[i]->samples.count = 0;
+        memset( &( job.polls[i]->usage ), 0, sizeof( job.polls[i]->usage ) );
+    }
+    for( size_t i = 0; i < job.benchmark_count; i++ ){
+        memset( job.benchmarks[i]->executed_loops, 0, sizeof( job.benchmarks[i]->executed_loops ) );
+        memset( job.benchmarks[i]->phase_tsc, 0, job.max_phase_transitions * sizeof( uint64_t ) );
+        memset( &( job.benchmarks[i]->usage ), 0, sizeof( job.benchmarks[i]->usage ) );
+    }
 }
 
 void* poll_thread_start( void *v ){
@@ -70,32 +149,62 @@ void* poll_thread_start( void *v ){
 
     size_t i = (size_t)v;
     assert( 0 == sched_setaffinity( 0, sizeof( cpu_set_t ), &( job.polls[i]->control_cpu ) ) );
-    int fd = open( "/dev/cpu/msr_batch", O_RDONLY );
-    assert( -1 != fd );
-    assert( 0 == pthread_mutex_lock( &(job.polls[i]->poll_mutex) ) );
-    for( size_t b = 0; b < job.polls[i]->total_ops && !(job.halt); b++ ){
-        errno = 0;
-        int rc = ioctl( fd, X86_IOC_MSR_BATCH, &(job.polls[i]->poll_batches[b]) );
-        job.polls[i]->poll_ops[b].tag = ( job.ab_selector << 1 ) | ( job.valid );
-        job.valid = true;   // Set to false by the main thread, below, after A->B or B->A transition.
-        if( -1 == rc ){
-            fprintf( stderr, "%s:%d:%s ioctl in poll thread %zu batch %zu returned %d, errno=%d.\n",
-                    __FILE__, __LINE__, __func__, i, b, rc, errno );
-            perror("");
-            exit(-1);
-        }
-        if( job.polls[i]->benchmark_output && job.polls[i]->single_output_ptr){
-            job.polls[i]->benchmark_output[b] = *(job.polls[i]->single_output_ptr);
-        }
-        // Grab the first key that shows up.
-        if( !(job.polls[i]->key) ){
-            if( job.polls[i]->key_ptr ){
-                job.polls[i]->key = *(job.polls[i]->key_ptr);
+    int fd = -1;
+    if( !job.polls[i]->powercap ){
+        fd = msr_batch_open();
+        assert( -1 != fd );
+    }
+    if( job.fifo ){
+        set_fifo_priority( job.poll_priority, "poll" );
+    }
+    // One batch, reissued for every sample; only the fields the flags asked
+    // for are copied out of it.  See store_poll_sample().
+    struct msr_batch_op *op = job.polls[i]->poll_op;
+    do{
+        thread_usage_start( &(job.polls[i]->usage) );
+        start_barrier_wait( &job.start, &(job.polls[i]->start_tsc) );
+        uint64_t next_update = 0;   // Auto interval only.
+        for( size_t b = 0; b < job.polls[i]->total_ops && !(job.halt); b++ ){
+            errno = 0;
+            op->err = 0;
+            int rc = job.polls[i]->powercap
+                   ? read_powercap_op( job.polls[i]->powercap_fd, op )
+                   : msr_batch( fd, job.polls[i]->poll_batch );
+            uint8_t tag = (uint8_t)( ( job.phase << 1 ) | ( job.valid ) );
+            job.valid = true;   // Set to false by the main thread, below, after each phase transition.
+            if( -1 == rc ){
+                fprintf( stderr, "%s:%d:%s ioctl in poll thread %zu batch %zu returned %d, errno=%d.\n",
+                        __FILE__, __LINE__, __func__, i, b, rc, errno );
+                perror("");
+                exit(-1);
+            }
+            store_poll_sample( &(job.polls[i]->samples), b, op, tag );
+            if( job.polls[i]->live ){
+                publish_live_sample( job.polls[i]->live,
+                                     ( op->op & OP_TSC  ) ? op->tsc      : __rdtsc(),
+                                     ( op->op & OP_POLL ) ? op->msrdata2 : op->msrdata,
+                                     op->therm, op->ptherm, tag );
+            }
+            if( job.polls[i]->benchmark_output && job.polls[i]->single_output_ptr){
+                job.polls[i]->benchmark_output[b] = *(job.polls[i]->single_output_ptr);
+            }
+            // Grab the first key that shows up.
+            if( !(job.polls[i]->key) ){
+                if( job.polls[i]->key_ptr ){
+                    job.polls[i]->key = *(job.polls[i]->key_ptr);
+                }
+            }
+            if( job.polls[i]->auto_interval ){
+                sleep_until_next_update( &(job.polls[i]->cadence), op, &next_update );
+            }else{
+                nanosleep( &job.polls[i]->interval, NULL );
             }
         }
-        nanosleep( &job.polls[i]->interval, NULL );
+        thread_usage_stop( &(job.polls[i]->usage) );
+    }while( wait_for_next_trial() );
+    if( -1 != fd ){
+        msr_batch_close( fd );
     }
-    close( fd );
     return 0;
 }
 
@@ -103,34 +212,70 @@ void* benchmark_thread_start( void *v ){
 
     size_t benchmark_idx = (size_t)v;
     assert( 0 == sched_setaffinity( 0, sizeof( cpu_set_t ), &( job.benchmarks[ benchmark_idx ]->execution_cpu ) ) );
-    assert( 0 == pthread_mutex_lock( &(job.benchmarks[ benchmark_idx ]->benchmark_mutex) ) );
-    if( job.benchmarks[ benchmark_idx ]->benchmark_type == SPIN ){
-        run_spin( job.benchmarks[ benchmark_idx ] );
-    }else if( job.benchmarks[ benchmark_idx ]->benchmark_type == ABSHIFT ){
-        run_abshift( job.benchmarks[ benchmark_idx ] );
-    }else if( job.benchmarks[ benchmark_idx ]->benchmark_type == ABXOR ){
-        run_abxor( job.benchmarks[ benchmark_idx ] );
+    if( job.fifo ){
+        set_fifo_priority( job.benchmark_priority, "benchmark" );
     }
+    do{
+        thread_usage_start( &(job.benchmarks[ benchmark_idx ]->usage) );
+        start_barrier_wait( &job.start, &(job.benchmarks[ benchmark_idx ]->start_tsc) );
+        if( job.self_timed ){
+            start_phase_cursor( job.benchmarks[ benchmark_idx ], job.schedule, job.start.release_tsc );
+        }
+        if( job.benchmarks[ benchmark_idx ]->benchmark_type == SPIN ){
+            run_spin( job.benchmarks[ benchmark_idx ] );
+        }else if( job.benchmarks[ benchmark_idx ]->benchmark_type == ABSHIFT ){
+            run_abshift( job.benchmarks[ benchmark_idx ] );
+        }else if( job.benchmarks[ benchmark_idx ]->benchmark_type == ABXOR ){
+            run_abxor( job.benchmarks[ benchmark_idx ] );
+        }
+        thread_usage_stop( &(job.benchmarks[ benchmark_idx ]->usage) );
+    }while( wait_for_next_trial() );
     return 0;
 }
 
 int main( int argc, char **argv ){
 
     srandom(13);
-    setup_abxor();      // only needed for abxor.
     sizeof_check();
     parse_options( argc, argv, &job );
-    populate_allowlist();
+    setup_sweep( &job );    // Leaves the job at the envelope of the trials for the setup below.
+    setup_abxor( &job );    // Needs the ABXOR cpus to place the table replicas.
+    if( needs_msrsafe( &job ) ){
+        populate_allowlist();
+    }
+    if( job.calibrate ){
+        run_calibration( &job );
+        cleanup();
+        return 0;
+    }
     setup_msrsafe_batches( &job );
+    get_tsc_hz();       // Calibrate now rather than while threads are spinning.
+    setup_live( &job );
     // Pin the main thread to the cpu requested.
     assert( 0 == sched_setaffinity( 0, sizeof( cpu_set_t ), &( job.main_cpu) ) );
+    check_isolation( &job );
+    if( job.fifo ){
+        set_fifo_priority( job.main_priority, "main" );
+    }
+
+    // Phase transition log.  At most one transition per phase of the longest
+    // schedule, plus slack.
+    job.max_phase_transitions = max_phase_count( &job ) + 2;
+    job.phase_tsc      = calloc( job.max_phase_transitions, sizeof( uint64_t ) );
+    job.phase_selector = calloc( job.max_phase_transitions, sizeof( uint8_t ) );
+    assert( job.phase_tsc && job.phase_selector );
+
+    // SETUP runs before any thread exists:  COLDSTART waits here, and spinning
+    // poll/benchmark threads would keep the cores warm.
+    run_longitudinal_batches( &job, SETUP );
+    fprintf( stderr, "%s:%d:%s Longitudinal batches SETUP completed.\n", __FILE__, __LINE__, __func__ );
 
     // Poll thread initialization
+    assert( 0 == pthread_barrier_init( &trial_end,  NULL, job.poll_count + job.benchmark_count + 1 ) );
+    assert( 0 == pthread_barrier_init( &trial_next, NULL, job.poll_count + job.benchmark_count + 1 ) );
     for( size_t i = 0; i < job.poll_count; i++ ){
 
         // Set up the single thread in each poll
-        assert( 0 == pthread_mutex_init( &(job.polls[i]->poll_mutex), NULL ) );
-        assert( 0 == pthread_mutex_lock( &(job.polls[i]->poll_mutex) ) );
         assert( 0 == pthread_create(     &(job.polls[i]->poll_thread), NULL, poll_thread_start, (void*)i ) );
 
         if( 0 == i ){
@@ -148,7 +293,8 @@ int main( int argc, char **argv ){
         // Setup for instance 0.
         if( 0 == i && job.benchmarks[0]->benchmark_type == ABXOR ){     // Setup output only once, only for ABXOR,
             if( job.poll_count > 0 ){                                   // and only if we're polling.
-                job.polls[0]->benchmark_output = calloc( job.polls[0]->total_ops, sizeof( uint64_t ) );
+                job.polls[0]->benchmark_output = measurement_alloc( job.polls[0]->total_ops * sizeof( uint64_t ),
+                                                                    &job.polls[0]->control_cpu, job.zero_fault );
                 assert( job.polls[0]->benchmark_output );
                 job.polls[0]->single_output_ptr = &(job.benchmarks[0]->single_output);
                 job.polls[0]->key_ptr = &(job.benchmarks[0]->key);
@@ -156,63 +302,98 @@ int main( int argc, char **argv ){
             }
         }
 
-        // Point to the global halt and ab_selector variables
+        // Point to the global halt and phase variables
         job.benchmarks[i]->halt          = &job.halt;
-        job.benchmarks[i]->ab_selector   = &job.ab_selector;
+        job.benchmarks[i]->phase         = &job.phase;
+        if( job.self_timed && SPIN != job.benchmarks[i]->benchmark_type ){
+            setup_self_timed_benchmark( &job, job.benchmarks[i] );
+        }
+
+        // Per-thread phase transition log
+        job.benchmarks[i]->phase_transition_count = &job.phase_transition_count;
+        job.benchmarks[i]->phase_tsc     = calloc( job.max_phase_transitions, sizeof( uint64_t ) );
+        assert( job.benchmarks[i]->phase_tsc );
 
         // Set up each thread.
-        assert( 0 == pthread_mutex_init( &(job.benchmarks[i]->benchmark_mutex), NULL ) );
-        assert( 0 == pthread_mutex_lock( &(job.benchmarks[i]->benchmark_mutex) ) );
         assert( 0 == pthread_create(     &(job.benchmarks[i]->benchmark_thread), NULL, benchmark_thread_start, (void*)i ) );
     }
     fprintf( stderr, "%s:%d:%s Benchmark thread initialization completed.\n", __FILE__, __LINE__, __func__ );
 
 
-    run_longitudinal_batches( &job, SETUP );
-    run_longitudinal_batches( &job, START );
-    fprintf( stderr, "%s:%d:%s Longitudinal batches SETUP and START  completed.\n", __FILE__, __LINE__, __func__ );
-
-    // Poll thread start
-    for( size_t i = 0; i < job.poll_count; i++ ){
-        assert( 0 == pthread_mutex_unlock( &(job.polls[i]->poll_mutex ) ) );
-    }
-
-    // Benchmark thread start
-    for( uint32_t i = 0; i < job.benchmark_count; i++ ){
-        assert( 0 == pthread_mutex_unlock( &(job.benchmarks[i]->benchmark_mutex ) ) );
-    }
-
-    // Sleep (note nanosleep does not rely on signals and is safe for multithreaded use).
-    struct timespec elapsed;
-    elapsed.tv_sec  = 0;
-    elapsed.tv_nsec = 0;;
-    uint64_t iterations[64] = {0,0};
-    do{
-        if( job.ab_randomized ){
-            bool next = random() & 0x1;
+    // Every buffer and thread stack exists now.
+    lock_memory( &job );
+
+    // One pass per -w/--sweep trial; just the one without it.
+    apply_sweep_trial( &job, 0 );
+    build_phase_schedule( &job );
+    for( size_t t = 0; t < job.trial_count; t++ ){
+        enter_sweep_trial( &job, t );
+
+        thread_usage_start( &job.main_usage );
+        run_longitudinal_batches( &job, START );
+        fprintf( stderr, "%s:%d:%s Longitudinal batches START completed.\n", __FILE__, __LINE__, __func__ );
+
+        // Poll and benchmark thread start.  Everyone (main included) leaves the
+        // barrier when the TSC passes a common deadline.
+        const struct timespec start_lead = { .tv_sec = 0, .tv_nsec = 1'000'000L };
+        uint64_t release_tsc = start_barrier_release( &job.start, job.poll_count + job.benchmark_count, &start_lead );
+        spin_until_tsc( release_tsc );
+        job.main_start_tsc = __rdtsc();
+        publish_live_status( &job );
+
+        // Each phase starts on its own deadline from here, so the time the
+        // main thread spends switching doesn't push back the phases after it.
+        // Self-timed benchmarks switch on their own at the same TSC deadlines;
+        // the main thread follows for the poll tags and the transition log.
+        struct timespec run_start;
+        clock_gettime( CLOCK_MONOTONIC, &run_start );
+        struct phase_schedule *schedule = job.schedule;
+        for( size_t k = 0; k < schedule->phase_count; k++ ){
+            if( job.self_timed ){
+                sleep_until_tsc( release_tsc + schedule->offset_tsc[k] );
+            }else{
+                sleep_until_phase( &run_start, schedule->offset_ns[k] );
+            }
+            schedule->tsc[k] = __rdtsc();
             // Don't invalidate the current poll if we're still doing the same benchmark workload.
-            if( job.ab_selector != next ){
-                job.ab_selector = next;
+            if( job.phase != schedule->selector[k] ){
+                set_phase( schedule->selector[k] );
                 job.valid = false;
             }
+        }
+        if( job.self_timed ){
+            sleep_until_tsc( release_tsc + schedule->offset_tsc[ schedule->phase_count ] );
         }else{
-            job.ab_selector = ! job.ab_selector;
-            job.valid = false;
+            sleep_until_phase( &run_start, schedule->offset_ns[ schedule->phase_count ] );
         }
-
-        nanosleep( &(job.ab_duration), NULL );
-
-        iterations[ job.ab_selector ]++;
-
-        elapsed.tv_sec =
-            job.ab_duration.tv_sec    + elapsed.tv_sec +
-            ( job.ab_duration.tv_nsec + elapsed.tv_nsec > 999'999'999L ? 1 : 0 );
-        elapsed.tv_nsec = ( job.ab_duration.tv_nsec + elapsed.tv_nsec ) % 999'999'999L;
-    }while( elapsed.tv_sec < job.duration.tv_sec );
-    fprintf( stderr, "%s:%d:%s Shutting down.\n", __FILE__, __LINE__, __func__ );
-
-    // Ring the bell.
-    job.halt = true;
+        schedule->tsc[ schedule->phase_count ] = __rdtsc();
+        fprintf( stderr, "%s:%d:%s Shutting down.\n", __FILE__, __LINE__, __func__ );
+
+        // Ring the bell.
+        job.halt = true;
+        thread_usage_stop( &job.main_usage );
+        publish_live_status( &job );
+
+        // Every poll and benchmark thread is done with this trial.
+        pthread_barrier_wait( &trial_end );
+        fprintf( stderr, "%s:%d:%s  Poll and benchmark threads stopped.\n", __FILE__, __LINE__, __func__ );
+
+        run_longitudinal_batches( &job, STOP );
+        run_longitudinal_batches( &job, READ );
+        fprintf( stderr, "%s:%d:%s  Longitudinal batches STOP and READ complete.\n", __FILE__, __LINE__, __func__ );
+        dump_batches( &job );
+        dump_phase_schedule( &job );
+        print_summary( &job );
+        leave_sweep_trial( &job );
+
+        if( t + 1 < job.trial_count ){
+            reset_trial();
+            apply_sweep_trial( &job, t + 1 );
+            build_phase_schedule( &job );
+        }
+        job.trial = t + 1;
+        pthread_barrier_wait( &trial_next );
+    }
 
     // Benchmark thread join
     for( uint32_t i = 0; i < job.benchmark_count; i++ ){
@@ -225,18 +406,9 @@ int main( int argc, char **argv ){
         assert( 0 == pthread_join( job.polls[i]->poll_thread, NULL ) );
     }
     fprintf( stderr, "%s:%d:%s  Polling threads joined.\n", __FILE__, __LINE__, __func__ );
-
-    //printf("# a|b iterations:  %"PRIu64", %"PRIu64".\n", iterations[0], iterations[1]); FIXME
-
-    run_longitudinal_batches( &job, STOP );
-    run_longitudinal_batches( &job, READ );
-    fprintf( stderr, "%s:%d:%s  Longitudinal batches STOP and READ complete.\n", __FILE__, __LINE__, __func__ );
-    dump_batches( &job );
-
-    // Benchmark thread cleanup
-    for( uint32_t i = 0; i < job.benchmark_count; i++ ){
-        pthread_mutex_destroy( &(job.benchmarks[i]->benchmark_mutex) );
-    }
+    pthread_barrier_destroy( &trial_end );
+    pthread_barrier_destroy( &trial_next );
+    teardown_live( &job );
 
     run_longitudinal_batches( &job, TEARDOWN );
     fprintf( stderr, "%s:%d:%s  Longitudinal batches TEARDOWN complete.\n", __FILE__, __LINE__, __func__ );
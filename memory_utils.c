@@ -0,0 +1,126 @@
+#define _GNU_SOURCE
+#include <stdlib.h>         // calloc(3), reallocarray(3)
+#include <stdio.h>          // fprintf(3)
+#include <string.h>         // memset(3), strerror(3)
+#include <errno.h>          // errno
+#include <assert.h>         // assert(3)
+#include <unistd.h>         // syscall(2)
+#include <sched.h>          // sched_setaffinity(2)
+#include <pthread.h>        // pthread_[create|join](3p)
+#include <sys/mman.h>       // mmap(2), madvise(2), mlockall(2)
+#include <sys/resource.h>   // getrusage(2)
+#include <sys/syscall.h>        // SYS_mbind
+#include <linux/mempolicy.h>    // MPOL_BIND
+#include "cpuset_utils.h"   // get_next_cpu()
+#include "topology_utils.h" // cpu2node()
+#include "memory_utils.h"
+
+static constexpr const size_t MAX_NUMA_NODES = 1024;
+static constexpr const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+// Mappings made by measurement_alloc(), so measurement_free() knows their length.
+struct mapping{
+    void        *p;
+    size_t      len;
+};
+static struct mapping   *mappings;
+static size_t           mapping_count;
+
+void bind_to_node( void *p, size_t len, unsigned int node ){
+    // Call before the pages are touched, so MPOL_BIND decides where they all
+    // land.  If the kernel refuses (no NUMA, or a seccomp filter), callers
+    // fall back on first touch from a thread running on the node.
+    unsigned long nodemask[ MAX_NUMA_NODES / ( 8 * sizeof( unsigned long ) ) ] = {};
+    if( node >= MAX_NUMA_NODES ){
+        return;
+    }
+    nodemask[ node / ( 8 * sizeof( unsigned long ) ) ] |= 1UL << ( node % ( 8 * sizeof( unsigned long ) ) );
+    if( 0 != syscall( SYS_mbind, p, len, MPOL_BIND, nodemask, MAX_NUMA_NODES, 0 ) ){
+        fprintf( stderr, "%s:%d:%s mbind to node %u failed (%s); relying on first touch.\n",
+                __FILE__, __LINE__, __func__, node, strerror( errno ) );
+    }
+}
+
+struct prefault_request{
+    size_t      len;
+    cpu_set_t   *cpu;
+    void        *p;
+};
+
+static void* prefault( void *v ){
+    // Runs on the cpu that will use the buffer.
+    struct prefault_request *r = v;
+    assert( 0 == sched_setaffinity( 0, sizeof( cpu_set_t ), r->cpu ) );
+    r->p = mmap( NULL, r->len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0 );
+    if( MAP_FAILED == r->p ){
+        // No hugetlbfs pages reserved; ask for transparent huge pages instead.
+        r->p = mmap( NULL, r->len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+        assert( MAP_FAILED != r->p );
+        madvise( r->p, r->len, MADV_HUGEPAGE );
+    }
+    bind_to_node( r->p, r->len, cpu2node( get_next_cpu( 0, CPU_SETSIZE, r->cpu, NULL ) ) );
+    memset( r->p, 0, r->len );
+    return NULL;
+}
+
+void * measurement_alloc( size_t len, cpu_set_t *cpu, bool zero_fault ){
+    // Zeroed memory for buffers written during the measured interval.  With
+    // zero_fault, the buffer is huge-page backed where possible and every page
+    // is faulted in now, on cpu's node, by a thread running on cpu.
+    if( !zero_fault ){
+        return calloc( 1, len );
+    }
+    struct prefault_request r = { .len = ( len + HUGE_PAGE_SIZE - 1 ) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE, .cpu = cpu };
+    pthread_t thread;
+    assert( 0 == pthread_create( &thread, NULL, prefault, &r ) );
+    assert( 0 == pthread_join( thread, NULL ) );
+    mappings = reallocarray( mappings, mapping_count + 1, sizeof( struct mapping ) );
+    assert( mappings );
+    mappings[ mapping_count ].p   = r.p;
+    mappings[ mapping_count ].len = r.len;
+    mapping_count++;
+    return r.p;
+}
+
+void measurement_free( void *p ){
+    for( size_t m = 0; m < mapping_count; m++ ){
+        if( mappings[m].p == p ){
+            munmap( p, mappings[m].len );
+            mappings[m] = mappings[ --mapping_count ];
+            return;
+        }
+    }
+    free( p );
+}
+
+void lock_memory( struct job *job ){
+    // Everything mapped now, and everything mapped later (thread stacks
+    // included), stays resident.  Needs CAP_IPC_LOCK or a large enough
+    // RLIMIT_MEMLOCK.  A SCHED_FIFO thread stuck on a page fault is no
+    // better than a CFS one, so -F/--fifo locks memory too.
+    if( !job->zero_fault && !job->fifo ){
+        return;
+    }
+    job->memory_locked = ( 0 == mlockall( MCL_CURRENT | MCL_FUTURE ) );
+    if( !job->memory_locked ){
+        fprintf( stderr, "%s:%d:%s mlockall failed (%s); pages may still fault.\n",
+                __FILE__, __LINE__, __func__, strerror( errno ) );
+    }
+}
+
+static void add_usage( struct thread_usage *u, long sign ){
+    struct rusage r;
+    assert( 0 == getrusage( RUSAGE_THREAD, &r ) );
+    u->minflt += sign * r.ru_minflt;
+    u->majflt += sign * r.ru_majflt;
+    u->nvcsw  += sign * r.ru_nvcsw;
+    u->nivcsw += sign * r.ru_nivcsw;
+}
+
+void thread_usage_start( struct thread_usage *u ){
+    add_usage( u, -1 );
+}
+
+void thread_usage_stop( struct thread_usage *u ){
+    add_usage( u, 1 );
+}
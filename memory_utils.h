@@ -0,0 +1,9 @@
+#pragma once
+#include "job.h"
+
+void bind_to_node( void *p, size_t len, unsigned int node );
+void * measurement_alloc( size_t len, cpu_set_t *cpu, bool zero_fault );
+void measurement_free( void *p );
+void lock_memory( struct job *job );
+void thread_usage_start( struct thread_usage *u );
+void thread_usage_stop( struct thread_usage *u );
@@ -0,0 +1,241 @@
+#define _GNU_SOURCE
+#include <stdlib.h>         // reallocarray(3), exit(3)
+#include <stdio.h>          // sscanf(3), printf(3)
+#include <string.h>         // strdup(3), strtok_r(3), strchr(3)
+#include <errno.h>          // errno
+#include <assert.h>         // assert(3)
+#include <time.h>           // clock_gettime(2)
+#include <unistd.h>         // sysconf(3)
+#include <pthread.h>        // pthread_mutex_*(3p), pthread_once(3p)
+#include <x86intrin.h>      // __rdtsc()
+#include "int_utils.h"      // safe_strtoull()
+#include "msr_backend.h"
+
+// A synthetic processor for running the whole pipeline without msr-safe.
+//
+//   TIME_STAMP_COUNTER  the real TSC.
+//   MPERF, APERF        advance with the TSC from the first open, APERF scaled
+//                       by aperf_percent.
+//   *_ENERGY_STATUS     32-bit counters in 2^-14 J units (RAPL_POWER_UNIT reads
+//                       0xA0E03), updated every millisecond:  PKG at <watts>,
+//                       PP0 at 60%, DRAM at 10%, PLATFORM at 120%, PP1 idle.
+//   [PACKAGE_]THERM_STATUS  valid, <degrees> below TCC.
+//
+// Anything else reads back whatever was last written (initially 0).  Access
+// follows the allowlist as msr-safe would:  unlisted MSRs fail with EACCES and
+// writes only change the bits in the write mask.  Writes to modelled
+// counters set an offset, so writing 0 to APERF zeroes it.
+
+static struct{
+    double      watts;
+    uint64_t    degrees;
+    uint64_t    aperf_percent;
+} model = { .watts = 50.0, .degrees = 40, .aperf_percent = 100 };
+
+static constexpr const uint64_t MOCK_RAPL_POWER_UNIT = 0x000A0E03;  // ESU 14:  61 uJ.
+static constexpr const uint64_t MOCK_ENERGY_UNITS_PER_JOULE = 1ULL << 14;
+
+static uint64_t         tsc0;
+static struct timespec  t0;
+static long             ncpus;
+static pthread_once_t   once = PTHREAD_ONCE_INIT;
+
+// Allowlist, as written by populate_allowlist().
+static uint32_t *allowed_msr;
+static uint64_t *allowed_wmask;
+static size_t   allowed_count;
+
+// Per cpu/msr offsets from the model, set by writes.
+struct mock_register{
+    uint16_t    cpu;
+    uint32_t    msr;
+    uint64_t    offset;
+};
+static struct mock_register *registers;
+static size_t               register_count;
+static pthread_mutex_t      register_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void configure_mock_backend( const char *params ){
+    if( NULL == params ){
+        return;
+    }
+    char *local_params = strdup( params );
+    char *saveptr = NULL;
+    char *watts   = strtok_r( local_params, ":", &saveptr );
+    char *degrees = strtok_r( NULL, ":", &saveptr );
+    char *percent = strtok_r( NULL, ":", &saveptr );
+    if( watts ){
+        model.watts = (double)safe_strtoull( watts );
+    }
+    if( degrees ){
+        model.degrees = safe_strtoull( degrees ) & 0x7F;
+    }
+    if( percent ){
+        model.aperf_percent = safe_strtoull( percent );
+    }
+    free( local_params );
+}
+
+static void mock_init( void ){
+    tsc0 = __rdtsc();
+    assert( 0 == clock_gettime( CLOCK_MONOTONIC, &t0 ) );
+    ncpus = sysconf( _SC_NPROCESSORS_CONF );
+}
+
+static uint64_t energy_counts( double fraction ){
+    // Quantized to the 1ms update cadence, then wrapped at 32 bits.
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    uint64_t ms = ( ( now.tv_sec - t0.tv_sec ) * 1'000'000'000ULL + now.tv_nsec - t0.tv_nsec ) / 1'000'000ULL;
+    double counts_per_ms = model.watts * fraction * MOCK_ENERGY_UNITS_PER_JOULE / 1000.0;
+    return (uint64_t)( ms * counts_per_ms ) & 0xFFFFFFFFULL;
+}
+
+static uint64_t model_value( uint32_t msr ){
+    uint64_t elapsed = __rdtsc() - tsc0;
+    switch( msr ){
+        case TIME_STAMP_COUNTER:        return __rdtsc();
+        case MPERF:                     return elapsed;
+        case APERF:                     return elapsed / 100 * model.aperf_percent;
+        case RAPL_POWER_UNIT:           return MOCK_RAPL_POWER_UNIT;
+        case PKG_ENERGY_STATUS:         return energy_counts( 1.0 );
+        case PP0_ENERGY_STATUS:         return energy_counts( 0.6 );
+        case DRAM_ENERGY_STATUS:        return energy_counts( 0.1 );
+        case PLATFORM_ENERGY_COUNTER:   return energy_counts( 1.2 );
+        case THERM_STATUS:
+        case PACKAGE_THERM_STATUS:      return ( 1ULL << 31 ) | ( model.degrees << 16 );
+        default:                        return 0;
+    }
+}
+
+static struct mock_register * find_register( uint16_t cpu, uint32_t msr ){
+    // Caller holds register_lock.
+    for( size_t r = 0; r < register_count; r++ ){
+        if( registers[r].cpu == cpu && registers[r].msr == msr ){
+            return &( registers[r] );
+        }
+    }
+    return NULL;
+}
+
+static uint64_t mock_read( uint16_t cpu, uint32_t msr ){
+    uint64_t offset = 0;
+    pthread_mutex_lock( &register_lock );
+    struct mock_register *r = find_register( cpu, msr );
+    if( r ){
+        offset = r->offset;
+    }
+    pthread_mutex_unlock( &register_lock );
+    return model_value( msr ) + offset;
+}
+
+static void mock_write( uint16_t cpu, uint32_t msr, uint64_t wmask, uint64_t msrdata ){
+    uint64_t current = mock_read( cpu, msr );
+    uint64_t next = ( current & ~wmask ) | ( msrdata & wmask );
+    pthread_mutex_lock( &register_lock );
+    struct mock_register *r = find_register( cpu, msr );
+    if( NULL == r ){
+        registers = reallocarray( registers, register_count + 1, sizeof( struct mock_register ) );
+        assert( registers );
+        r = &( registers[ register_count++ ] );
+        r->cpu = cpu;
+        r->msr = msr;
+    }
+    r->offset = next - model_value( msr );
+    pthread_mutex_unlock( &register_lock );
+}
+
+static int32_t mock_op( struct msr_batch_op *o ){
+    if( o->cpu >= ncpus ){
+        return -ENXIO;
+    }
+    size_t a = 0;
+    while( a < allowed_count && allowed_msr[a] != o->msr ){
+        a++;
+    }
+    if( a == allowed_count ){
+        return -EACCES;
+    }
+    if( o->op & OP_WRITE ){
+        if( 0 == allowed_wmask[a] ){
+            return -EACCES;
+        }
+        mock_write( o->cpu, o->msr, allowed_wmask[a], o->msrdata );
+    }
+    if( o->op & ( OP_READ | OP_POLL ) ){
+        o->msrdata = mock_read( o->cpu, o->msr );
+    }
+    if( o->op & OP_POLL ){
+        // Spin until the value changes, as msr-safe does.
+        o->msrdata2 = o->msrdata;
+        for( uint32_t p = 0; p < o->poll_max && o->msrdata2 == o->msrdata; p++ ){
+            o->msrdata2 = mock_read( o->cpu, o->msr );
+        }
+    }
+    if( o->op & OP_MPERF ){
+        o->mperf = mock_read( o->cpu, MPERF );
+    }
+    if( o->op & OP_APERF ){
+        o->aperf = mock_read( o->cpu, APERF );
+    }
+    if( o->op & OP_THERM ){
+        o->therm = mock_read( o->cpu, THERM_STATUS );
+    }
+    if( o->op & OP_PTHERM ){
+        o->ptherm = mock_read( o->cpu, PACKAGE_THERM_STATUS );
+    }
+    if( o->op & OP_TSC ){
+        o->tsc = __rdtsc();
+    }
+    return 0;
+}
+
+static int mock_open_batch( void ){
+    pthread_once( &once, mock_init );
+    return 0;
+}
+
+static int mock_batch( [[maybe_unused]] int fd, struct msr_batch_array *b ){
+    if( 0 == b->numops || NULL == b->ops ){
+        errno = EINVAL;
+        return -1;
+    }
+    int rc = 0;
+    for( uint32_t i = 0; i < b->numops; i++ ){
+        b->ops[i].err = mock_op( &( b->ops[i] ) );
+        if( b->ops[i].err ){
+            errno = -b->ops[i].err;
+            rc = -1;
+        }
+    }
+    return rc;
+}
+
+static int mock_close_batch( [[maybe_unused]] int fd ){
+    return 0;
+}
+
+static ssize_t mock_write_allowlist( const char *allowlist, size_t len ){
+    pthread_once( &once, mock_init );
+    uint32_t msr;
+    unsigned long long wmask;
+    for( const char *line = allowlist; line && 2 == sscanf( line, "0x%x 0x%llx", &msr, &wmask ); ){
+        allowed_msr   = reallocarray( allowed_msr,   allowed_count + 1, sizeof( uint32_t ) );
+        allowed_wmask = reallocarray( allowed_wmask, allowed_count + 1, sizeof( uint64_t ) );
+        assert( allowed_msr && allowed_wmask );
+        allowed_msr[ allowed_count ]   = msr;
+        allowed_wmask[ allowed_count ] = wmask;
+        allowed_count++;
+        line = strchr( line, '\n' );
+        line = line ? line + 1 : NULL;
+    }
+    return (ssize_t)len;
+}
+
+const struct msr_backend mock_backend = {
+    .name            = "mock",
+    .open_batch      = mock_open_batch,
+    .batch           = mock_batch,
+    .close_batch     = mock_close_batch,
+    .write_allowlist = mock_write_allowlist,
+};
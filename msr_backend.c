@@ -0,0 +1,68 @@
+#define _GNU_SOURCE
+#include <fcntl.h>          // open(2)
+#include <unistd.h>         // write(2), close(2)
+#include <sys/ioctl.h>      // ioctl(2)
+#include "msr_backend.h"
+
+//////////////////////////////////////////////////////////////////////////////////
+// msr-safe
+//////////////////////////////////////////////////////////////////////////////////
+static int msrsafe_open_batch( void ){
+    return open( "/dev/cpu/msr_batch", O_RDONLY );
+}
+
+static int msrsafe_batch( int fd, struct msr_batch_array *b ){
+    return ioctl( fd, X86_IOC_MSR_BATCH, b );
+}
+
+static int msrsafe_close_batch( int fd ){
+    return close( fd );
+}
+
+static ssize_t msrsafe_write_allowlist( const char *allowlist, size_t len ){
+    int fd = open( "/dev/cpu/msr_allowlist", O_WRONLY );
+    if( -1 == fd ){
+        return -1;
+    }
+    ssize_t nbytes = write( fd, allowlist, len );
+    close( fd );
+    return nbytes;
+}
+
+const struct msr_backend msrsafe_backend = {
+    .name            = "msr-safe",
+    .open_batch      = msrsafe_open_batch,
+    .batch           = msrsafe_batch,
+    .close_batch     = msrsafe_close_batch,
+    .write_allowlist = msrsafe_write_allowlist,
+};
+
+//////////////////////////////////////////////////////////////////////////////////
+// Dispatch
+//////////////////////////////////////////////////////////////////////////////////
+// Chosen once during option parsing, before any thread exists.
+static const struct msr_backend *current = &msrsafe_backend;
+
+void set_msr_backend( const struct msr_backend *backend ){
+    current = backend;
+}
+
+const struct msr_backend * get_msr_backend( void ){
+    return current;
+}
+
+int msr_batch_open( void ){
+    return current->open_batch();
+}
+
+int msr_batch( int fd, struct msr_batch_array *b ){
+    return current->batch( fd, b );
+}
+
+int msr_batch_close( int fd ){
+    return current->close_batch( fd );
+}
+
+ssize_t msr_allowlist_write( const char *allowlist, size_t len ){
+    return current->write_allowlist( allowlist, len );
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include <sys/types.h>      // ssize_t
+#include "msr_utils.h"      // struct msr_batch_array
+
+// Everything that talks to msr-safe goes through one of these.  The calls
+// follow open(2), ioctl(2), close(2) and write(2) conventions:  -1 and errno
+// on failure, with per-op results in each op's err field.
+struct msr_backend{
+    const char  *name;
+    int         (*open_batch)( void );
+    int         (*batch)( int fd, struct msr_batch_array *b );
+    int         (*close_batch)( int fd );
+    ssize_t     (*write_allowlist)( const char *allowlist, size_t len );
+};
+
+extern const struct msr_backend msrsafe_backend;
+extern const struct msr_backend mock_backend;
+
+void set_msr_backend( const struct msr_backend *backend );
+const struct msr_backend * get_msr_backend( void );
+
+int     msr_batch_open( void );
+int     msr_batch( int fd, struct msr_batch_array *b );
+int     msr_batch_close( int fd );
+ssize_t msr_allowlist_write( const char *allowlist, size_t len );
+
+// <watts>:<degrees>:<aperf_percent>, any suffix of which may be omitted.
+void configure_mock_backend( const char *params );
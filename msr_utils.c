@@ -10,62 +10,31 @@
 #include <sys/ioctl.h>      // ioctl(2)
 #include <errno.h>          // errno
 #include <sys/time.h>	    // gettimeofday()
+#include <time.h>           // clock_gettime(2), nanosleep(2)
+#include <cpuid.h>          // __get_cpuid(3)
+#include <pthread.h>        // pthread_[create|join](3p)
+#include <x86intrin.h>      // __rdtsc()
 #include "msr_version.h"    // MSR_SAFE_VERSION_u32
 #include "cpuset_utils.h"   // get_next_cpu()
 #include "msr_utils.h"
 #include "int_utils.h"
 #include "timespec_utils.h" // timespec_division()
+#include "tsc_utils.h"      // start_barrier_[wait|release]()
+#include "topology_utils.h" // cpu2package()
+#include "energy_utils.h"   // start_energy_accumulators() etc.
+#include "snapshot_utils.h" // start_snapshots() etc.
+#include "msr_backend.h"    // msr_batch() etc.
+#include "powercap_utils.h" // setup_powercap_polls() etc.
+#include "cadence_utils.h"  // calibrate_poll_cadences()
+#include "perf_utils.h"     // setup_perf_groups() etc.
+#include "memory_utils.h"   // measurement_alloc()
+#include "sample_utils.h"   // setup_poll_samples() etc.
+#include "archive_utils.h"  // write_poll_archive()
 
 #define EXTRACT_TEMPERATURE(x) ( (x>>16) & 0x7fULL )
-#define UNUSED_OP ((__s32)(0xDECAFBAD))
 
 static constexpr const uint16_t max_msrsafe_cpu = UINT16_MAX;   // current limitation of msr-safe.
-static constexpr const uint32_t MAX_POLL_ATTEMPTS = 10000;
 
-//////////////////////////////////////////////////////////////////////////////////
-// List of MSRs
-//////////////////////////////////////////////////////////////////////////////////
-typedef enum : uint64_t{
-    TIME_STAMP_COUNTER               = 0x0010,
-    MISC_PACKAGE_CTLS                = 0x00BC,
-    MPERF                            = 0x00E7,
-    APERF                            = 0x00E8,
-    ARCH_CAPABILITIES                = 0x010A,
-    PERF_STATUS                      = 0x0198,
-    PERF_CTL                         = 0x0199,
-    THERM_STATUS                     = 0x019C, // 22:16 Degrees C away from max
-    ENERGY_PERF_BIAS                 = 0x01B0,
-    PACKAGE_THERM_STATUS             = 0x01B1, // 22:16 Degrees C away from max
-    FIXED_CTR0                       = 0x0309, // INST_RETIRED.ANY
-    FIXED_CTR1                       = 0x030A, // CPU_CLK_UNHALTED.[THREAD|CORE]
-    FIXED_CTR2                       = 0x030B, // CPU_CLK_UNHALTED.REF_TSC
-    FIXED_CTR3                       = 0x030C,
-    FIXED_CTR_CTRL                   = 0x038D,
-    PERF_GLOBAL_CTRL                 = 0x038F,
-    RAPL_POWER_UNIT                  = 0x0606,
-    PKG_POWER_LIMIT                  = 0x0610,
-    PKG_ENERGY_STATUS                = 0x0611,
-    PACKAGE_ENERGY_TIME_STATUS       = 0x0612,
-    PKG_PERF_STATUS                  = 0x0613,
-    PKG_POWER_INFO                   = 0x0614,
-    DRAM_POWER_LIMIT                 = 0x0618,
-    DRAM_ENERGY_STATUS               = 0x0619,
-    DRAM_PERF_STATUS                 = 0x061B,
-    DRAM_POWER_INFO                  = 0x061C,
-    PP0_POWER_LIMIT                  = 0x0638,
-    PP0_ENERGY_STATUS                = 0x0639,
-    PP0_POLICY                       = 0x063A,
-    PP1_POWER_LIMIT                  = 0x0640,
-    PP1_ENERGY_STATUS                = 0x0641,
-    PP1_POLICY                       = 0x0642,
-    PLATFORM_ENERGY_COUNTER          = 0x064D,
-    PPERF                            = 0x064E,
-    PLATFORM_POWER_INFO              = 0x0665,
-    PLATFORM_POWER_LIMIT             = 0x065C,
-    PLATFORM_RAPL_SOCKET_PERF_STATUS = 0x0666,
-    PM_ENABLE                        = 0x0770,
-    HWP_CAPABILITIES                 = 0x0771,
-}msr_t;
 #if 0
 // This is an extravagence.
 static const char * const msr2str[] = {
@@ -123,11 +92,27 @@ static char const *const allowlist =
     // Everything else
     "0x0010 0x0000000000000000\n"      // TIME_STAMP_COUNTER
     "0x00BC 0x0000000000000000\n"      // MISC_PACKAGE_CTLS
-    "0x00E7 0x0000000000000000\n"      // MPERF
-    "0x00E8 0x0000000000000000\n"      // APERF
+    "0x00C1 0xFFFFFFFFFFFFFFFF\n"      // PMC0
+    "0x00C2 0xFFFFFFFFFFFFFFFF\n"      // PMC1
+    "0x00C3 0xFFFFFFFFFFFFFFFF\n"      // PMC2
+    "0x00C4 0xFFFFFFFFFFFFFFFF\n"      // PMC3
+    "0x00C5 0xFFFFFFFFFFFFFFFF\n"      // PMC4
+    "0x00C6 0xFFFFFFFFFFFFFFFF\n"      // PMC5
+    "0x00C7 0xFFFFFFFFFFFFFFFF\n"      // PMC6
+    "0x00C8 0xFFFFFFFFFFFFFFFF\n"      // PMC7
+    "0x00E7 0xFFFFFFFFFFFFFFFF\n"      // MPERF
+    "0x00E8 0xFFFFFFFFFFFFFFFF\n"      // APERF
     "0x010A 0x0000000000000000\n"      // ARCH_CAPABILTIES
+    "0x0186 0x00000000FFEFFFFF\n"      // PERFEVTSEL0 (everything but INT, bit 20)
+    "0x0187 0x00000000FFEFFFFF\n"      // PERFEVTSEL1
+    "0x0188 0x00000000FFEFFFFF\n"      // PERFEVTSEL2
+    "0x0189 0x00000000FFEFFFFF\n"      // PERFEVTSEL3
+    "0x018A 0x00000000FFEFFFFF\n"      // PERFEVTSEL4
+    "0x018B 0x00000000FFEFFFFF\n"      // PERFEVTSEL5
+    "0x018C 0x00000000FFEFFFFF\n"      // PERFEVTSEL6
+    "0x018D 0x00000000FFEFFFFF\n"      // PERFEVTSEL7
     "0x0198 0x0000000000000000\n"      // PERF_STATUS
-    "0x0199 0x0000000000000000\n"      // PERF_CTL
+    "0x0199 0x000000000000FFFF\n"      // PERF_CTL
     "0x019C 0x0000000000000000\n"      // THERM_STATUS         (bits 22:16 contain "Package digital temperature reading in 1 degree Celsius relative to the package TCC activation temperature." p16-46, etc.)
     "0x01B0 0x0000000000000000\n"      // ENERGY_PERF_BIAS
     "0x01B1 0x0000000000000000\n"      // PACKAGE_THERM_STATUS (bits 22:16 contain "Package digital temperature reading in 1 degree Celsius relative to the package TCC activation temperature." p16-46, v3B, 253669-086US, Dec 2024)
@@ -136,7 +121,7 @@ static char const *const allowlist =
     "0x030B 0xFFFFFFFFFFFFFFFF\n"      // FIXED_CTR2
     "0x030C 0xFFFFFFFFFFFFFFFF\n"      // FIXED_CTR3
     "0x038D 0x0000000000000333\n"      // FIXED_CTR_CTRL
-    "0x038F 0x0000000700000000\n"      // PERF_GLOBAL_CTRL
+    "0x038F 0x00000007000000FF\n"      // PERF_GLOBAL_CTRL
     "0x0606 0x0000000000000000\n"      // RAPL_POWER_UNIT
     "0x0610 0x0000000000000000\n"      // PKG_POWER_LIMIT
     "0x0612 0x0000000000000000\n"      // PACKAGE_ENERGY_TIME_STATUS
@@ -156,6 +141,7 @@ static char const *const allowlist =
     "0x0666 0x0000000000000000\n"      // PLATFORM_RAPL_SOCKET_PERF_STATUS
     "0x0770 0x0000000000000000\n"      // PM_ENABLE
     "0x0771 0x0000000000000000\n"      // HWP_CAPABILITIES
+    "0x0774 0x00000000FFFFFFFF\n"      // HWP_REQUEST
     ;
 
 
@@ -177,16 +163,6 @@ static constexpr const struct msr_batch_op op_enable_fixed = { .op = OP_WRITE |
 static constexpr const struct msr_batch_op op_start_global = { .op = OP_WRITE | OP_TSC, .msr = PERF_GLOBAL_CTRL, .msrdata=0x700000000 };
 static constexpr const struct msr_batch_op op_stop_global  = { .op = OP_WRITE | OP_TSC, .msr = PERF_GLOBAL_CTRL, .msrdata=0x000000000 };
 
-// Single-read energy instructions.
-/*
-static constexpr const struct msr_batch_op op_rd_RAPL_POWER_UNIT         = { .op = OP_READ | OP_ALL_MODS, .msr = RAPL_POWER_UNIT };
-static constexpr const struct msr_batch_op op_rd_PKG_ENERGY_STATUS       = { .op = OP_READ | OP_ALL_MODS, .msr = PKG_ENERGY_STATUS };
-static constexpr const struct msr_batch_op op_rd_DRAM_ENERGY_STATUS      = { .op = OP_READ | OP_ALL_MODS, .msr = DRAM_ENERGY_STATUS };
-static constexpr const struct msr_batch_op op_rd_PP0_ENERGY_STATUS       = { .op = OP_READ | OP_ALL_MODS, .msr = PP0_ENERGY_STATUS };
-static constexpr const struct msr_batch_op op_rd_PP1_ENERGY_STATUS       = { .op = OP_READ | OP_ALL_MODS, .msr = PP1_ENERGY_STATUS };
-static constexpr const struct msr_batch_op op_rd_PLATFORM_ENERGY_COUNTER = { .op = OP_READ | OP_ALL_MODS, .msr = PLATFORM_ENERGY_COUNTER };
-*/
-
 // All readable MSRs with OP_ALL_MODS
 static constexpr const struct msr_batch_op op_rd_TIME_STAMP_COUNTER                 = { .op = OP_READ | OP_ALL_MODS, .msr = TIME_STAMP_COUNTER };
 static constexpr const struct msr_batch_op op_rd_MISC_PACKAGE_CTLS                  = { .op = OP_READ | OP_ALL_MODS, .msr = MISC_PACKAGE_CTLS };
@@ -251,7 +227,8 @@ static const struct msr_batch_op * const fixed_function_counters__teardown[] = {
 //   update rates are relatively slow.  Doing the read during the "stop" phase
 //   eliminates a bit of measurement contamination.  Reading during the "read"
 //   phase leads to less confusion.  Prefer the latter.
-/*
+//
+// START and READ must list the energy MSRs in the same order; see energy_utils.c.
 static const struct msr_batch_op * const energy_counters__setup[] = { &op_rd_RAPL_POWER_UNIT, NULL };
 static const struct msr_batch_op * const energy_counters__start[] = {
     &op_rd_PKG_ENERGY_STATUS, &op_rd_DRAM_ENERGY_STATUS, &op_rd_PP0_ENERGY_STATUS, &op_rd_PP1_ENERGY_STATUS, &op_rd_PLATFORM_ENERGY_COUNTER, NULL };
@@ -259,7 +236,7 @@ static const struct msr_batch_op * const energy_counters__stop[] = { NULL };
 static const struct msr_batch_op * const energy_counters__read[] = {
     &op_rd_RAPL_POWER_UNIT, &op_rd_PKG_ENERGY_STATUS, &op_rd_DRAM_ENERGY_STATUS, &op_rd_PP0_ENERGY_STATUS, &op_rd_PP1_ENERGY_STATUS, &op_rd_PLATFORM_ENERGY_COUNTER, NULL };
 static const struct msr_batch_op * const energy_counters__teardown[] = { NULL };
-*/
+
 static const struct msr_batch_op * const all_allowed__setup[] = {
     &op_rd_TIME_STAMP_COUNTER,   &op_rd_MISC_PACKAGE_CTLS,   &op_rd_MPERF,                            &op_rd_APERF,
     &op_rd_ARCH_CAPABILITIES,    &op_rd_PERF_STATUS,         &op_rd_THERM_STATUS,                     &op_rd_ENERGY_PERF_BIAS,
@@ -270,7 +247,7 @@ static const struct msr_batch_op * const all_allowed__setup[] = {
     &op_rd_DRAM_POWER_INFO,      &op_rd_PP0_POWER_LIMIT,     &op_rd_PP0_ENERGY_STATUS,                &op_rd_PP0_POLICY,
     &op_rd_PP1_POWER_LIMIT,      &op_rd_PP1_ENERGY_STATUS,   &op_rd_PP1_POLICY,                       &op_rd_PLATFORM_ENERGY_COUNTER,
     &op_rd_PPERF,                &op_rd_PLATFORM_POWER_INFO, &op_rd_PLATFORM_RAPL_SOCKET_PERF_STATUS, &op_rd_PM_ENABLE,
-    &op_rd_HWP_CAPABILITIES };
+    &op_rd_HWP_CAPABILITIES, NULL };
 static const struct msr_batch_op * const all_allowed__start[]       = { NULL };
 static const struct msr_batch_op * const all_allowed__stop[]        = { NULL };
 static const struct msr_batch_op * const all_allowed__read[]        = {
@@ -283,7 +260,7 @@ static const struct msr_batch_op * const all_allowed__read[]        = {
     &op_rd_DRAM_POWER_INFO,      &op_rd_PP0_POWER_LIMIT,     &op_rd_PP0_ENERGY_STATUS,                &op_rd_PP0_POLICY,
     &op_rd_PP1_POWER_LIMIT,      &op_rd_PP1_ENERGY_STATUS,   &op_rd_PP1_POLICY,                       &op_rd_PLATFORM_ENERGY_COUNTER,
     &op_rd_PPERF,                &op_rd_PLATFORM_POWER_INFO, &op_rd_PLATFORM_RAPL_SOCKET_PERF_STATUS, &op_rd_PM_ENABLE,
-    &op_rd_HWP_CAPABILITIES };
+    &op_rd_HWP_CAPABILITIES, NULL };
 static const struct msr_batch_op * const all_allowed__teardown[]    = { NULL };
 
 static const struct msr_batch_op * const * const fixed_function_counters__ops[ NUM_LONGITUDINAL_EXECUTION_SLOTS ] = {
@@ -300,18 +277,282 @@ static const struct msr_batch_op * const * const all_allowed__ops[ NUM_LONGITUDI
     all_allowed__read,
     all_allowed__teardown };
 
-/*
+// Recipes that are built at runtime (see build_runtime_recipes()) have no
+// static ops.
+static const struct msr_batch_op * const runtime__empty[] = { NULL };
+static const struct msr_batch_op * const * const runtime__ops[ NUM_LONGITUDINAL_EXECUTION_SLOTS ] = {
+    runtime__empty,
+    runtime__empty,
+    runtime__empty,
+    runtime__empty,
+    runtime__empty };
+
 static const struct msr_batch_op * const * const energy_counters__ops[ NUM_LONGITUDINAL_EXECUTION_SLOTS ] = {
     energy_counters__setup,
     energy_counters__start,
     energy_counters__stop,
     energy_counters__read,
     energy_counters__teardown };
-*/
+
 static const struct msr_batch_op * const * const * const longitudinal_recipes[ NUM_LONGITUDINAL_FUNCTIONS ] = {
-    fixed_function_counters__ops, all_allowed__ops };
+    fixed_function_counters__ops, all_allowed__ops, runtime__ops, energy_counters__ops,
+    runtime__ops, runtime__ops, runtime__ops };
 
 
+//////////////////////////////////////////////////////////////////////////////////
+// Recipes built at runtime from -l parameters.
+//
+// These are laid out the same way as the static recipes (a list of ops per slot,
+// each of which is replicated across the sample cpus), but they live in the
+// longitudinal_config because their contents depend on the command line.
+//////////////////////////////////////////////////////////////////////////////////
+
+// IA32_PERFEVTSELx bits we always set:  USR (16), OS (17) and EN (22).
+static constexpr const uint64_t PERFEVTSEL_USR_OS_EN = ( 1ULL << 16 ) | ( 1ULL << 17 ) | ( 1ULL << 22 );
+
+static void append_runtime_op( struct longitudinal_config *lng, longitudinal_slot_t slot_idx, uint16_t op, uint32_t msr, uint64_t msrdata ){
+    lng->runtime_recipe = true;
+    size_t n = ++( lng->runtime_op_count[ slot_idx ] );
+    lng->runtime_ops[ slot_idx ] = reallocarray( lng->runtime_ops[ slot_idx ], n, sizeof( struct msr_batch_op ) );
+    assert( lng->runtime_ops[ slot_idx ] );
+    memset( &( lng->runtime_ops[ slot_idx ][ n - 1 ] ), 0, sizeof( struct msr_batch_op ) );
+    lng->runtime_ops[ slot_idx ][ n - 1 ].op      = op;
+    lng->runtime_ops[ slot_idx ][ n - 1 ].msr     = msr;
+    lng->runtime_ops[ slot_idx ][ n - 1 ].msrdata = msrdata;
+}
+
+static void build_general_purpose_counters_recipe( struct longitudinal_config *lng ){
+    // SETUP stops everything, programs the event selects and zeroes the counters.
+    // START and STOP only touch PERF_GLOBAL_CTRL, as with the fixed counters.
+    uint64_t enable = 0;
+    append_runtime_op( lng, SETUP, OP_WRITE | OP_TSC, PERF_GLOBAL_CTRL, 0 );
+    for( size_t x = 0; x < lng->event_count; x++ ){
+        append_runtime_op( lng, SETUP,    OP_WRITE | OP_TSC, PERFEVTSEL0 + x, lng->events[x] | PERFEVTSEL_USR_OS_EN );
+        append_runtime_op( lng, SETUP,    OP_WRITE | OP_TSC, PMC0 + x,        0 );
+        append_runtime_op( lng, READ,     OP_READ  | OP_TSC, PMC0 + x,        0 );
+        append_runtime_op( lng, TEARDOWN, OP_WRITE | OP_TSC, PERFEVTSEL0 + x, 0 );
+        enable |= 1ULL << x;
+    }
+    append_runtime_op( lng, START, OP_WRITE | OP_TSC, PERF_GLOBAL_CTRL, enable );
+    append_runtime_op( lng, STOP,  OP_WRITE | OP_TSC, PERF_GLOBAL_CTRL, 0 );
+}
+
+static bool has_hwp( void ){
+    // CPUID.06H:EAX[7] is HWP base support.
+    unsigned int eax = 0, ebx, ecx, edx;
+    if( 0 == __get_cpuid( 0x06, &eax, &ebx, &ecx, &edx ) ){
+        return false;
+    }
+    return eax & ( 1U << 7 );
+}
+
+// CAPFREQUENCY only replaces these fields; prepare_capfrequency() keeps the
+// rest (HWP_REQUEST's EPP and activity window, PERF_CTL's turbo disengage).
+static constexpr const uint64_t PERF_CTL_RATIO_MASK   = 0x0000FF00;  // 15:8 target ratio.
+static constexpr const uint64_t HWP_REQUEST_PERF_MASK = 0x00FFFFFF;  // 7:0 min, 15:8 max, 23:16 desired.
+
+static void build_capfrequency_recipe( struct longitudinal_config *lng ){
+    // Save the current requests, then pin min = max = desired to the ratio.
+    // If HWP is enabled, PERF_CTL writes are ignored; if it isn't, the
+    // HWP_REQUEST ops fail individually.  Either way the right one sticks.
+    // The SETUP writes are merged with the current values by
+    // prepare_capfrequency(); the TEARDOWN values are filled in by
+    // prepare_teardown().
+    bool hwp = has_hwp();
+    append_runtime_op( lng, SETUP, OP_READ  | OP_TSC, PERF_CTL,    0 );
+    append_runtime_op( lng, SETUP, OP_WRITE | OP_TSC, PERF_CTL,    lng->ratio << 8 );
+    if( hwp ){
+        append_runtime_op( lng, SETUP, OP_READ  | OP_TSC, HWP_REQUEST, 0 );
+        append_runtime_op( lng, SETUP, OP_WRITE | OP_TSC, HWP_REQUEST, lng->ratio | ( lng->ratio << 8 ) | ( lng->ratio << 16 ) );
+    }
+    append_runtime_op( lng, READ, OP_READ | OP_ALL_MODS, PERF_STATUS, 0 );
+    append_runtime_op( lng, TEARDOWN, OP_WRITE | OP_TSC, PERF_CTL, 0 );
+    if( hwp ){
+        append_runtime_op( lng, TEARDOWN, OP_WRITE | OP_TSC, HWP_REQUEST, 0 );
+    }
+}
+
+static void build_coldstart_recipe( struct longitudinal_config *lng ){
+    // SETUP doubles as the probe that wait_for_coldstart() re-issues.
+    append_runtime_op( lng, SETUP, OP_READ | OP_TSC, THERM_STATUS,         0 );
+    append_runtime_op( lng, SETUP, OP_READ | OP_TSC, PACKAGE_THERM_STATUS, 0 );
+    append_runtime_op( lng, READ,  OP_READ | OP_TSC, THERM_STATUS,         0 );
+    append_runtime_op( lng, READ,  OP_READ | OP_TSC, PACKAGE_THERM_STATUS, 0 );
+}
+
+static void build_zeroamperf_recipe( struct longitudinal_config *lng ){
+    // The values saved at SETUP plus those read at READ are written back at
+    // TEARDOWN, so the counters look (nearly) monotonic to everyone else.
+    append_runtime_op( lng, SETUP,    OP_READ  | OP_TSC, APERF, 0 );
+    append_runtime_op( lng, SETUP,    OP_READ  | OP_TSC, MPERF, 0 );
+    append_runtime_op( lng, START,    OP_WRITE | OP_TSC, MPERF, 0 );
+    append_runtime_op( lng, START,    OP_WRITE | OP_TSC, APERF, 0 );
+    append_runtime_op( lng, READ,     OP_READ  | OP_TSC, APERF, 0 );
+    append_runtime_op( lng, READ,     OP_READ  | OP_TSC, MPERF, 0 );
+    append_runtime_op( lng, TEARDOWN, OP_WRITE | OP_TSC, APERF, 0 );
+    append_runtime_op( lng, TEARDOWN, OP_WRITE | OP_TSC, MPERF, 0 );
+}
+
+static void build_perf_fixed_function_counters_recipe( struct longitudinal_config *lng ){
+    // The perf_event_open(2) groups do the setup, start and stop; only the
+    // READ ops remain, and perf_read_batch() fills them in.  They are the
+    // msr-safe READ ops, modifier flags and all.
+    for( size_t op_idx = 0; fixed_function_counters__read[ op_idx ]; op_idx++ ){
+        append_runtime_op( lng, READ, fixed_function_counters__read[ op_idx ]->op,
+                fixed_function_counters__read[ op_idx ]->msr, 0 );
+    }
+}
+
+static void build_runtime_recipes( struct job *job ){
+    for( size_t i = 0; i < job->longitudinal_count; i++ ){
+        switch( job->longitudinals[i]->longitudinal_type ){
+            case FIXED_FUNCTION_COUNTERS:
+                if( job->longitudinals[i]->use_perf ){
+                    build_perf_fixed_function_counters_recipe( job->longitudinals[i] );
+                }
+                break;
+            case GENERAL_PURPOSE_COUNTERS:
+                build_general_purpose_counters_recipe( job->longitudinals[i] );
+                break;
+            case CAPFREQUENCY:
+                build_capfrequency_recipe( job->longitudinals[i] );
+                break;
+            case COLDSTART:
+                build_coldstart_recipe( job->longitudinals[i] );
+                break;
+            case ZEROAMPERF:
+                build_zeroamperf_recipe( job->longitudinals[i] );
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+static void merge_global_enables( struct job *job ){
+    // FIXED_FUNCTION_COUNTERS and GENERAL_PURPOSE_COUNTERS each write their own
+    // bits to PERF_GLOBAL_CTRL at START.  If both sample the same cpu, the later
+    // write would disable the earlier longitudinal's counters, so every START
+    // write to PERF_GLOBAL_CTRL gets the union of the bits for its cpu.
+    uint64_t *enable = calloc( (size_t)max_msrsafe_cpu + 1, sizeof( uint64_t ) );
+    assert( enable );
+    for( int pass = 0; pass < 2; pass++ ){
+        for( size_t i = 0; i < job->longitudinal_count; i++ ){
+            struct msr_batch_array *b = job->longitudinals[i]->batches[ START ];
+            for( size_t op_idx = 0; b && op_idx < b->numops; op_idx++ ){
+                struct msr_batch_op *o = &( b->ops[ op_idx ] );
+                if( o->msr == PERF_GLOBAL_CTRL && ( o->op & OP_WRITE ) ){
+                    if( 0 == pass ){
+                        enable[ o->cpu ] |= o->msrdata;
+                    }else{
+                        o->msrdata = enable[ o->cpu ];
+                    }
+                }
+            }
+        }
+    }
+    free( enable );
+}
+
+static void probe_longitudinal_batches( struct job *job ){
+    // Read each distinct longitudinal MSR once on one sample cpu of each cpu
+    // type, then strip every op whose MSR couldn't be read on that cpu's type.
+    // The probe only reads:  a write to an MSR that reads fine can still fail.
+    int probe_cpu[ NUM_CPU_TYPES ];
+    for( cpu_type_t t = 0; t < NUM_CPU_TYPES; t++ ){
+        probe_cpu[t] = -1;
+    }
+    uint32_t *msrs = NULL;
+    size_t nmsrs = 0;
+    for( size_t i = 0; i < job->longitudinal_count; i++ ){
+        if( job->longitudinals[i]->use_perf ){
+            continue;   // perf_event_open(2) reports its own failures.
+        }
+        for( longitudinal_slot_t slot_idx = 0; slot_idx < NUM_LONGITUDINAL_EXECUTION_SLOTS; slot_idx++ ){
+            struct msr_batch_array *b = job->longitudinals[i]->batches[ slot_idx ];
+            for( size_t op_idx = 0; b && op_idx < b->numops; op_idx++ ){
+                cpu_type_t t = cpu2type( b->ops[ op_idx ].cpu );
+                if( -1 == probe_cpu[t] ){
+                    probe_cpu[t] = b->ops[ op_idx ].cpu;
+                }
+                size_t m = 0;
+                while( m < nmsrs && msrs[m] != b->ops[ op_idx ].msr ){
+                    m++;
+                }
+                if( m == nmsrs ){
+                    msrs = reallocarray( msrs, ++nmsrs, sizeof( uint32_t ) );
+                    assert( msrs );
+                    msrs[ m ] = b->ops[ op_idx ].msr;
+                }
+            }
+        }
+    }
+    if( 0 == nmsrs ){
+        return;
+    }
+
+    struct msr_batch_array probe = { .numops = 0, .version = MSR_SAFE_VERSION_u32 };
+    probe.ops = calloc( NUM_CPU_TYPES * nmsrs, sizeof( struct msr_batch_op ) );
+    assert( probe.ops );
+    for( cpu_type_t t = 0; t < NUM_CPU_TYPES; t++ ){
+        for( size_t m = 0; -1 != probe_cpu[t] && m < nmsrs; m++ ){
+            probe.ops[ probe.numops ].cpu = probe_cpu[t];
+            probe.ops[ probe.numops ].op  = OP_READ;
+            probe.ops[ probe.numops ].msr = msrs[m];
+            probe.numops++;
+        }
+    }
+    int fd = msr_batch_open();
+    assert( -1 != fd );
+    // Failures are what we're looking for; the per-op err fields tell us which.
+    msr_batch( fd, &probe );
+    msr_batch_close( fd );
+
+    for( size_t p = 0; p < probe.numops; p++ ){
+        if( 0 == probe.ops[p].err ){
+            continue;
+        }
+        job->dropped = reallocarray( job->dropped, job->dropped_count + 1, sizeof( struct dropped_msr ) );
+        assert( job->dropped );
+        job->dropped[ job->dropped_count ].msr       = probe.ops[p].msr;
+        job->dropped[ job->dropped_count ].cpu_type  = cpu2type( probe.ops[p].cpu );
+        job->dropped[ job->dropped_count ].probe_cpu = probe.ops[p].cpu;
+        job->dropped[ job->dropped_count ].err       = probe.ops[p].err;
+        job->dropped_count++;
+    }
+
+    // Compact in place, keeping the order of the surviving ops.
+    for( size_t i = 0; job->dropped_count && i < job->longitudinal_count; i++ ){
+        for( longitudinal_slot_t slot_idx = 0; slot_idx < NUM_LONGITUDINAL_EXECUTION_SLOTS; slot_idx++ ){
+            struct msr_batch_array *b = job->longitudinals[i]->batches[ slot_idx ];
+            if( NULL == b ){
+                continue;
+            }
+            size_t kept = 0;
+            for( size_t op_idx = 0; op_idx < b->numops; op_idx++ ){
+                bool drop = false;
+                for( size_t d = 0; d < job->dropped_count && !drop; d++ ){
+                    drop = job->dropped[d].msr == b->ops[ op_idx ].msr
+                        && job->dropped[d].cpu_type == cpu2type( b->ops[ op_idx ].cpu );
+                }
+                if( drop ){
+                    job->dropped_op_count++;
+                }else{
+                    b->ops[ kept++ ] = b->ops[ op_idx ];
+                }
+            }
+            b->numops = kept;
+            if( 0 == kept ){
+                free( b->ops );
+                free( b );
+                job->longitudinals[i]->batches[ slot_idx ] = NULL;
+            }
+        }
+    }
+    free( probe.ops );
+    free( msrs );
+}
+
 //////////////////////////////////////////////////////////////////////////////////
 // Now on to something that isn't datatype hell.
 //////////////////////////////////////////////////////////////////////////////////
@@ -319,11 +560,15 @@ static const struct msr_batch_op * const * const * const longitudinal_recipes[ N
 
 void teardown_msrsafe_batches( struct job *job ){
     // Polls are easy.
+    teardown_powercap_polls( job );
     for( size_t i = 0; i < job->poll_count; i++ ){
-        free( job->polls[i]->poll_batches );
-        free( job->polls[i]->poll_ops );
+        teardown_poll_samples( job->polls[i] );
+        free( job->polls[i]->poll_batch );
+        free( job->polls[i]->poll_op );
     }
     // Longitudinals are a little tricker.
+    teardown_energy_accumulators( job );
+    teardown_snapshots( job );
     for( size_t i = 0; i < job->longitudinal_count; i++ ){
         for( longitudinal_slot_t slot_idx = 0; slot_idx < NUM_LONGITUDINAL_EXECUTION_SLOTS; slot_idx++ ){
             if( NULL == job->longitudinals[i]->batches[slot_idx] ){
@@ -331,6 +576,8 @@ void teardown_msrsafe_batches( struct job *job ){
             }
             free( job->longitudinals[i]->batches[slot_idx]->ops );
             free( job->longitudinals[i]->batches[slot_idx] );
+            free( job->longitudinals[i]->socket_batches[slot_idx] );
+            free( job->longitudinals[i]->runtime_ops[slot_idx] );
         }
     }
 }
@@ -340,15 +587,10 @@ static void setup_polling_batches( struct job *job ){
     // Map the polling batches
     for( size_t i = 0; i < job->poll_count; i++ ){
         // One op per batch, and (for now) one cpu per batch.
-        job->polls[i]->total_ops = timespec_division( &job->duration, &job->polls[i]->interval );
-
-        job->polls[i]->poll_batches = calloc( job->polls[i]->total_ops, sizeof( struct msr_batch_array ) ); assert( job->polls[i]->poll_batches );
-        job->polls[i]->poll_ops     = calloc( job->polls[i]->total_ops, sizeof( struct msr_batch_op ) );    assert( job->polls[i]->poll_ops );
-
         // Find the polled cpu.
         uint16_t polled_cpu = (uint16_t)( get_next_cpu( 0, max_msrsafe_cpu, &(job->polls[i]->polled_cpu), NULL ) );
 
-        // Create the msr_batch_op that we'll copy into all of the msr_batch_arrays.
+        // Create the msr_batch_op that the poll thread reissues for every sample.
         struct msr_batch_op op = {
             .cpu        = polled_cpu,
             .op         = job->polls[i]->flags,
@@ -365,13 +607,13 @@ static void setup_polling_batches( struct job *job ){
             .ptherm     = 0,
             .tag        = 0 };
 
-        // For each op, fill in an msr_batch_array and a single msr_batch_op.
-        for( size_t j = 0; j < job->polls[i]->total_ops; j++ ){
-            job->polls[i]->poll_batches[j].numops = 1;
-            job->polls[i]->poll_batches[j].version = MSR_SAFE_VERSION_u32;
-            job->polls[i]->poll_batches[j].ops = &(job->polls[i]->poll_ops[j]);
-            memcpy( &(job->polls[i]->poll_ops[j]), &op, sizeof( struct msr_batch_op ) );
-       }
+        job->polls[i]->poll_op    = calloc( 1, sizeof( struct msr_batch_op ) );
+        job->polls[i]->poll_batch = calloc( 1, sizeof( struct msr_batch_array ) );
+        assert( job->polls[i]->poll_op && job->polls[i]->poll_batch );
+        memcpy( job->polls[i]->poll_op, &op, sizeof( struct msr_batch_op ) );
+        job->polls[i]->poll_batch->numops  = 1;
+        job->polls[i]->poll_batch->version = MSR_SAFE_VERSION_u32;
+        job->polls[i]->poll_batch->ops     = job->polls[i]->poll_op;
     }
 }
 
@@ -396,6 +638,8 @@ static void setup_longitudinal_batches( struct job *job ){
         initialized = true;
     }
 
+    build_runtime_recipes( job );
+
     for( size_t i = 0; i < job->longitudinal_count; i++ ){
 
         uint32_t ncpu = CPU_COUNT( &(job->longitudinals[i]->sample_cpus) );
@@ -406,7 +650,9 @@ static void setup_longitudinal_batches( struct job *job ){
         for( longitudinal_slot_t slot_idx = 0; slot_idx < NUM_LONGITUDINAL_EXECUTION_SLOTS; slot_idx++ ){
 
             // How many operations are in each slot of this longitudinal function?
-            uint32_t ops_per_cpu = ops_per_function_per_slot[ lng->longitudinal_type ][ slot_idx ];
+            uint32_t ops_per_cpu = lng->runtime_recipe
+                                 ? lng->runtime_op_count[ slot_idx ]
+                                 : ops_per_function_per_slot[ lng->longitudinal_type ][ slot_idx ];
 
             if( 0 == ops_per_cpu ){
                 lng->batches[ slot_idx ] = NULL;
@@ -420,43 +666,143 @@ static void setup_longitudinal_batches( struct job *job ){
             lng->batches[ slot_idx ]->version   = MSR_SAFE_VERSION_u32;
             lng->batches[ slot_idx ]->ops       = calloc( total_ops, sizeof( struct msr_batch_op ) );
             // Make copies of the operations listed in longitudinal_recipes[ functions ][ slots ][ ops ]
+            // (or in the runtime recipe).
             for( uint32_t op_idx = 0; op_idx < ops_per_cpu; op_idx++ ){
                 for ( uint32_t cpu_idx = 0, current_cpu = 0; cpu_idx < ncpu; cpu_idx++ ){
                     memcpy( &(lng->batches[ slot_idx ]->ops[ (op_idx * ncpu) + cpu_idx ]),
-                            longitudinal_recipes[ lng->longitudinal_type ][ slot_idx ][ op_idx ],
+                            lng->runtime_recipe
+                                ? &( lng->runtime_ops[ slot_idx ][ op_idx ] )
+                                : longitudinal_recipes[ lng->longitudinal_type ][ slot_idx ][ op_idx ],
                             sizeof( struct msr_batch_op ) );
                     lng->batches[ slot_idx ]->ops[ (op_idx * ncpu) + cpu_idx ].err = UNUSED_OP;
                     current_cpu = get_next_cpu( current_cpu, max_msrsafe_cpu, &(lng->sample_cpus), NULL );
                     lng->batches[ slot_idx ]->ops[ (op_idx * ncpu) + cpu_idx ].cpu = current_cpu;
                     current_cpu++;
+                    // START and STOP always carry a TSC so we can measure their spread.
+                    if( slot_idx == START || slot_idx == STOP ){
+                        lng->batches[ slot_idx ]->ops[ (op_idx * ncpu) + cpu_idx ].op |= OP_TSC;
+                    }
+                }
+            }
+        }
+    }
+}
+
+static void setup_socket_batches( struct job *job ){
+
+    // For --parallelLongitudinal, split START and STOP into one batch per package.
+    // The ops are stably reordered by package so that ops for the same cpu keep
+    // their relative order, and each package batch points into the original array.
+    job->package_count = 0;
+    for( size_t i = 0; i < job->longitudinal_count; i++ ){
+        bool valid;
+        for( unsigned int cpu = get_next_cpu( 0, max_msrsafe_cpu, &(job->longitudinals[i]->sample_cpus), &valid );
+                valid;
+                cpu = get_next_cpu( cpu + 1, max_msrsafe_cpu, &(job->longitudinals[i]->sample_cpus), &valid ) ){
+            unsigned int package = cpu2package( cpu );
+            if( package + 1 > job->package_count ){
+                job->package_count = package + 1;
+            }
+        }
+    }
+
+    for( size_t i = 0; i < job->longitudinal_count; i++ ){
+        struct longitudinal_config *lng = job->longitudinals[i];
+        for( longitudinal_slot_t slot_idx = START; slot_idx <= STOP; slot_idx++ ){
+            if( NULL == lng->batches[ slot_idx ] ){
+                continue;
+            }
+            struct msr_batch_array *b = lng->batches[ slot_idx ];
+            struct msr_batch_op *sorted = calloc( b->numops, sizeof( struct msr_batch_op ) );
+            unsigned int *op_package = calloc( b->numops, sizeof( unsigned int ) );
+            lng->socket_batches[ slot_idx ] = calloc( job->package_count, sizeof( struct msr_batch_array ) );
+            assert( sorted && op_package && lng->socket_batches[ slot_idx ] );
+
+            for( size_t op_idx = 0; op_idx < b->numops; op_idx++ ){
+                op_package[ op_idx ] = cpu2package( b->ops[ op_idx ].cpu );
+            }
+            size_t n = 0;
+            for( size_t package = 0; package < job->package_count; package++ ){
+                size_t first = n;
+                for( size_t op_idx = 0; op_idx < b->numops; op_idx++ ){
+                    if( op_package[ op_idx ] == package ){
+                        sorted[ n++ ] = b->ops[ op_idx ];
+                    }
                 }
+                lng->socket_batches[ slot_idx ][ package ].numops  = n - first;
+                lng->socket_batches[ slot_idx ][ package ].version = MSR_SAFE_VERSION_u32;
+                lng->socket_batches[ slot_idx ][ package ].ops     = &( b->ops[ first ] );
             }
+            assert( n == b->numops );
+            memcpy( b->ops, sorted, b->numops * sizeof( struct msr_batch_op ) );
+            free( sorted );
+            free( op_package );
         }
     }
 }
 
+static void setup_polling_buffers( struct job *job ){
+    for( size_t i = 0; i < job->poll_count; i++ ){
+        job->polls[i]->total_ops = poll_sample_capacity( &job->duration, job->polls[i] );
+
+        // Written by the poll thread during the run; see measurement_alloc().
+        setup_poll_samples( job->polls[i], job->zero_fault );
+    }
+}
+
 void setup_msrsafe_batches( struct job *job ){
 
     setup_polling_batches( job );
+    setup_powercap_polls( job );
+    calibrate_poll_cadences( job );     // Auto intervals, which the buffers are sized by.
+    setup_polling_buffers( job );
     setup_longitudinal_batches( job );
+    probe_longitudinal_batches( job );
+    merge_global_enables( job );
+    if( job->parallel_longitudinals ){
+        setup_socket_batches( job );
+    }
+}
+
+static bool has_msrsafe_longitudinals( const struct job *job ){
+    // perf_event_open(2) longitudinals never touch msr-safe.
+    for( size_t i = 0; i < job->longitudinal_count; i++ ){
+        if( !job->longitudinals[i]->use_perf ){
+            return true;
+        }
+    }
+    return false;
+}
+
+bool needs_msrsafe( const struct job *job ){
+
+    // Powercap polls read sysfs and perf longitudinals use perf_event_open(2);
+    // everything else goes through msr-safe.
+    if( job->calibrate || has_msrsafe_longitudinals( job ) ){
+        return true;
+    }
+    for( size_t i = 0; i < job->poll_count; i++ ){
+        if( !job->polls[i]->powercap ){
+            return true;
+        }
+    }
+    return false;
 }
 
 void populate_allowlist( void ) {
 
     // Keep it manual.
-    int fd = open("/dev/cpu/msr_allowlist", O_WRONLY);
-    assert(-1 != fd);
-    ssize_t nbytes = write(fd, allowlist, strlen(allowlist));
+    ssize_t nbytes = msr_allowlist_write( allowlist, strlen(allowlist) );
     if( -1 == nbytes ){
         fprintf( stderr, "%s:%d:%s Loading allowlist failed:  (%d) %s.\n",
                 __FILE__, __LINE__, __func__, errno, strerror( errno ) );
         exit(-1);
     }
     if( nbytes != strlen(allowlist) ){
-        fprintf( stderr, "%zd bytes written to /dev/cpu/msr_allowlist, expected to write %zu.\n", nbytes, strlen(allowlist) );
+        fprintf( stderr, "%zd bytes written to the %s allowlist, expected to write %zu.\n",
+                nbytes, get_msr_backend()->name, strlen(allowlist) );
         exit(-1);
     }
-    close(fd);
 }
 /*
 static void read_all_msrs( FILE *fp, cpu_set_t *cpus ){
@@ -501,15 +847,25 @@ static void read_all_msrs( FILE *fp, cpu_set_t *cpus ){
 }
 */
 
-static void print_header( FILE* fp, uint64_t op_bitfield ){
-    static bool is_first = true;
+// Longitudinal dumps are space-separated with registers in hex; the poll
+// TSVs are tab-separated with counters in decimal and the phase after the tag.
+typedef enum{ DUMP_HEX, DUMP_TSV } dump_format_t;
+
+static void print_header( FILE* fp, uint64_t op_bitfield, dump_format_t format ){
+    bool is_first = true;
+    const char *sep = ( DUMP_TSV == format ) ? "\t" : " ";
     if( 0 == op_bitfield ){
         fprintf( fp, "# No column headers requested\n");
     }else{
-        fprintf( fp, "# bitfield for header selection is:  %#"PRIx64"\n", op_bitfield );
+        if( DUMP_HEX == format ){
+            fprintf( fp, "# bitfield for header selection is:  %#"PRIx64"\n", op_bitfield );
+        }
         for( op_field_arridx_t arridx = 0; arridx < op_field_arridx_MAX_IDX; arridx++ ){
             if( op_bitfield & ( 1 << arridx ) ){
-                fprintf( fp, is_first ? "%s" : " %s", opfield2str[ arridx ] );
+                fprintf( fp, "%s%s", is_first ? "" : sep, opfield2str[ arridx ] );
+                if( op_field_arridx_TAG == arridx && DUMP_TSV == format ){
+                    fprintf( fp, "\tPHASE" );
+                }
                 is_first = false;
             }
         }
@@ -518,29 +874,50 @@ static void print_header( FILE* fp, uint64_t op_bitfield ){
     return;
 }
 
+// The per-sample columns a poll with these flags fills in:  the msr value
+// always, msrdata2 with OP_POLL, each OP_* modifier and DELTA_* requested,
+// and the phase tag (followed by the phase itself).
+static uint64_t poll_flags2fields( uint16_t flags ){
+    uint64_t fields = op_field_bitidx_MSRDATA;
+    if( flags & OP_POLL       ){ fields |= op_field_bitidx_MSRDATA2;      }
+    if( flags & OP_TSC        ){ fields |= op_field_bitidx_TSC;           }
+    if( flags & OP_MPERF      ){ fields |= op_field_bitidx_MPERF;         }
+    if( flags & OP_APERF      ){ fields |= op_field_bitidx_APERF;         }
+    if( flags & OP_THERM      ){ fields |= op_field_bitidx_THERM;         }
+    if( flags & OP_PTHERM     ){ fields |= op_field_bitidx_PTHERM;        }
+    if( flags & DELTA_MSRDATA ){ fields |= op_field_bitidx_DELTA_MSRDATA; }
+    if( flags & DELTA_TSC     ){ fields |= op_field_bitidx_DELTA_TSC;     }
+    if( flags & DELTA_MPERF   ){ fields |= op_field_bitidx_DELTA_MPERF;   }
+    if( flags & DELTA_APERF   ){ fields |= op_field_bitidx_DELTA_APERF;   }
+    if( flags & DELTA_THERM   ){ fields |= op_field_bitidx_DELTA_THERM;   }
+    if( flags & DELTA_PTHERM  ){ fields |= op_field_bitidx_DELTA_PTHERM;  }
+    return fields | op_field_bitidx_TAG;
+}
+
 // Given a therm or ptherm values, extract and return bits 22:17.
 static int8_t get_temperature( uint64_t val ){
     return (int8_t)( (val >> 17) & 0x3fULL );
 }
 
-static void print_op( FILE *fp, uint64_t op_bitfield, struct msr_batch_op *o, struct msr_batch_op *prev, bool skip_unused ){
+static void print_op( FILE *fp, uint64_t op_bitfield, struct msr_batch_op *o, struct msr_batch_op *prev, bool skip_unused, dump_format_t format ){
 
     if( ( o->err == UNUSED_OP ) && skip_unused ){
         return;
     }
 
-    static bool is_first = true;    // Add a leading space to all but the first field
+    bool is_first = true;           // Add a leading separator to all but the first field
+    bool tsv = ( DUMP_TSV == format );
 
     if( 0 == op_bitfield ){
         fprintf( fp, "# No column headers requested\n");
     }else{
         for( op_field_arridx_t arridx = 0; arridx < op_field_arridx_MAX_IDX; arridx++ ){
             if( op_bitfield & ( 1 << arridx ) ){
-                // extra leading space for all but the first value
+                // extra leading separator for all but the first value
                 if( is_first ){
                     is_first = false;
                 }else{
-                    fprintf( fp, " " );
+                    fprintf( fp, tsv ? "\t" : " " );
                 }
                 // print out the formatted value
                 // casting required because the kernel's _u64 is not quite the same time as uint64_t
@@ -552,14 +929,20 @@ static void print_op( FILE *fp, uint64_t op_bitfield, struct msr_batch_op *o, st
                     case op_field_arridx_POLL_MAX:      fprintf( fp, "%#"PRIx32, (uint32_t)(o->poll_max) );     break;
                     case op_field_arridx_WMASK:         fprintf( fp, "%#"PRIx64, (uint64_t)(o->wmask) );        break;
                     case op_field_arridx_MSR:           fprintf( fp, "%#"PRIx32, (uint32_t)(o->msr) );          break;
-                    case op_field_arridx_MSRDATA:       fprintf( fp, "%#"PRIx64, (uint64_t)(o->msrdata) );      break;
-                    case op_field_arridx_MSRDATA2:      fprintf( fp, "%#"PRIx64, (uint64_t)(o->msrdata2) );     break;
-                    case op_field_arridx_TSC:           fprintf( fp, "%#"PRIx64, (uint64_t)(o->tsc) );          break;
-                    case op_field_arridx_MPERF:         fprintf( fp, "%#"PRIx64, (uint64_t)(o->mperf) );        break;
-                    case op_field_arridx_APERF:         fprintf( fp, "%#"PRIx64, (uint64_t)(o->aperf) );        break;
+                    case op_field_arridx_MSRDATA:       fprintf( fp, tsv ? "%"PRIu64 : "%#"PRIx64, (uint64_t)(o->msrdata) );  break;
+                    case op_field_arridx_MSRDATA2:      fprintf( fp, tsv ? "%"PRIu64 : "%#"PRIx64, (uint64_t)(o->msrdata2) ); break;
+                    case op_field_arridx_TSC:           fprintf( fp, tsv ? "%"PRIu64 : "%#"PRIx64, (uint64_t)(o->tsc) );      break;
+                    case op_field_arridx_MPERF:         fprintf( fp, tsv ? "%"PRIu64 : "%#"PRIx64, (uint64_t)(o->mperf) );    break;
+                    case op_field_arridx_APERF:         fprintf( fp, tsv ? "%"PRIu64 : "%#"PRIx64, (uint64_t)(o->aperf) );    break;
                     case op_field_arridx_THERM:         fprintf( fp, "%"PRId8,   get_temperature(o->therm) );   break;
                     case op_field_arridx_PTHERM:        fprintf( fp, "%"PRId8,   get_temperature(o->ptherm));   break;
-                    case op_field_arridx_TAG:           fprintf( fp, "%#"PRIx64, (uint64_t)(o->tag) );          break;
+                    case op_field_arridx_TAG:
+                        if( tsv ){
+                            fprintf( fp, "%"PRIu64"\t%"PRIu64, (uint64_t)(o->tag), (uint64_t)(o->tag >> 1) );
+                        }else{
+                            fprintf( fp, "%#"PRIx64, (uint64_t)(o->tag) );
+                        }
+                        break;
                     case op_field_arridx_DELTA_MPERF:   if( prev && ( prev->err != UNUSED_OP ) ){ fprintf( fp, "%"PRId64, (int64_t)( o->mperf   - prev->mperf   ) ); } break;
                     case op_field_arridx_DELTA_APERF:   if( prev && ( prev->err != UNUSED_OP ) ){ fprintf( fp, "%"PRId64, (int64_t)( o->aperf   - prev->aperf   ) ); } break;
                     case op_field_arridx_DELTA_TSC:     if( prev && ( prev->err != UNUSED_OP ) ){ fprintf( fp, "%"PRId64, (int64_t)( o->tsc     - prev->tsc     ) ); } break;
@@ -599,33 +982,26 @@ static void print_summaries( struct job *job ){
             // If we don't have at least two ops, give up.
             continue;
         }
-        if( UNUSED_OP == job->polls[i]->poll_ops[0].err
-         || UNUSED_OP == job->polls[i]->poll_ops[0].err){
+        if( job->polls[i]->samples.count < 2 ){
             // If either or both of the first two ops were never used, give up.
             continue;
         }
         // Find the last entry
-        size_t o;
-        for( o = 0; o < job->polls[i]->total_ops; o++ ){
-            if( UNUSED_OP == job->polls[i]->poll_ops[o].err ){
-                break;
-            }
-        }
-        o--;    // We want the last-non-DECAFBAD op.
+        size_t o = job->polls[i]->samples.count - 1;
         printf( "# SUMMARY %s\n", job->polls[i]->local_optarg );
         if( PKG_ENERGY == job->polls[i]->poll_type
          || PP0_ENERGY == job->polls[i]->poll_type
          || PP1_ENERGY == job->polls[i]->poll_type
          || DRAM_ENERGY == job->polls[i]->poll_type){
             printf( "# SUMMARY delta msrdata = %llu\n",
-                    job->polls[i]->poll_ops[o].msrdata - job->polls[i]->poll_ops[0].msrdata );
+                    job->polls[i]->samples.msrdata[o] - job->polls[i]->samples.msrdata[0] );
         }
         printf( "# SUMMARY delta tsc     = %llu\n",
-                job->polls[i]->poll_ops[o].tsc - job->polls[i]->poll_ops[0].tsc);
+                job->polls[i]->samples.tsc[o] - job->polls[i]->samples.tsc[0]);
         printf( "# SUMMARY initial C     = %llu\n",
-                EXTRACT_TEMPERATURE( job->polls[i]->poll_ops[0].therm) );
+                EXTRACT_TEMPERATURE( job->polls[i]->samples.therm[0]) );
         printf( "# SUMMARY final C       = %llu\n",
-                EXTRACT_TEMPERATURE( job->polls[i]->poll_ops[o].therm) );
+                EXTRACT_TEMPERATURE( job->polls[i]->samples.therm[o]) );
 
     }
 }
@@ -633,31 +1009,42 @@ static void print_summaries( struct job *job ){
 
 static void manage_energy_rollover( struct job *job ){
 
-    uint64_t cumulative_adjustment = 0;
-    constexpr const uint64_t rollover_adjustment = 1ULL << 32;
-
     for( size_t i = 0; i < job->poll_count; i++ ){
+        // The MSRs wrap at 32 bits; powercap wraps past max_energy_range_uj.
+        uint64_t cumulative_adjustment = 0;
+        const uint64_t rollover_adjustment = job->polls[i]->powercap
+                                           ? job->polls[i]->powercap_max_range + 1
+                                           : 1ULL << 32;
         if( job->polls[i]->msr == PKG_ENERGY_STATUS
          || job->polls[i]->msr == PP0_ENERGY_STATUS
          || job->polls[i]->msr == PP1_ENERGY_STATUS
          || job->polls[i]->msr == DRAM_ENERGY_STATUS
+         || job->polls[i]->msr == PLATFORM_ENERGY_COUNTER
         ){
-            for( size_t b = 0; b < job->polls[i]->total_ops; b++ ){
+            // Without OP_POLL there is no msrdata2 column and the last value seen is msrdata.
+            uint64_t *msrdata  = job->polls[i]->samples.msrdata;
+            uint64_t *msrdata2 = job->polls[i]->samples.msrdata2;   // NULL without OP_POLL.
+            for( size_t b = 0; b < job->polls[i]->samples.count; b++ ){
 
                 // Handle the rollover case here so we don't have to reinvent solutions
                 // in the analysis phase.
-                job->polls[i]->poll_ops[b].msrdata  += cumulative_adjustment;
-                job->polls[i]->poll_ops[b].msrdata2 += cumulative_adjustment;
+                msrdata[b]  += cumulative_adjustment;
+                if( msrdata2 ){
+                    msrdata2[b] += cumulative_adjustment;
+                }
+                uint64_t previous = ( b > 0 ) ? ( msrdata2 ? msrdata2[b-1] : msrdata[b-1] ) : 0;
 
                 // 1. Check to see if rollover happened within a poll op.
-                if( job->polls[i]->poll_ops[b].msrdata2 < job->polls[i]->poll_ops[b].msrdata ){
-                    job->polls[i]->poll_ops[b].msrdata2 += rollover_adjustment;
+                if( msrdata2 && msrdata2[b] < msrdata[b] ){
+                    msrdata2[b] += rollover_adjustment;
                     cumulative_adjustment += rollover_adjustment;
 
                 // 2. Check to see if rollover happened between ops.
-                }else if( (b > 0) && (job->polls[i]->poll_ops[b].msrdata < job->polls[i]->poll_ops[b-1].msrdata2) ){
-                    job->polls[i]->poll_ops[b].msrdata  += rollover_adjustment;
-                    job->polls[i]->poll_ops[b].msrdata2 += rollover_adjustment;
+                }else if( (b > 0) && (msrdata[b] < previous) ){
+                    msrdata[b]  += rollover_adjustment;
+                    if( msrdata2 ){
+                        msrdata2[b] += rollover_adjustment;
+                    }
                     cumulative_adjustment += rollover_adjustment;
                 }
             }
@@ -670,13 +1057,43 @@ static void print_execution_counts( struct job *job ){
     snprintf( filename, 2047, "./benchmarks.out" );
     FILE *fp = fopen( filename, "w" );
     assert( fp != NULL );
-    fprintf(fp, "benchmark_type cpu A B\n");
+    // One loop count per phase.
+    fprintf(fp, "benchmark_type cpu");
+    for( size_t k = 0; k < job->phases; k++ ){
+        fprintf( fp, " %c", (char)( 'A' + k ) );
+    }
+    fprintf( fp, "\n" );
+    for( size_t i = 0; i < job->benchmark_count; i++ ){
+        fprintf( fp, "%s %u",
+            benchmarktype2str[ job->benchmarks[ i ]->benchmark_type ],
+            get_next_cpu( 0, 255, &(job->benchmarks[ i ]->execution_cpu ), NULL ) );
+        for( size_t k = 0; k < job->phases; k++ ){
+            fprintf( fp, " %15"PRIu64, job->benchmarks[ i ]->executed_loops[k] );
+        }
+        fprintf( fp, "\n" );
+    }
+    fclose(fp);
+}
+
+static void print_phase_transitions( struct job *job ){
+    // One row per phase change.  The main thread's TSC is when the change
+    // was made; each benchmark column is when that thread first observed it
+    // (0 if it never did, e.g., SPIN, or the phase was too short to notice).
+    FILE *fp = fopen( "./phases.out", "w" );
+    assert( fp != NULL );
+    fprintf( fp, "transition selector main_tsc" );
     for( size_t i = 0; i < job->benchmark_count; i++ ){
-        fprintf( fp, "%s %u %15"PRIu64" %15"PRIu64"\n",
+        fprintf( fp, " %s_%u",
             benchmarktype2str[ job->benchmarks[ i ]->benchmark_type ],
-            get_next_cpu( 0, 255, &(job->benchmarks[ i ]->execution_cpu ), NULL ),
-            job->benchmarks[ i ]->executed_loops[0],
-            job->benchmarks[ i ]->executed_loops[1] );
+            get_next_cpu( 0, 255, &(job->benchmarks[ i ]->execution_cpu ), NULL ) );
+    }
+    fprintf( fp, "\n" );
+    for( size_t t = 0; t < job->phase_transition_count; t++ ){
+        fprintf( fp, "%zu %"PRIu8" %"PRIu64, t, job->phase_selector[ t ], job->phase_tsc[ t ] );
+        for( size_t i = 0; i < job->benchmark_count; i++ ){
+            fprintf( fp, " %"PRIu64, job->benchmarks[ i ]->phase_tsc[ t ] );
+        }
+        fprintf( fp, "\n" );
     }
     fclose(fp);
 }
@@ -688,6 +1105,10 @@ void dump_batches( struct job *job ){
         print_execution_counts( job );
     }
 
+    if( job->phase_transition_count ){
+        print_phase_transitions( job );
+    }
+
     //fprintf( stderr, "%s:%d:%s Dumping longitudinal batches.\n", __FILE__, __LINE__, __func__ );
     if( job->longitudinal_count ){
 
@@ -718,20 +1139,41 @@ void dump_batches( struct job *job ){
                             break;
                         case ALL_ALLOWED:
                             break;
+                        case CAPFREQUENCY:
+                            fprintf( fp, "# 0x0198 PERF_STATUS (ratio requested:  %"PRIu64")\n", job->longitudinals[i]->ratio );
+                            break;
+                        case COLDSTART:
+                            fprintf( fp, "# 0x019c THERM_STATUS, 0x01b1 PACKAGE_THERM_STATUS\n" );
+                            break;
+                        case ZEROAMPERF:
+                            fprintf( fp, "# 0x00e8 APERF, 0x00e7 MPERF (both zeroed at START)\n" );
+                            break;
+                        case ENERGY_COUNTERS:
+                            fprintf( fp, "# Raw counts; see longitudinal_%zu_%s_JOULES.out for wrap-corrected joules.\n",
+                                    i, longitudinaltype2str[ ENERGY_COUNTERS ] );
+                            break;
+                        case GENERAL_PURPOSE_COUNTERS:
+                            for( size_t x = 0; x < job->longitudinals[i]->event_count; x++ ){
+                                fprintf( fp, "# %#06zx PMC%zu (PERFEVTSEL%zu=%#"PRIx64")\n",
+                                        (size_t)PMC0 + x, x, x, job->longitudinals[i]->events[x] | PERFEVTSEL_USR_OS_EN );
+                            }
+                            break;
                         default:
                             assert(0);
                             break;
                     }
                 }
 
-                print_header( fp,op_field_bitidx_CPU | op_field_bitidx_ERR | op_field_bitidx_MSR | op_field_bitidx_MSRDATA | op_field_bitidx_TSC);
+                print_header( fp,op_field_bitidx_CPU | op_field_bitidx_ERR | op_field_bitidx_MSR | op_field_bitidx_MSRDATA | op_field_bitidx_TSC, DUMP_HEX );
                 for( size_t op_idx = 0; op_idx < job->longitudinals[i]->batches[slot_idx]->numops; op_idx++ ){
                     print_op( fp, op_field_bitidx_CPU | op_field_bitidx_ERR | op_field_bitidx_MSR | op_field_bitidx_MSRDATA | op_field_bitidx_TSC,
-                            &( job->longitudinals[i]->batches[slot_idx]->ops[op_idx] ), NULL, true);
+                            &( job->longitudinals[i]->batches[slot_idx]->ops[op_idx] ), NULL, true, DUMP_HEX );
                 }
                 fclose( fp );
             }
         }
+        dump_energy_accumulators( job );
+        dump_snapshots( job );
     }
 
     if( job->poll_count ){
@@ -763,11 +1205,9 @@ void dump_batches( struct job *job ){
                 double v[64] = {0.0};   // Cumulative vote.
 
                 // iterate over all of our ops.
-                for( size_t o = 0; o < job->polls[i]->total_ops; o++ ){
-                    if( job->polls[i]->poll_ops[o].err == UNUSED_OP ){
-                        break;
-                    }
-                    if( (job->polls[i]->poll_ops[o].tag & 0x1ull) == 0 ){
+                const struct poll_samples *smp = &job->polls[i]->samples;
+                for( size_t o = 0; o < smp->count; o++ ){
+                    if( (smp->tag[o] & 0x1) == 0 ){
                         continue;   // Ignore measurements that span A|B boundaries.
                     }
                     // Get the result of the last xor (the "encoded" value)
@@ -777,7 +1217,7 @@ void dump_batches( struct job *job ){
                     uint64_t hw  = __builtin_popcount( enc );
 
                     // How many fractional Joules were consumed encoding that repeatedly?
-                    uint64_t fJ  = job->polls[i]->poll_ops[o].msrdata2 - job->polls[i]->poll_ops[o].msrdata; // FIXME Doesn't handle sw polling rate > hw polling rate
+                    uint64_t fJ  = ( smp->msrdata2 ? smp->msrdata2[o] : 0 ) - smp->msrdata[o]; // FIXME Doesn't handle sw polling rate > hw polling rate
 
                     // Divide fractional joules by the number of 1 bits.
                     double vote = fJ /(double)(hw);
@@ -819,14 +1259,11 @@ void dump_batches( struct job *job ){
                 double vote;
                 double v[64] = {0.0};   // Cumulative vote.
 
-                for( size_t o = 0; o < job->polls[i]->total_ops; o++ ){
-                    if( job->polls[i]->poll_ops[o].err == UNUSED_OP ){
-                        break;
-                    }
+                for( size_t o = 0; o < job->polls[i]->samples.count; o++ ){
                     key = job->polls[i]->key;   // Convenience, shouldn't change
                     enc = job->polls[i]->benchmark_output[ o ];
                     hw  = __builtin_popcount( job->polls[i]->benchmark_output[ o ] );
-                    fJ  = job->polls[i]->poll_ops[o].msrdata2 - job->polls[i]->poll_ops[o].msrdata; // FIXME Doesn't handle sw polling rate > hw polling rate
+                    fJ  = job->polls[i]->samples.msrdata2[o] - job->polls[i]->samples.msrdata[o]; // FIXME Doesn't handle sw polling rate > hw polling rate
                     vote= fJ /(double)(hw);
 
                     for( size_t j = 0; j < 64; j++ ){
@@ -845,98 +1282,343 @@ void dump_batches( struct job *job ){
 #endif
             }
 
+            // Archive, in place of the text dumps below.
+            if( job->archive ){
+                snprintf( filename, 2047, "./poll_%zu.var", i );
+                write_poll_archive( filename, job->polls[i] );
+                continue;
+            }
+
             // Raw dump
             snprintf( filename, 2047, "./poll_%zu.raw", i );
             FILE *fp = fopen( filename, "w" );
             assert( NULL != fp );
-            fprintf( fp, "cpu op err poll_max msr wmask msrdata msrdata2 tsc mperf aperf therm ptherm tag\n" );
+            fprintf( fp, "cpu op err poll_max msr wmask msrdata msrdata2 tsc mperf aperf therm ptherm tag phase\n" );
             for( size_t o = 0; o < job->polls[i]->total_ops; o++ ){
-                fprintf( fp, "%"PRIu16" ",  (uint16_t) job->polls[i]->poll_ops[o].cpu );
-                fprintf( fp, "%"PRIu16" ",  (uint16_t) job->polls[i]->poll_ops[o].op  );
-                fprintf( fp, "%"PRId32" ",  ( int32_t) job->polls[i]->poll_ops[o].err );
-                fprintf( fp, "%"PRIu32" ",  (uint32_t) job->polls[i]->poll_ops[o].poll_max );
-                fprintf( fp, "%#"PRIx32" ", (uint32_t) job->polls[i]->poll_ops[o].msr );
-                fprintf( fp, "%#"PRIx64" ", (uint64_t) job->polls[i]->poll_ops[o].wmask );
-                fprintf( fp, "%"PRIu64" ",  (uint64_t) job->polls[i]->poll_ops[o].msrdata );
-                fprintf( fp, "%"PRIu64" ",  (uint64_t) job->polls[i]->poll_ops[o].msrdata2 );
-                fprintf( fp, "%"PRIu64" ",  (uint64_t) job->polls[i]->poll_ops[o].tsc );
-                fprintf( fp, "%"PRIu64" ",  (uint64_t) job->polls[i]->poll_ops[o].mperf );
-                fprintf( fp, "%"PRIu64" ",  (uint64_t) job->polls[i]->poll_ops[o].aperf );
-                fprintf( fp, "%"PRIu64" ",  (uint64_t) job->polls[i]->poll_ops[o].therm );
-                fprintf( fp, "%"PRIu64" ",  (uint64_t) job->polls[i]->poll_ops[o].ptherm );
-                fprintf( fp, "%"PRIu64   ,  (uint64_t) job->polls[i]->poll_ops[o].tag );
+                struct msr_batch_op op;
+                load_poll_sample( job->polls[i], o, &op );
+                fprintf( fp, "%"PRIu16" ",  (uint16_t) op.cpu );
+                fprintf( fp, "%"PRIu16" ",  (uint16_t) op.op  );
+                fprintf( fp, "%"PRId32" ",  ( int32_t) op.err );
+                fprintf( fp, "%"PRIu32" ",  (uint32_t) op.poll_max );
+                fprintf( fp, "%#"PRIx32" ", (uint32_t) op.msr );
+                fprintf( fp, "%#"PRIx64" ", (uint64_t) op.wmask );
+                fprintf( fp, "%"PRIu64" ",  (uint64_t) op.msrdata );
+                fprintf( fp, "%"PRIu64" ",  (uint64_t) op.msrdata2 );
+                fprintf( fp, "%"PRIu64" ",  (uint64_t) op.tsc );
+                fprintf( fp, "%"PRIu64" ",  (uint64_t) op.mperf );
+                fprintf( fp, "%"PRIu64" ",  (uint64_t) op.aperf );
+                fprintf( fp, "%"PRIu64" ",  (uint64_t) op.therm );
+                fprintf( fp, "%"PRIu64" ",  (uint64_t) op.ptherm );
+                fprintf( fp, "%"PRIu64" ",  (uint64_t) op.tag );
+                fprintf( fp, "%"PRIu64   ,  (uint64_t) op.tag >> 1 );
                 fprintf( fp, "\n" );
             }
             fclose(fp);
         }
 
-        // Nicer dump
-        // For each poll...
-        for( size_t i = 0; i < job->poll_count; i++ ){
+        // Nicer dump:  one tab-separated file per poll, one row per sample, with
+        // exactly the columns the flags asked for.
+        for( size_t i = 0; i < job->poll_count && !job->archive; i++ ){
 
-            static char filename[2048];
-            FILE *fp[ op_field_arridx_MAX_IDX ];
+            uint64_t op_bitfield = poll_flags2fields( job->polls[i]->flags );
+            snprintf( filename, 2047, "./poll_%zu_%#"PRIx32".tsv", i, job->polls[i]->msr );
+            FILE *fp = fopen( filename, "w" );
+            if( fp == NULL ){
+                perror("");
+                fprintf( stderr, "%s:%d:%s Error opening file %s.  Bye!\n", __FILE__, __LINE__, __func__, filename );
+                exit(-1);
+            }
+            print_header( fp, op_bitfield, DUMP_TSV );
+
+            // DELTA_* columns are empty in the first row.
+            struct msr_batch_op op = { 0 }, prev;
+            for( size_t o = 0; o < job->polls[i]->samples.count; o++ ){
+                prev = op;
+                load_poll_sample( job->polls[i], o, &op );
+                print_op( fp, op_bitfield, &op, o ? &prev : NULL, true, DUMP_TSV );
+            }
+            fclose( fp );
+        }
+    }
+}
 
-            // ...for each array index...
-            for( op_field_arridx_t arridx = 0; arridx < op_field_arridx_MAX_IDX; arridx++ ){
 
-                // ...create a file based on the poll and array index name....
-                snprintf( filename, 2047, "./poll_%zu_%s_%#"PRIx32".out", i, opfield2str[ arridx ], job->polls[i]->msr );
+struct socket_helper{
+    struct job                  *job;
+    struct start_barrier        *barrier;
+    longitudinal_slot_t         slot_idx;
+    size_t                      package;
+    cpu_set_t                   cpu;
+    uint64_t                    start_tsc;
+};
 
-                // ...create that file...
-                fp[ arridx ] = fopen( filename, "w" );
-                if( fp[ arridx ] == NULL ){
-                    perror("");
-                    fprintf( stderr, "%s:%d:%s Error opening file %s.  Bye!\n", __FILE__, __LINE__, __func__, filename );
-                    exit(-1);
-                }
+static void* socket_helper_start( void *v ){
+    // Issue this package's share of every longitudinal's START or STOP batch.
+    struct socket_helper *h = v;
+    assert( 0 == sched_setaffinity( 0, sizeof( cpu_set_t ), &( h->cpu ) ) );
+    int fd = msr_batch_open();
+    assert( -1 != fd );
+    start_barrier_wait( h->barrier, &( h->start_tsc ) );
+    for( size_t i = 0; i < h->job->longitudinal_count; i++ ){
+        struct msr_batch_array *b = h->job->longitudinals[i]->socket_batches[ h->slot_idx ];
+        if( NULL == b || 0 == b[ h->package ].numops ){
+            continue;
+        }
+        // See run_longitudinal_batches() regarding the ignored return code.
+        msr_batch( fd, &( b[ h->package ] ) );
+    }
+    msr_batch_close( fd );
+    return NULL;
+}
+
+static void run_longitudinal_batches_parallel( struct job *job, longitudinal_slot_t slot_idx ){
+
+    // One helper per package that has work, pinned to the first cpu in that
+    // package that appears in any of the longitudinal batches.
+    struct socket_helper *helpers = calloc( job->package_count, sizeof( struct socket_helper ) );
+    pthread_t *threads = calloc( job->package_count, sizeof( pthread_t ) );
+    bool *active = calloc( job->package_count, sizeof( bool ) );
+    assert( helpers && threads && active );
+    struct start_barrier barrier = { .arrived = 0, .release_tsc = 0 };
+
+    size_t helper_count = 0;
+    for( size_t package = 0; package < job->package_count; package++ ){
+        for( size_t i = 0; i < job->longitudinal_count && !active[ package ]; i++ ){
+            struct msr_batch_array *b = job->longitudinals[i]->socket_batches[ slot_idx ];
+            if( b && b[ package ].numops ){
+                active[ package ] = true;
+                cpu2cpuset( b[ package ].ops[0].cpu, &( helpers[ package ].cpu ) );
+            }
+        }
+        if( active[ package ] ){
+            helpers[ package ].job      = job;
+            helpers[ package ].barrier  = &barrier;
+            helpers[ package ].slot_idx = slot_idx;
+            helpers[ package ].package  = package;
+            assert( 0 == pthread_create( &threads[ package ], NULL, socket_helper_start, &helpers[ package ] ) );
+            helper_count++;
+        }
+    }
+
+    const struct timespec lead = { .tv_sec = 0, .tv_nsec = 1'000'000L };
+    start_barrier_release( &barrier, helper_count, &lead );
+
+    for( size_t package = 0; package < job->package_count; package++ ){
+        if( active[ package ] ){
+            assert( 0 == pthread_join( threads[ package ], NULL ) );
+        }
+    }
+    free( active );
+    free( threads );
+    free( helpers );
+}
 
-                // ...and print a header to it.
-                print_header( fp[ arridx ], 1ULL << arridx );
+static struct msr_batch_op * find_read_op( struct msr_batch_array *b, uint16_t cpu, uint32_t msr ){
+    for( size_t op_idx = 0; b && op_idx < b->numops; op_idx++ ){
+        if( b->ops[ op_idx ].cpu == cpu && b->ops[ op_idx ].msr == msr && ( b->ops[ op_idx ].op & OP_READ ) ){
+            return &( b->ops[ op_idx ] );
+        }
+    }
+    return NULL;
+}
+
+static void prepare_capfrequency( struct job *job, int fd ){
+    // Read PERF_CTL and HWP_REQUEST just before SETUP and merge the requested
+    // ratio fields into what's there.  If the read fails, turn the write into
+    // a read rather than clobber the other fields.
+    for( size_t i = 0; i < job->longitudinal_count; i++ ){
+        struct longitudinal_config *lng = job->longitudinals[i];
+        if( lng->longitudinal_type != CAPFREQUENCY || NULL == lng->batches[ SETUP ] ){
+            continue;
+        }
+        struct msr_batch_array *setup = lng->batches[ SETUP ];
+        struct msr_batch_array current = { .numops = 0, .version = MSR_SAFE_VERSION_u32 };
+        current.ops = calloc( setup->numops, sizeof( struct msr_batch_op ) );
+        assert( current.ops );
+        for( size_t op_idx = 0; op_idx < setup->numops; op_idx++ ){
+            if( setup->ops[ op_idx ].op & OP_READ ){
+                current.ops[ current.numops++ ] = setup->ops[ op_idx ];
             }
+        }
+        // Ignore return code; the per-op err fields say which reads failed.
+        msr_batch( fd, &current );
+        for( size_t op_idx = 0; op_idx < setup->numops; op_idx++ ){
+            struct msr_batch_op *o = &( setup->ops[ op_idx ] );
+            if( !( o->op & OP_WRITE ) ){
+                continue;
+            }
+            struct msr_batch_op *saved = find_read_op( &current, o->cpu, o->msr );
+            if( NULL == saved || 0 != saved->err ){
+                o->op = OP_READ | OP_TSC;
+                continue;
+            }
+            uint64_t mask = ( o->msr == HWP_REQUEST ) ? HWP_REQUEST_PERF_MASK : PERF_CTL_RATIO_MASK;
+            o->msrdata = ( saved->msrdata & ~mask ) | ( o->msrdata & mask );
+        }
+        free( current.ops );
+    }
+}
 
-            // Probably faster to visit each operation once.
-            // Note that we start with the second poll value to make the deltas work.
-            assert( job->polls[i]->total_ops > 2 );
+static void prepare_teardown( struct job *job ){
+    // Longitudinals that change MSRs restore them at TEARDOWN from what SETUP
+    // read.  ZEROAMPERF adds back what accumulated since START.  If the saved
+    // value is missing, turn the write into a read rather than write garbage.
+    for( size_t i = 0; i < job->longitudinal_count; i++ ){
+        struct longitudinal_config *lng = job->longitudinals[i];
+        if( ( lng->longitudinal_type != CAPFREQUENCY && lng->longitudinal_type != ZEROAMPERF )
+         || NULL == lng->batches[ TEARDOWN ] ){
+            continue;
+        }
+        for( size_t op_idx = 0; op_idx < lng->batches[ TEARDOWN ]->numops; op_idx++ ){
+            struct msr_batch_op *o = &( lng->batches[ TEARDOWN ]->ops[ op_idx ] );
+            struct msr_batch_op *saved = find_read_op( lng->batches[ SETUP ], o->cpu, o->msr );
+            if( NULL == saved || 0 != saved->err ){
+                o->op = OP_READ | OP_TSC;
+                continue;
+            }
+            o->msrdata = saved->msrdata;
+            if( lng->longitudinal_type == ZEROAMPERF ){
+                struct msr_batch_op *since_start = find_read_op( lng->batches[ READ ], o->cpu, o->msr );
+                if( since_start && 0 == since_start->err ){
+                    o->msrdata += since_start->msrdata;
+                }
+            }
+        }
+    }
+}
 
-            // For each op....
-            for( size_t o = 1; o < job->polls[i]->total_ops; o++ ){ // FIXME This o=1 has to go when we do multi-cpu polls.
-                // ...for each field...
-                for( op_field_arridx_t arridx = 0; arridx < op_field_arridx_MAX_IDX; arridx++ ){
-                    // ...print the data in that field.
-                    print_op( fp[ arridx ], 1ULL << arridx, &(job->polls[i]->poll_ops[o]), &(job->polls[i]->poll_ops[ o-1 ]), true );
+static void wait_for_coldstart( struct job *job, int fd ){
+    // Re-issue each COLDSTART SETUP batch every 100ms until every THERM_STATUS
+    // readout (degrees below TCC activation) reaches the margin, or we time out.
+    const struct timespec probe_interval = { .tv_sec = 0, .tv_nsec = 100'000'000L };
+    for( size_t i = 0; i < job->longitudinal_count; i++ ){
+        struct longitudinal_config *lng = job->longitudinals[i];
+        if( lng->longitudinal_type != COLDSTART || NULL == lng->batches[ SETUP ] ){
+            continue;
+        }
+        struct timespec t0, t1;
+        assert( 0 == clock_gettime( CLOCK_MONOTONIC, &t0 ) );
+        uint64_t timeout_ns = lng->coldstart_timeout.tv_sec * 1'000'000'000ULL + lng->coldstart_timeout.tv_nsec;
+        uint64_t waited_ns = 0;
+        lng->coldstart_reached = false;
+        while( 1 ){
+            msr_batch( fd, lng->batches[ SETUP ] );
+            bool cold = true;
+            for( size_t op_idx = 0; op_idx < lng->batches[ SETUP ]->numops; op_idx++ ){
+                struct msr_batch_op *o = &( lng->batches[ SETUP ]->ops[ op_idx ] );
+                if( o->msr == THERM_STATUS && 0 == o->err && EXTRACT_TEMPERATURE( o->msrdata ) < lng->coldstart_margin ){
+                    cold = false;
                 }
             }
-            // Close a bunch of files.
-            for( op_field_arridx_t arridx = 0; arridx < op_field_arridx_MAX_IDX; arridx++ ){
-                fclose( fp[ arridx ] );
+            assert( 0 == clock_gettime( CLOCK_MONOTONIC, &t1 ) );
+            waited_ns = ( t1.tv_sec - t0.tv_sec ) * 1'000'000'000ULL + t1.tv_nsec - t0.tv_nsec;
+            if( cold ){
+                lng->coldstart_reached = true;
+                break;
+            }
+            if( waited_ns >= timeout_ns ){
+                fprintf( stderr, "%s:%d:%s COLDSTART longitudinal %zu did not reach %"PRIu64"C below TCC within the timeout.\n",
+                        __FILE__, __LINE__, __func__, i, lng->coldstart_margin );
+                break;
             }
+            nanosleep( &probe_interval, NULL );
         }
+        lng->coldstart_waited.tv_sec  = waited_ns / 1'000'000'000ULL;
+        lng->coldstart_waited.tv_nsec = waited_ns % 1'000'000'000ULL;
     }
 }
 
+static void measure_spread( struct job *job, longitudinal_slot_t slot_idx ){
+    for( size_t i = 0; i < job->longitudinal_count; i++ ){
+        struct msr_batch_array *b = job->longitudinals[i]->batches[ slot_idx ];
+        if( NULL == b ){
+            continue;
+        }
+        uint64_t first = UINT64_MAX, last = 0;
+        for( size_t op_idx = 0; op_idx < b->numops; op_idx++ ){
+            if( b->ops[ op_idx ].err != 0 || b->ops[ op_idx ].tsc == 0 ){
+                continue;
+            }
+            first = b->ops[ op_idx ].tsc < first ? b->ops[ op_idx ].tsc : first;
+            last  = b->ops[ op_idx ].tsc > last  ? b->ops[ op_idx ].tsc : last;
+        }
+        job->longitudinals[i]->spread_tsc[ slot_idx ] = ( last >= first ) ? last - first : 0;
+    }
+}
 
 void run_longitudinal_batches( struct job *job, longitudinal_slot_t slot_idx ){
 
-    static int initialized, fd;
+    static int initialized, fd = -1;
     if( !initialized && slot_idx != TEARDOWN ){
         initialized = 1;
-        fd = open( "/dev/cpu/msr_batch", O_RDONLY );
-        assert( -1 != fd );
+        if( has_msrsafe_longitudinals( job ) ){
+            fd = msr_batch_open();
+            assert( -1 != fd );
+        }
     }
 
-    for( size_t i = 0; i < job->longitudinal_count; i++ ){
-        if( NULL == job->longitudinals[i]->batches[slot_idx] ){
-            continue;
+    if( slot_idx == SETUP ){
+        prepare_capfrequency( job, fd );
+    }else if( slot_idx == TEARDOWN ){
+        prepare_teardown( job );
+    }
+
+    if( job->parallel_longitudinals && ( slot_idx == START || slot_idx == STOP ) ){
+        run_longitudinal_batches_parallel( job, slot_idx );
+    }else{
+        for( size_t i = 0; i < job->longitudinal_count; i++ ){
+            if( NULL == job->longitudinals[i]->batches[slot_idx] ){
+                continue;
+            }
+            errno = 0;
+            if( job->longitudinals[i]->use_perf ){
+                // Only READ has ops; the per-op err fields record any failure.
+                perf_read_batch( job->longitudinals[i], job->longitudinals[i]->batches[slot_idx] );
+                continue;
+            }
+            // Ignore return code.  probe_longitudinal_batches() removed the MSRs
+            //   that aren't present, but a write can still be refused.
+            msr_batch( fd, job->longitudinals[i]->batches[slot_idx] );
         }
-        errno = 0;
-        // Ignore return code, as ALL_ALLOWED will generate errors due to not
-        //   all allowed MSRs being present on all architectures.
-        ioctl( fd, X86_IOC_MSR_BATCH, job->longitudinals[i]->batches[slot_idx] );
+    }
+
+    if( slot_idx == SETUP ){
+        wait_for_coldstart( job, fd );
+        setup_perf_groups( job );
+        setup_snapshots( job );
+    }
+
+    if( slot_idx == START || slot_idx == STOP ){
+        measure_spread( job, slot_idx );
+    }
+
+    // perf_event_open(2) groups have no START or STOP batches; these record
+    // their own spread.
+    if( slot_idx == START ){
+        start_perf_groups( job );
+    }else if( slot_idx == STOP ){
+        stop_perf_groups( job );
+    }
+
+    // ENERGY_COUNTERS and --snapshot keep reading in the background between
+    // START and STOP.
+    if( slot_idx == START ){
+        start_energy_accumulators( job );
+        start_snapshots( job );
+    }else if( slot_idx == STOP ){
+        stop_energy_accumulators( job );
+        stop_snapshots( job );
+    }else if( slot_idx == READ ){
+        finalize_energy_accumulators( job );
     }
 
     if( slot_idx == TEARDOWN ){
-        close( fd );
+        teardown_perf_groups( job );
+        if( -1 != fd ){
+            msr_batch_close( fd );
+            fd = -1;
+        }
         initialized = 0;
     }
 }
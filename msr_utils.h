@@ -1,11 +1,65 @@
 #pragma once
+#include <stdio.h>          // FILE
 #include "job.h"
 #define MSR_SAFE_USERSPACE
 #include "msr_safe.h"
 #undef MSR_SAFE_USERSPACE
 
+//////////////////////////////////////////////////////////////////////////////////
+// List of MSRs
+//////////////////////////////////////////////////////////////////////////////////
+typedef enum : uint64_t{
+    TIME_STAMP_COUNTER               = 0x0010,
+    MISC_PACKAGE_CTLS                = 0x00BC,
+    PMC0                             = 0x00C1, // through PMC7 at 0x00C8
+    MPERF                            = 0x00E7,
+    APERF                            = 0x00E8,
+    ARCH_CAPABILITIES                = 0x010A,
+    PERFEVTSEL0                      = 0x0186, // through PERFEVTSEL7 at 0x018D
+    PERF_STATUS                      = 0x0198,
+    PERF_CTL                         = 0x0199,
+    THERM_STATUS                     = 0x019C, // 22:16 Degrees C away from max
+    ENERGY_PERF_BIAS                 = 0x01B0,
+    PACKAGE_THERM_STATUS             = 0x01B1, // 22:16 Degrees C away from max
+    FIXED_CTR0                       = 0x0309, // INST_RETIRED.ANY
+    FIXED_CTR1                       = 0x030A, // CPU_CLK_UNHALTED.[THREAD|CORE]
+    FIXED_CTR2                       = 0x030B, // CPU_CLK_UNHALTED.REF_TSC
+    FIXED_CTR3                       = 0x030C,
+    FIXED_CTR_CTRL                   = 0x038D,
+    PERF_GLOBAL_CTRL                 = 0x038F,
+    RAPL_POWER_UNIT                  = 0x0606,
+    PKG_POWER_LIMIT                  = 0x0610,
+    PKG_ENERGY_STATUS                = 0x0611,
+    PACKAGE_ENERGY_TIME_STATUS       = 0x0612,
+    PKG_PERF_STATUS                  = 0x0613,
+    PKG_POWER_INFO                   = 0x0614,
+    DRAM_POWER_LIMIT                 = 0x0618,
+    DRAM_ENERGY_STATUS               = 0x0619,
+    DRAM_PERF_STATUS                 = 0x061B,
+    DRAM_POWER_INFO                  = 0x061C,
+    PP0_POWER_LIMIT                  = 0x0638,
+    PP0_ENERGY_STATUS                = 0x0639,
+    PP0_POLICY                       = 0x063A,
+    PP1_POWER_LIMIT                  = 0x0640,
+    PP1_ENERGY_STATUS                = 0x0641,
+    PP1_POLICY                       = 0x0642,
+    PLATFORM_ENERGY_COUNTER          = 0x064D,
+    PPERF                            = 0x064E,
+    PLATFORM_POWER_INFO              = 0x0665,
+    PLATFORM_POWER_LIMIT             = 0x065C,
+    PLATFORM_RAPL_SOCKET_PERF_STATUS = 0x0666,
+    PM_ENABLE                        = 0x0770,
+    HWP_CAPABILITIES                 = 0x0771,
+    HWP_REQUEST                      = 0x0774,
+}msr_t;
+
+#define UNUSED_OP ((__s32)(0xDECAFBAD))     // err of an op that was never issued.
+
+static constexpr const uint32_t MAX_POLL_ATTEMPTS = 10000;
+
 void setup_msrsafe_batches( struct job *job );
 void teardown_msrsafe_batches( struct job *job );
+bool needs_msrsafe( const struct job *job );
 void populate_allowlist( void );
 void dump_batches( struct job *job );
 void run_longitudinal_batches( struct job *job, longitudinal_slot_t j );
@@ -6,12 +6,19 @@
 #include <string.h>             // strtok_r(3), strdup(3)
 #include <stdint.h>
 #include <inttypes.h>
+#include <cpuid.h>              // __get_cpuid(3)
+#include <unistd.h>             // getpid(2)
 #include "job.h"
 #include "int_utils.h"          // safe_strtoull()
 #include "cpuset_utils.h"       // str2cpuset()
 #include "version.h"
 #include "msr_utils.h"
 #include "timespec_utils.h"
+#include "tsc_utils.h"          // tsc2ns()
+#include "topology_utils.h"     // cputype2str, cpu_is_online()
+#include "msr_backend.h"        // set_msr_backend()
+#include "cadence_utils.h"      // print_poll_cadences()
+#include "phase_utils.h"        // configure_phase_sequence()
 
 static void print_help( void ){
     printf("var [options]\n" );
@@ -27,18 +34,91 @@ static void print_help( void ){
     "\n"
     "  -m / --main=<main_cpu>\n"
     "  -b / --benchmark=<benchmark_type>:<execution_cpus>:<param1>:<param2>:<param3>\n"
-    "  -l / --longitudinal=<longitudinal_type>:<sample_cpus>\n"
-    "  -p / --poll=<msr_address>:<flags>:<timespec>:<control_cpu>:<sample_cpu>\n"
+    "       (any <param> may be a comma-separated list of one value per phase,\n"
+    "       A, B, C, ... up to 8; the longest list sets the number of phases.)\n"
+    "  -l / --longitudinal=<longitudinal_type>:<sample_cpus>[:<params>]\n"
+    "  -p / --poll=<msr_address>[@powercap]:<flags>:<timespec>:<control_cpu>:<sample_cpu>\n"
+    "  -r / --powercapRoot=<directory> (default is /sys/class/powercap)\n"
+    "  -s / --sysfsRoot=<directory> (default is /sys; where the cpu topology is\n"
+    "       read from.  Must precede any auto placement.)\n"
     "\n"
-    "  -R / --abRandomized (enables random a|b selection)\n"
+    "  -R / --abRandomized (same as -A bernoulli)\n"
     "  -T / --abTime=<timespec> (default is 1 second)\n"
+    "  -A / --abSequence=<sequence>\n"
+    "       (which phase runs in each abTime interval:  alternate (the\n"
+    "       default, b first), bernoulli[:<seed>], balanced[:<block>[:<seed>]]\n"
+    "       (each phase equally often in every block, default four of each),\n"
+    "       lfsr[:<bits>[:<seed>]] (a maximal-length LFSR; a and b only) or\n"
+    "       replay:<file> (the phases and offsets of an earlier schedule.out).\n"
+    "       Phases start on absolute deadlines; schedule.out records when each\n"
+    "       did.)\n"
+    "  -D / --selfTimed[=<loops>]\n"
+    "       (benchmark threads switch phases themselves when the TSC passes\n"
+    "       each phase's deadline, worked out before the run, rather than\n"
+    "       following the main thread.  They read the TSC every <loops> times\n"
+    "       round their loop:  by default every ABXOR loop and every 1024th\n"
+    "       ABSHIFT loop.)\n"
+    "\n"
+    "  -z / --zeroFault (allocate the buffers poll threads write during the run\n"
+    "       from huge pages, prefaulted on each control cpu's node, and\n"
+    "       mlockall(2) everything before START.  Page faults and context\n"
+    "       switches per thread are reported in job.out either way.)\n"
+    "\n"
+    "  -a / --archive (write each poll to poll_<n>.var, a delta-encoded\n"
+    "       binary archive, instead of poll_<n>.raw and poll_<n>_<msr>.tsv.\n"
+    "       Print it with var-archive (make archive).)\n"
+    "\n"
+    "  -L / --live[=<name>] (publish poll samples and the a|b phase in POSIX\n"
+    "       shared memory object <name> (default /var-<pid>) during the run.\n"
+    "       Watch it with var-top <name> (make top).)\n"
+    "\n"
+    "  -w / --sweep=<parameter>=<value>[,<value>...][/<parameter>=<value>...]\n"
+    "  -w / --sweep=@<file>\n"
+    "       (run one trial per combination of values, or per line of <file>\n"
+    "       (whitespace-separated <parameter>=<value>s, # comments), in this\n"
+    "       process with the same threads, ABXOR table and buffers.  The\n"
+    "       parameters are abTime, time, interval (every poll not set to\n"
+    "       auto) and param1, param2 and param3 (every benchmark and phase);\n"
+    "       anything a trial doesn't set is taken from the command line.\n"
+    "       Trial <k> writes to trial_<k>/; sweep.out lists the trials.)\n"
+    "\n"
+    "  -F / --fifo[=<main>[:<poll>[:<benchmark>]]]\n"
+    "       (run the main, poll and benchmark threads as SCHED_FIFO at these\n"
+    "       priorities (default 60:70:50) and mlockall(2) before START.  Needs\n"
+    "       CAP_SYS_NICE.  Spinning benchmarks are subject to RT throttling,\n"
+    "       see /proc/sys/kernel/sched_rt_runtime_us.  Either way, isolcpus=,\n"
+    "       nohz_full=, irq affinity and runnable tasks on the chosen cpus are\n"
+    "       checked before the run and any warnings written to isolation.out.)\n"
+    "\n"
+    "  -P / --parallelLongitudinal (issue longitudinal START/STOP from one\n"
+    "       thread per package, released together)\n"
+    "  -S / --snapshot=<longitudinal_index>:<timespec>:<control_cpu>\n"
+    "       (re-run that longitudinal's READ batch every <timespec> from\n"
+    "       <control_cpu> and write a per-cpu time series to\n"
+    "       longitudinal_<index>_<type>_SNAPSHOTS.out.  Indices count -l\n"
+    "       options from 0, and -S must follow the -l it refers to.)\n"
+    "\n"
+    "  -C / --calibrate=<msr_address>:<control_cpus>:<sample_cpus>[:<samples>]\n"
+    "       (instead of running a job, time <samples> (default 10000)\n"
+    "       back-to-back single-op batches reading <msr_address> on each\n"
+    "       <sample_cpu> from each <control_cpu>, for several combinations of\n"
+    "       OP_READ, OP_POLL, OP_TSC, OP_THERM, etc.  Latency histograms and\n"
+    "       the resulting maximum sample rate are written to calibrate.out.)\n"
+    "\n"
+    "  -M / --mock[=<watts>[:<degrees>[:<aperf_percent>]]]\n"
+    "       (replace msr-safe with a simulated processor:  energy counters\n"
+    "       updated every 1ms at <watts> (default 50) with 32-bit wrap, the\n"
+    "       real TSC, MPERF at the TSC rate and APERF at <aperf_percent> of it\n"
+    "       (default 100), and a temperature <degrees> below TCC (default 40).\n"
+    "       Other MSRs read back what was last written.  Needs no privileges.)\n"
     "\n"
     "The available benchmarks are SPIN, ABSHIFT, and ABXOR.\n"
     "  SPIN\n"
     "    No parameters are used.  This benchmark is a simple integer spin loop.\n"
     "  ABSHIFT\n"
     "    The benchmark alternates between shifting 64-bit values <param1> and <param2>\n"
-    "    back and forth by <param3> bits.  The <param1> and <param2> values can be\n"
+    "    back and forth by <param3> bits.  With a list of <param1> values, phase k\n"
+    "    shifts the k-th of them instead.  The <param1> and <param2> values can be\n"
     "    specified using regular hexidecimal notation (to use particular bits) or by\n"
     "    using hwN to generate a value with a Hamming Weight of N.  The latter will\n"
     "    begin by filling in odd-numbered bits starting with the least-significant and\n"
@@ -46,14 +126,44 @@ static void print_help( void ){
     "    and finally bits 0 and 63.  The shift value (<param3>) may be 0; this is useful\n"
     "    when measuring only parasitic power.\n"
     "  ABXOR\n"
-    "    Benchmark still under development.\n"
+    "    Benchmark still under development.  Each pass XORs <param1> consecutive\n"
+    "    table entries, or the current phase's <param1> given a list.\n"
     "\n"
     "The <longitudinal_type> may be either\n"
-    "  FIXED_FUNCTION_COUNTERS\n"
+    "  FIXED_FUNCTION_COUNTERS[:<sample_cpus>[:perf]]\n"
     "    The counter accumulators for instructions retired, reference\n"
     "    cycles, and cycle counts will be zeroed out before the start\n"
     "    of the benchmark(s) and read out after <duration> seconds\n"
-    "    elapse.\n"
+    "    elapse.  With perf, the counts come from one perf_event_open(2)\n"
+    "    group per <sample_cpu> (instructions, cycles, ref-cycles) instead\n"
+    "    of msr-safe, so the kernel's own use of the fixed counters (e.g.,\n"
+    "    the NMI watchdog) isn't disturbed.  This may need a lower\n"
+    "    /proc/sys/kernel/perf_event_paranoid.\n"
+    "  GENERAL_PURPOSE_COUNTERS:<sample_cpus>:<event>[+<event>...]\n"
+    "    Each <event> is a raw IA32_PERFEVTSELx value (umask << 8 | event code,\n"
+    "    optionally with the EDGE, INV and CMASK fields) assigned to successive\n"
+    "    programmable counters.  USR, OS and EN are always set.  Counters are\n"
+    "    programmed and zeroed at setup, enabled and disabled through\n"
+    "    PERF_GLOBAL_CTRL, and read out after <duration> seconds elapse.\n"
+    "    For example, 0x412e+0x00c5 counts LLC misses and branch misses.\n"
+    "  ENERGY_COUNTERS:<sample_cpus>[:<timespec>]\n"
+    "    Package, DRAM, PP0, PP1 and platform energy over the whole run.  Use one\n"
+    "    <sample_cpu> per socket.  The counters are re-read in the background\n"
+    "    every <timespec> (default 1s) so that 32-bit wraps are accounted for,\n"
+    "    and the totals are reported in joules.\n"
+    "  CAPFREQUENCY:<sample_cpus>:<ratio>\n"
+    "    Pin PERF_CTL (and HWP_REQUEST min/max/desired, where supported) to\n"
+    "    <ratio> before the run starts.  PERF_STATUS is read out afterwards, and\n"
+    "    the original requests are restored at teardown.\n"
+    "  COLDSTART:<sample_cpus>:<timespec>:<degrees>\n"
+    "    Before any thread starts, wait up to <timespec> for every <sample_cpu>\n"
+    "    to be at least <degrees> C below its thermal control activation point.\n"
+    "    The time waited is appended to job.out.\n"
+    "  ZEROAMPERF:<sample_cpus>\n"
+    "    Zero APERF and MPERF at the start of the run and read them out\n"
+    "    afterwards.  The original values (plus the accumulated counts) are\n"
+    "    written back at teardown, but the kernel's frequency-invariance\n"
+    "    accounting will notice the counters went backwards.\n"
     "The several <cpu> fields expect CPU numbering of the type used by\n"
     "  sched_setaffinity(2).  These can take the form of a single integer,\n"
     "  or comma-separate single integers and ranges of integers m-n, where\n"
@@ -61,7 +171,15 @@ static void print_help( void ){
     "  cpu should be unique.  Ideally, <execution_cpus> and <sample_cpus>\n"
     "  should take up all CPUs on an isolated socket, while each\n"
     "  <control_cpu> and the single <main_cpu> share a socket with, say,\n"
-    "  operating system background tasks.\n"
+    "  operating system background tasks.  Every cpu must be online.\n"
+    "\n"
+    "  <execution_cpus>, <main_cpu> and the -p and -S <control_cpu> also accept\n"
+    "  \"auto\".  Benchmarks then fill the package with the most isolated cpus\n"
+    "  (see isolcpus=), or the highest-numbered package if none are isolated.\n"
+    "  Main, poll and snapshot control threads each get a cpu on their own\n"
+    "  core, on another package where there is one, and never on a core that\n"
+    "  holds an auto <execution_cpu>.  On a single package with nothing\n"
+    "  isolated, the first core is kept for control threads.\n"
     "\n"
     "A <timespec> is a non-negative integer following by an optional suffix,\n"
     "  \"ns\", \"us\", \"ms\", \"s\", \"m\", or \"h\", corresponding to\n"
@@ -88,7 +206,18 @@ static void print_help( void ){
     "  during the delay.\n"
     "\n"
     "  Also note that --poll repeats the operation every <timespec> seconds, and\n"
-    "  OP_POLL reads the MSR until its value changes or MAX_POLL_ATTEMPTS is exceeded.\n");
+    "  OP_POLL reads the MSR until its value changes or MAX_POLL_ATTEMPTS is exceeded.\n"
+    "\n"
+    "  A <timespec> of auto (OP_POLL only) measures how often the value actually\n"
+    "  changes before the run, then starts each poll just ahead of the next\n"
+    "  expected change so that it lands right after it.  The measured period and\n"
+    "  jitter are written to job.out.\n"
+    "\n"
+    "  Appending @powercap to one of the RAPL energy <msr_address>es (0x611, 0x619,\n"
+    "  0x639, 0x641 or 0x64d) reads the corresponding intel-rapl zone's energy_uj\n"
+    "  for <sample_cpu>'s package instead.  The output has the same columns, but\n"
+    "  MSRDATA is in microjoules and MPERF, APERF, THERM and PTHERM are not filled\n"
+    "  in.  OP_POLL and OP_TSC behave as they do for the MSR.\n");
 }
 
 static void print_options( int argc, char **argv, struct job *job ){
@@ -114,14 +243,57 @@ static void print_options( int argc, char **argv, struct job *job ){
     fprintf_timespec( fp, &job->duration );
     fprintf(          fp, "\n");
 
-    // a|b randomized
-    fprintf( fp, "#\t%-20s%s\n", "a|b randomized: ", job->ab_randomized ? "True" : "False" );
+    // phases
+    fprintf( fp, "#\t%-20s%zu\n", "phases: ", job->phases );
+
+    // a|b sequence
+    fprintf( fp, "#\t%-20s", "a|b sequence: " );
+    fprintf_phase_sequence( fp, job );
+    fprintf( fp, "\n" );
+
+    // self-timed
+    if( !job->self_timed ){
+        fprintf( fp, "#\t%-20s%s\n", "self-timed: ", "off" );
+    }else if( job->check_loops ){
+        fprintf( fp, "#\t%-20severy %"PRIu64" loops\n", "self-timed: ", job->check_loops );
+    }else{
+        fprintf( fp, "#\t%-20s%s\n", "self-timed: ", "default loops" );
+    }
 
     // a|b duration
     fprintf(          fp, "#\t%-20s", "a|b duration: " );
     fprintf_timespec( fp, &job->ab_duration );
     fprintf(          fp, "\n#\n");
 
+    // msr backend
+    fprintf( fp, "#\t%-20s%s\n", "msr backend: ", get_msr_backend()->name );
+
+    // sysfs root
+    fprintf( fp, "#\t%-20s%s\n", "sysfs root: ", get_sysfs_root() );
+
+    // zero-fault mode
+    fprintf( fp, "#\t%-20s%s\n", "zero fault: ", job->zero_fault ? "True" : "False" );
+
+    // poll output
+    fprintf( fp, "#\t%-20s%s\n", "poll output: ", job->archive ? "archive" : "text" );
+
+    // live telemetry
+    fprintf( fp, "#\t%-20s%s\n", "live: ", job->live_name ? job->live_name : "off" );
+
+    // sweep
+    fprintf( fp, "#\t%-20s%s\n", "sweep: ", job->sweep_spec ? job->sweep_spec : "off" );
+
+    // scheduling
+    if( job->fifo ){
+        fprintf( fp, "#\t%-20sSCHED_FIFO main %d, poll %d, benchmark %d\n", "scheduling: ",
+                job->main_priority, job->poll_priority, job->benchmark_priority );
+    }else{
+        fprintf( fp, "#\t%-20sSCHED_OTHER\n", "scheduling: " );
+    }
+
+    // parallel longitudinals
+    fprintf( fp, "#\t%-20s%s\n#\n", "parallel START/STOP: ", job->parallel_longitudinals ? "True" : "False" );
+
     // counts
     fprintf( fp, "# %zu %s, %zu %s, %zu %s.\n#\n",
             job->poll_count,
@@ -145,12 +317,20 @@ static void print_options( int argc, char **argv, struct job *job ){
 
         fprintf(          fp, "#\t%-15s%#"PRIx32"\n", "msr: ", job->polls[i]->msr );
 
+        if( job->polls[i]->powercap ){
+            fprintf(      fp, "#\t%-15s%s\n", "powercap root: ", job->powercap_root );
+        }
+
         fprintf(          fp, "#\t%-15s", "flags: ");
         fprintf_flags(    fp, job->polls[i]->flags );
         fprintf(          fp, "\n");
 
         fprintf(          fp, "#\t%-15s", "interval: ");
-        fprintf_timespec( fp, &job->polls[i]->interval );
+        if( job->polls[i]->auto_interval ){
+            fprintf(      fp, "auto" );
+        }else{
+            fprintf_timespec( fp, &job->polls[i]->interval );
+        }
         fprintf(          fp, "\n");
     }
 
@@ -158,11 +338,10 @@ static void print_options( int argc, char **argv, struct job *job ){
 
     // benchmarks
     for( size_t i = 0; i < job->benchmark_count; i++ ){
-        fprintf( fp, "# benchmark %zu of %zu:  type=%s. parameters=%#"PRIx64", %#"PRIx64", %#"PRIx64".\n",
-                i+1, job->benchmark_count, benchmarktype2str[ job->benchmarks[i]->benchmark_type ],
-                job->benchmarks[i]->benchmark_param1,
-                job->benchmarks[i]->benchmark_param2,
-                job->benchmarks[i]->benchmark_param3 );
+        fprintf( fp, "# benchmark %zu of %zu:  type=%s. parameters=",
+                i+1, job->benchmark_count, benchmarktype2str[ job->benchmarks[i]->benchmark_type ] );
+        fprintf_phase_params( fp, job, job->benchmarks[i] );
+        fprintf( fp, ".\n" );
         fprintf( fp, "#\texecution cpu:  ");
         fprintf_cpuset( fp, &job->benchmarks[i]->execution_cpu );
         fprintf( fp, "\n" );
@@ -174,14 +353,225 @@ static void print_options( int argc, char **argv, struct job *job ){
     for( size_t i = 0; i < job->longitudinal_count; i++ ){
         fprintf(fp, "# longitudinal %zu of %zu:  type=%s.\n",
                 i, job->longitudinal_count, longitudinaltype2str[ job->longitudinals[i]->longitudinal_type ]);
+        if( job->longitudinals[i]->params ){
+            fprintf(fp, "#\tparameters:  %s\n", job->longitudinals[i]->params );
+        }
         fprintf(fp, "#\tsample cpu:  ");
         fprintf_cpuset( fp, &job->longitudinals[i]->sample_cpus );
         fprintf(fp, "\n");
+        if( job->longitudinals[i]->snapshot_interval.tv_sec || job->longitudinals[i]->snapshot_interval.tv_nsec ){
+            fprintf(fp, "#\tsnapshot every ");
+            fprintf_timespec( fp, &job->longitudinals[i]->snapshot_interval );
+            fprintf(fp, " from cpu ");
+            fprintf_cpuset( fp, &job->longitudinals[i]->snapshot_cpu );
+            fprintf(fp, "\n");
+        }
     }
     fclose(fp);
 }
 
-static uint64_t create_hw_param( char *param ){
+static void print_start_skew( FILE *fp, struct job *job ){
+    // Offsets are relative to the barrier release deadline.
+    uint64_t release = job->start.release_tsc;
+    uint64_t first = job->main_start_tsc, last = job->main_start_tsc;
+    for( size_t i = 0; i < job->poll_count; i++ ){
+        first = job->polls[i]->start_tsc < first ? job->polls[i]->start_tsc : first;
+        last  = job->polls[i]->start_tsc > last  ? job->polls[i]->start_tsc : last;
+    }
+    for( size_t i = 0; i < job->benchmark_count; i++ ){
+        first = job->benchmarks[i]->start_tsc < first ? job->benchmarks[i]->start_tsc : first;
+        last  = job->benchmarks[i]->start_tsc > last  ? job->benchmarks[i]->start_tsc : last;
+    }
+    fprintf( fp, "# start barrier\n" );
+    fprintf( fp, "#\t%-20s%"PRIu64"\n", "tsc hz: ", get_tsc_hz() );
+    fprintf( fp, "#\t%-20s%"PRIu64"\n", "release tsc: ", release );
+    fprintf( fp, "#\t%-20s%"PRIu64" ticks (%"PRIu64" ns)\n", "observed skew: ", last - first, tsc2ns( last - first ) );
+    fprintf( fp, "#\t%-20s+%"PRIu64" ticks\n", "main: ", job->main_start_tsc - release );
+    for( size_t i = 0; i < job->poll_count; i++ ){
+        fprintf( fp, "#\tpoll %-15zu+%"PRIu64" ticks\n", i, job->polls[i]->start_tsc - release );
+    }
+    for( size_t i = 0; i < job->benchmark_count; i++ ){
+        fprintf( fp, "#\tbenchmark %-10zu+%"PRIu64" ticks\n", i, job->benchmarks[i]->start_tsc - release );
+    }
+    fprintf( fp, "#\n" );
+}
+
+static void fprintf_thread_usage( FILE *fp, const char *name, size_t idx, struct thread_usage *u ){
+    fprintf( fp, "#\t%-10s %-4zu %10ld %10ld %10ld %10ld\n", name, idx, u->minflt, u->majflt, u->nvcsw, u->nivcsw );
+}
+
+static void print_thread_usage( FILE *fp, struct job *job ){
+    // Only faults and switches taken between the start barrier and the end of
+    // the run count; a clean run is all zeros apart from voluntary switches
+    // by threads that sleep (main and polls).
+    fprintf( fp, "# thread usage during the run (getrusage RUSAGE_THREAD)%s\n",
+            ( job->zero_fault || job->fifo ) ? ( job->memory_locked ? ", memory locked" : ", mlockall FAILED" ) : "" );
+    fprintf( fp, "#\t%-10s %-4s %10s %10s %10s %10s\n", "thread", "idx", "minflt", "majflt", "nvcsw", "nivcsw" );
+    fprintf_thread_usage( fp, "main", 0, &job->main_usage );
+    for( size_t i = 0; i < job->poll_count; i++ ){
+        fprintf_thread_usage( fp, "poll", i, &job->polls[i]->usage );
+    }
+    for( size_t i = 0; i < job->benchmark_count; i++ ){
+        fprintf_thread_usage( fp, "benchmark", i, &job->benchmarks[i]->usage );
+    }
+    fprintf( fp, "#\n" );
+}
+
+static void print_longitudinal_spread( FILE *fp, struct job *job ){
+    if( 0 == job->longitudinal_count ){
+        return;
+    }
+    fprintf( fp, "# longitudinal START/STOP spread (max - min op tsc)\n" );
+    for( size_t i = 0; i < job->longitudinal_count; i++ ){
+        fprintf( fp, "#\tlongitudinal %zu %-25s START %"PRIu64" ticks (%"PRIu64" ns), STOP %"PRIu64" ticks (%"PRIu64" ns)\n",
+                i, longitudinaltype2str[ job->longitudinals[i]->longitudinal_type ],
+                job->longitudinals[i]->spread_tsc[ START ], tsc2ns( job->longitudinals[i]->spread_tsc[ START ] ),
+                job->longitudinals[i]->spread_tsc[ STOP ],  tsc2ns( job->longitudinals[i]->spread_tsc[ STOP ] ) );
+    }
+    fprintf( fp, "#\n" );
+}
+
+static void print_coldstart( FILE *fp, struct job *job ){
+    for( size_t i = 0; i < job->longitudinal_count; i++ ){
+        struct longitudinal_config *lng = job->longitudinals[i];
+        if( lng->longitudinal_type != COLDSTART ){
+            continue;
+        }
+        fprintf( fp, "# longitudinal %zu COLDSTART %s %"PRIu64"C below TCC after %ld.%09ld s\n",
+                i, lng->coldstart_reached ? "reached" : "DID NOT REACH", lng->coldstart_margin,
+                lng->coldstart_waited.tv_sec, lng->coldstart_waited.tv_nsec );
+    }
+}
+
+static void print_dropped( FILE *fp, struct job *job ){
+    if( 0 == job->dropped_count ){
+        return;
+    }
+    fprintf( fp, "# setup probe dropped %zu longitudinal ops for %zu unreadable msr/cpu type pairs\n",
+            job->dropped_op_count, job->dropped_count );
+    for( size_t d = 0; d < job->dropped_count; d++ ){
+        fprintf( fp, "#\tmsr %#06"PRIx32" on %s (probed on cpu %"PRIu16", err %"PRId32")\n",
+                job->dropped[d].msr, cputype2str[ job->dropped[d].cpu_type ],
+                job->dropped[d].probe_cpu, job->dropped[d].err );
+    }
+    fprintf( fp, "#\n" );
+}
+
+void print_summary( struct job *job ){
+    // Things we only know after the run, appended to what print_options() wrote.
+    FILE *fp = fopen( "job.out", "a" );
+    assert( NULL != fp );
+    print_start_skew( fp, job );
+    print_poll_cadences( fp, job );
+    print_thread_usage( fp, job );
+    print_longitudinal_spread( fp, job );
+    print_coldstart( fp, job );
+    print_dropped( fp, job );
+    fclose(fp);
+}
+
+static size_t get_general_purpose_counter_count( void ){
+    // CPUID.0AH:EAX[15:8] is the number of general-purpose counters per logical processor.
+    unsigned int eax = 0, ebx, ecx, edx;
+    if( 0 == __get_cpuid( 0x0A, &eax, &ebx, &ecx, &edx ) ){
+        return 0;
+    }
+    return ( eax >> 8 ) & 0xFF;
+}
+
+static void parse_longitudinal_params( struct longitudinal_config *lng, const char * const optarg ){
+    switch( lng->longitudinal_type ){
+        case FIXED_FUNCTION_COUNTERS:
+            if( NULL != lng->params ){
+                if( 0 != strcmp( "perf", lng->params ) ){
+                    printf( "%s:%d:%s The only parameter FIXED_FUNCTION_COUNTERS accepts is perf, not (%s).\n",
+                            __FILE__, __LINE__, __func__, optarg);
+                    exit(-1);
+                }
+                lng->use_perf = true;
+            }
+            break;
+        case GENERAL_PURPOSE_COUNTERS:
+        {
+            if( NULL == lng->params ){
+                printf( "%s:%d:%s Parameter (%s) to -l/--longitudinal is missing the <event> list.\n",
+                        __FILE__, __LINE__, __func__, optarg);
+                exit(-1);
+            }
+            size_t available = get_general_purpose_counter_count();
+            if( available > MAX_GENERAL_PURPOSE_COUNTERS ){
+                available = MAX_GENERAL_PURPOSE_COUNTERS;
+            }
+            char *local_params = strdup( lng->params );
+            char *saveptr = NULL;
+            for( char *event = strtok_r( local_params, "+", &saveptr ); event; event = strtok_r( NULL, "+", &saveptr ) ){
+                if( lng->event_count == available ){
+                    printf( "%s:%d:%s Too many events in (%s); this processor has %zu general-purpose counters.\n",
+                            __FILE__, __LINE__, __func__, optarg, available );
+                    exit(-1);
+                }
+                lng->events[ lng->event_count++ ] = safe_strtoull( event ) & 0xFFFFFFFFULL;
+            }
+            free( local_params );
+            break;
+        }
+        case ENERGY_COUNTERS:
+            lng->energy_interval.tv_sec  = 1;
+            lng->energy_interval.tv_nsec = 0;
+            if( NULL != lng->params ){
+                str2timespec( lng->params, &( lng->energy_interval ) );
+            }
+            if( lng->energy_interval.tv_sec == 0 && lng->energy_interval.tv_nsec == 0 ){
+                printf( "%s:%d:%s Background read interval in (%s) cannot be 0.\n",
+                        __FILE__, __LINE__, __func__, optarg);
+                exit(-1);
+            }
+            break;
+        case CAPFREQUENCY:
+            if( NULL == lng->params ){
+                printf( "%s:%d:%s Parameter (%s) to -l/--longitudinal is missing the <ratio>.\n",
+                        __FILE__, __LINE__, __func__, optarg);
+                exit(-1);
+            }
+            lng->ratio = safe_strtoull( lng->params );
+            if( lng->ratio == 0 || lng->ratio > 0xFF ){
+                printf( "%s:%d:%s The <ratio> in (%s) must be between 1 and 255.\n",
+                        __FILE__, __LINE__, __func__, optarg);
+                exit(-1);
+            }
+            break;
+        case COLDSTART:
+        {
+            char *local_params = lng->params ? strdup( lng->params ) : NULL;
+            char *saveptr = NULL;
+            char *timeout = local_params ? strtok_r( local_params, ":", &saveptr ) : NULL;
+            char *margin  = local_params ? strtok_r( NULL, ":", &saveptr ) : NULL;
+            if( NULL == timeout || NULL == margin ){
+                printf( "%s:%d:%s Parameter (%s) to -l/--longitudinal needs <timespec>:<degrees>.\n",
+                        __FILE__, __LINE__, __func__, optarg);
+                exit(-1);
+            }
+            str2timespec( timeout, &( lng->coldstart_timeout ) );
+            lng->coldstart_margin = safe_strtoull( margin );
+            if( lng->coldstart_margin > 0x7F ){
+                printf( "%s:%d:%s The <degrees> in (%s) must be at most 127.\n",
+                        __FILE__, __LINE__, __func__, optarg);
+                exit(-1);
+            }
+            free( local_params );
+            break;
+        }
+        default:
+            if( NULL != lng->params ){
+                printf( "%s:%d:%s Extra parameters in -l/--longitudinal (%s).\n",
+                        __FILE__, __LINE__, __func__, optarg);
+                exit(-1);
+            }
+            break;
+    }
+}
+
+uint64_t create_hw_param( char *param ){
     // Input is a string representing a integer, possibly prefaced by "hw".
     // If hw is present, return a value with that Hamming Weight.
     // Otherwise, just return the value.
@@ -212,13 +602,100 @@ static uint64_t create_hw_param( char *param ){
     return v;
 }
 
+static bool auto_placed;     // Once set, the topology has been read.
+
+static void str2control_cpuset( const char * const s, cpu_set_t *cpuset ){
+    // Control cpus may be "auto"; see compute_auto_placement().
+    if( 0 == strcmp( "auto", s ) ){
+        cpu2cpuset( get_auto_control_cpu(), cpuset );
+        auto_placed = true;
+    }else{
+        str2cpuset( s, cpuset );
+    }
+}
+
+static void validate_cpuset( cpu_set_t *cpus, const char *what, size_t idx ){
+    for( unsigned int cpu = 0; cpu < CPU_SETSIZE; cpu++ ){
+        if( CPU_ISSET( cpu, cpus ) && !cpu_is_online( cpu ) ){
+            printf( "%s:%d:%s cpu %u (%s %zu) does not exist or is offline according to %s/devices/system/cpu/online.\n",
+                    __FILE__, __LINE__, __func__, cpu, what, idx, get_sysfs_root() );
+            exit(-1);
+        }
+    }
+}
+
+static void validate_cpusets( struct job *job ){
+    // str2cpuset() only knows about CPU_SETSIZE; check against what's actually
+    // there.  Sharing a core with a benchmark is legal but worth a warning.
+    validate_cpuset( &job->main_cpu, "main", 0 );
+    cpu_set_t execution_cpus;
+    CPU_ZERO( &execution_cpus );
+    for( size_t i = 0; i < job->benchmark_count; i++ ){
+        validate_cpuset( &job->benchmarks[i]->execution_cpu, "benchmark", i );
+        cpu_set_t overlap;
+        CPU_AND( &overlap, &execution_cpus, &job->benchmarks[i]->execution_cpu );
+        if( CPU_COUNT( &overlap ) ){
+            printf( "%s:%d:%s More than one benchmark on cpu ", __FILE__, __LINE__, __func__ );
+            fprintf_cpuset( stdout, &overlap );
+            printf( ".\n" );
+            exit(-1);
+        }
+        CPU_OR( &execution_cpus, &execution_cpus, &job->benchmarks[i]->execution_cpu );
+    }
+    for( size_t i = 0; i < job->longitudinal_count; i++ ){
+        validate_cpuset( &job->longitudinals[i]->sample_cpus, "longitudinal", i );
+        validate_cpuset( &job->longitudinals[i]->snapshot_cpu, "snapshot", i );
+    }
+    for( size_t i = 0; i < job->poll_count; i++ ){
+        validate_cpuset( &job->polls[i]->control_cpu, "poll control", i );
+        validate_cpuset( &job->polls[i]->polled_cpu, "poll sample", i );
+    }
+    if( job->calibrate ){
+        validate_cpuset( &job->calibrate->control_cpus, "calibrate control", 0 );
+        validate_cpuset( &job->calibrate->polled_cpus, "calibrate sample", 0 );
+    }
+
+    // SCHED_FIFO threads that spin (benchmarks, and everyone in the start
+    // barrier) never yield to each other on a shared cpu.
+    if( job->fifo ){
+        cpu_set_t fifo_cpus = execution_cpus, overlap;
+        for( size_t i = 0; i <= job->poll_count; i++ ){
+            cpu_set_t *cpus = ( i == job->poll_count ) ? &job->main_cpu : &job->polls[i]->control_cpu;
+            CPU_AND( &overlap, &fifo_cpus, cpus );
+            if( CPU_COUNT( &overlap ) ){
+                printf( "%s:%d:%s With -F/--fifo, main, poll and benchmark threads need cpus of their own; cpu ",
+                        __FILE__, __LINE__, __func__ );
+                fprintf_cpuset( stdout, &overlap );
+                printf( " is shared.\n" );
+                exit(-1);
+            }
+            CPU_OR( &fifo_cpus, &fifo_cpus, cpus );
+        }
+    }
+
+    if( cpusets_share_core( &job->main_cpu, &execution_cpus ) ){
+        fprintf( stderr, "%s:%d:%s Warning:  the main cpu shares a core with a benchmark.\n",
+                __FILE__, __LINE__, __func__ );
+    }
+    for( size_t i = 0; i < job->poll_count; i++ ){
+        if( cpusets_share_core( &job->polls[i]->control_cpu, &execution_cpus ) ){
+            fprintf( stderr, "%s:%d:%s Warning:  the control cpu of poll %zu shares a core with a benchmark.\n",
+                    __FILE__, __LINE__, __func__, i );
+        }
+    }
+}
+
 void parse_options( int argc, char **argv, struct job *job ){
     // Default values:
     job->duration.tv_sec     = 10;
     job->duration.tv_nsec    =  0;
-    job->ab_randomized       =  false;
     job->ab_duration.tv_sec  =  1;
     job->ab_duration.tv_nsec =  0;
+    configure_phase_sequence( job, "alternate" );
+    job->powercap_root       = "/sys/class/powercap";
+    job->main_priority       = 60;
+    job->poll_priority       = 70;
+    job->benchmark_priority  = 50;
 
     static struct option long_options[] = {
         { .name = "benchmark",    .has_arg = required_argument, .flag = NULL, .val = 'b' },
@@ -230,11 +707,24 @@ void parse_options( int argc, char **argv, struct job *job ){
         { .name = "version",      .has_arg = no_argument,       .flag = NULL, .val = 'v' },
         { .name = "abTime",       .has_arg = required_argument, .flag = NULL, .val = 'T' },
         { .name = "abRandomized", .has_arg = no_argument,       .flag = NULL, .val = 'R' },
+        { .name = "abSequence",   .has_arg = required_argument, .flag = NULL, .val = 'A' },
+        { .name = "selfTimed",    .has_arg = optional_argument, .flag = NULL, .val = 'D' },
+        { .name = "parallelLongitudinal", .has_arg = no_argument, .flag = NULL, .val = 'P' },
+        { .name = "snapshot",     .has_arg = required_argument, .flag = NULL, .val = 'S' },
+        { .name = "mock",         .has_arg = optional_argument, .flag = NULL, .val = 'M' },
+        { .name = "calibrate",    .has_arg = required_argument, .flag = NULL, .val = 'C' },
+        { .name = "powercapRoot", .has_arg = required_argument, .flag = NULL, .val = 'r' },
+        { .name = "sysfsRoot",    .has_arg = required_argument, .flag = NULL, .val = 's' },
+        { .name = "zeroFault",    .has_arg = no_argument,       .flag = NULL, .val = 'z' },
+        { .name = "fifo",         .has_arg = optional_argument, .flag = NULL, .val = 'F' },
+        { .name = "archive",      .has_arg = no_argument,       .flag = NULL, .val = 'a' },
+        { .name = "live",         .has_arg = optional_argument, .flag = NULL, .val = 'L' },
+        { .name = "sweep",        .has_arg = required_argument, .flag = NULL, .val = 'w' },
         { 0, 0, 0, 0}
     };
 
     while(1){
-        int c = getopt_long( argc, argv, ":RT:b:d:hl:m:p:t:v", long_options, NULL );
+        int c = getopt_long( argc, argv, ":A:C:D::F::L::M::PRS:T:ab:d:hl:m:p:r:s:t:vw:z", long_options, NULL );
         if( -1 == c ){
             break;
         }
@@ -262,8 +752,150 @@ void parse_options( int argc, char **argv, struct job *job ){
                 break;
             }
             case 'R':
-                job->ab_randomized = true;
+                configure_phase_sequence( job, "bernoulli" );
+                break;
+            case 'A':
+                configure_phase_sequence( job, optarg );
+                break;
+            case 'D':   // self-timed phases
+                job->self_timed  = true;
+                job->check_loops = optarg ? safe_strtoull( optarg ) : 0;
+                if( optarg && 0 == job->check_loops ){
+                    printf( "%s:%d:%s -D/--selfTimed needs at least one loop between checks.\n", __FILE__, __LINE__, __func__ );
+                    exit(-1);
+                }
+                break;
+            case 'P':
+                job->parallel_longitudinals = true;
+                break;
+            case 'z':
+                job->zero_fault = true;
+                break;
+            case 'a':
+                job->archive = true;
+                break;
+            case 'L':   // live telemetry
+                free( job->live_name );
+                if( NULL == optarg ){
+                    job->live_name = calloc( 32, 1 );
+                    assert( job->live_name );
+                    snprintf( job->live_name, 32, "/var-%d", (int)getpid() );
+                }else if( '/' != optarg[0] || strchr( optarg + 1, '/' ) ){
+                    printf( "%s:%d:%s Shared memory name (%s) must be a single '/' followed by a name.\n",
+                            __FILE__, __LINE__, __func__, optarg );
+                    exit(-1);
+                }else{
+                    job->live_name = strdup( optarg );
+                }
+                break;
+            case 'w':   // sweep; parsed by setup_sweep() once the polls and benchmarks are known.
+                free( job->sweep_spec );
+                job->sweep_spec = strdup( optarg );
+                break;
+            case 'F':   // SCHED_FIFO
+            {
+                job->fifo = true;
+                if( NULL == optarg ){
+                    break;
+                }
+                char *local_optarg = strdup( optarg );
+                char *saveptr = NULL;
+                int *priorities[] = { &job->main_priority, &job->poll_priority, &job->benchmark_priority };
+                char *priority = strtok_r( local_optarg, ":", &saveptr );
+                for( size_t p = 0; p < sizeof( priorities ) / sizeof( priorities[0] ) && priority; p++ ){
+                    *priorities[p] = (int)safe_strtoull( priority );
+                    if( *priorities[p] < sched_get_priority_min( SCHED_FIFO ) || *priorities[p] > sched_get_priority_max( SCHED_FIFO ) ){
+                        printf( "%s:%d:%s Priority %d in (%s) is outside the SCHED_FIFO range %d-%d.\n",
+                                __FILE__, __LINE__, __func__, *priorities[p], optarg,
+                                sched_get_priority_min( SCHED_FIFO ), sched_get_priority_max( SCHED_FIFO ) );
+                        exit(-1);
+                    }
+                    priority = strtok_r( NULL, ":", &saveptr );
+                }
+                if( priority ){
+                    printf( "%s:%d:%s Extra parameters in -F/--fifo (%s).\n",
+                            __FILE__, __LINE__, __func__, optarg);
+                    exit(-1);
+                }
+                free( local_optarg );
                 break;
+            }
+            case 'C':   // calibrate
+            {
+                char *local_optarg = strdup( optarg );
+                char *saveptr = NULL;
+                char *cal_msr     = strtok_r( local_optarg, ":", &saveptr );
+                char *cal_control = strtok_r( NULL, ":", &saveptr );
+                char *cal_sample  = strtok_r( NULL, ":", &saveptr );
+                char *cal_samples = strtok_r( NULL, ":", &saveptr );
+                if( NULL == cal_sample ){
+                    printf( "%s:%d:%s Parameter (%s) to -C/--calibrate needs <msr_address>:<control_cpus>:<sample_cpus>.\n",
+                            __FILE__, __LINE__, __func__, optarg);
+                    exit(-1);
+                }
+                job->calibrate = calloc( 1, sizeof( struct calibrate_config ) );
+                assert( job->calibrate );
+                job->calibrate->msr     = safe_strtoull( cal_msr );
+                job->calibrate->samples = cal_samples ? safe_strtoull( cal_samples ) : 10'000;
+                str2cpuset( cal_control, &( job->calibrate->control_cpus ) );
+                str2cpuset( cal_sample,  &( job->calibrate->polled_cpus ) );
+                if( 0 == job->calibrate->samples ){
+                    printf( "%s:%d:%s Number of samples in (%s) cannot be 0.\n",
+                            __FILE__, __LINE__, __func__, optarg);
+                    exit(-1);
+                }
+                free( local_optarg );
+                break;
+            }
+            case 'r':   // powercap root
+                job->powercap_root = optarg;
+                break;
+            case 's':   // sysfs root
+                if( auto_placed ){
+                    printf( "%s:%d:%s -s/--sysfsRoot (%s) must precede any auto placement.\n",
+                            __FILE__, __LINE__, __func__, optarg);
+                    exit(-1);
+                }
+                set_sysfs_root( optarg );
+                break;
+            case 'M':   // mock
+                set_msr_backend( &mock_backend );
+                configure_mock_backend( optarg );
+                break;
+            case 'S':   // snapshot
+            {
+                char *local_optarg = strdup( optarg );
+                char *saveptr = NULL;
+                char *snp_idx      = strtok_r( local_optarg, ":", &saveptr );
+                char *snp_interval = strtok_r( NULL, ":", &saveptr );
+                char *snp_cpu      = strtok_r( NULL, ":", &saveptr );
+                if( NULL == snp_cpu ){
+                    printf( "%s:%d:%s Parameter (%s) to -S/--snapshot needs <longitudinal_index>:<timespec>:<control_cpu>.\n",
+                            __FILE__, __LINE__, __func__, optarg);
+                    exit(-1);
+                }
+                size_t idx = safe_strtoull( snp_idx );
+                if( idx >= job->longitudinal_count ){
+                    printf( "%s:%d:%s No longitudinal %zu (yet) in (%s); -S/--snapshot must follow its -l.\n",
+                            __FILE__, __LINE__, __func__, idx, optarg);
+                    exit(-1);
+                }
+                struct longitudinal_config *lng = job->longitudinals[ idx ];
+                str2timespec( snp_interval, &( lng->snapshot_interval ) );
+                if( lng->snapshot_interval.tv_sec == 0 && lng->snapshot_interval.tv_nsec == 0 ){
+                    printf( "%s:%d:%s Snapshot interval in (%s) cannot be 0.\n",
+                            __FILE__, __LINE__, __func__, optarg);
+                    exit(-1);
+                }
+                str2control_cpuset( snp_cpu, &( lng->snapshot_cpu ) );
+                if( CPU_COUNT( &( lng->snapshot_cpu ) ) != 1 ){
+                    printf( "%s:%d:%s Parameter (%s) to -S/--snapshot takes a single <control_cpu>.\n",
+                            __FILE__, __LINE__, __func__, optarg);
+                    exit(-1);
+                }
+                free( local_optarg );
+                break;
+            }
             case 't':   // time (duration)
             {
                 char *local_optarg = strdup( optarg );
@@ -273,7 +905,7 @@ void parse_options( int argc, char **argv, struct job *job ){
             }
             case 'm':   // main
             {
-                str2cpuset( optarg, &job->main_cpu );
+                str2control_cpuset( optarg, &job->main_cpu );
                 break;
             }
             case 'l':   // longitudinal
@@ -299,29 +931,36 @@ void parse_options( int argc, char **argv, struct job *job ){
                 char *saveptr = NULL;
                 char *lng_type = strtok_r( local_optarg, ":", &saveptr);
                 char *lng_cpuset = strtok_r( NULL, ":", &saveptr );
-                char *should_be_null = strtok_r( NULL, ":", &saveptr);
+                char *lng_params = strtok_r( NULL, "", &saveptr );     // Everything else, type-specific.
                 if( NULL == lng_cpuset ){
                     printf( "%s:%d:%s Parameter (%s) to -l/--longitudinal is missing <sample_cpus>.\n",
                             __FILE__, __LINE__, __func__, optarg);
                     exit( -1 ) ;
                 }
-                if( NULL != should_be_null ){
-                    printf( "%s:%d:%s Extra parameters in -l/--longitudinal (%s).\n",
-                            __FILE__, __LINE__, __func__, optarg);
-                    exit(-1);
-                }
 
                 // Fill in the struct
                 if( 0 == strcmp( longitudinaltype2str[0], lng_type ) ){
                     lng->longitudinal_type = FIXED_FUNCTION_COUNTERS;
                 }else if ( 0 == strcmp( longitudinaltype2str[1], lng_type ) ){
                     lng->longitudinal_type = ALL_ALLOWED;
+                }else if ( 0 == strcmp( longitudinaltype2str[ GENERAL_PURPOSE_COUNTERS ], lng_type ) ){
+                    lng->longitudinal_type = GENERAL_PURPOSE_COUNTERS;
+                }else if ( 0 == strcmp( longitudinaltype2str[ ENERGY_COUNTERS ], lng_type ) ){
+                    lng->longitudinal_type = ENERGY_COUNTERS;
+                }else if ( 0 == strcmp( longitudinaltype2str[ CAPFREQUENCY ], lng_type ) ){
+                    lng->longitudinal_type = CAPFREQUENCY;
+                }else if ( 0 == strcmp( longitudinaltype2str[ COLDSTART ], lng_type ) ){
+                    lng->longitudinal_type = COLDSTART;
+                }else if ( 0 == strcmp( longitudinaltype2str[ ZEROAMPERF ], lng_type ) ){
+                    lng->longitudinal_type = ZEROAMPERF;
                 }else{
                     printf( "%s:%d:%s Unknown longitudinal type (%s).\n",
                             __FILE__, __LINE__, __func__, lng_type );
                     exit(-1);
                 }
                 str2cpuset( lng_cpuset, &lng->sample_cpus );
+                lng->params = lng_params ? strdup( lng_params ) : NULL;
+                parse_longitudinal_params( lng, optarg );
 
                 free(local_optarg);
                 break;
@@ -365,7 +1004,12 @@ void parse_options( int argc, char **argv, struct job *job ){
 
                 // Unlike longitudinal tasks, we need one benchmark_config per thread.
                 cpu_set_t all_cpus;
-                str2cpuset( bch_cpuset, &all_cpus );
+                if( 0 == strcmp( "auto", bch_cpuset ) ){
+                    get_auto_measured_cpus( &all_cpus );
+                    auto_placed = true;
+                }else{
+                    str2cpuset( bch_cpuset, &all_cpus );
+                }
                 size_t num_threads = get_cpuset_count( &all_cpus );
 
                 unsigned int current_cpu = 0;
@@ -378,10 +1022,26 @@ void parse_options( int argc, char **argv, struct job *job ){
                         sizeof( struct benchmark_config *) * job->benchmark_count );
                 assert( job->benchmarks );
 
-                // Grab the parameters
-                uint64_t benchmark_param1 = create_hw_param( bch_param1 );
-                uint64_t benchmark_param2 = create_hw_param( bch_param2 );
-                uint64_t benchmark_param3 = safe_strtoull( bch_param3 );
+                // Grab the parameters, one value or one per phase.
+                uint64_t benchmark_param[ MAX_PHASES ][3];
+                uint8_t  benchmark_param_count[3];
+                char *bch_params[3] = { bch_param1, bch_param2, bch_param3 };
+                for( size_t j = 0; j < 3; j++ ){
+                    char *value_saveptr = NULL;
+                    benchmark_param_count[j] = 0;
+                    for( char *v = strtok_r( bch_params[j], ",", &value_saveptr ); v; v = strtok_r( NULL, ",", &value_saveptr ) ){
+                        if( MAX_PHASES == benchmark_param_count[j] ){
+                            printf( "%s:%d:%s More than %zu values for <param%zu> in -b/--benchmark (%s).\n",
+                                    __FILE__, __LINE__, __func__, MAX_PHASES, j + 1, optarg );
+                            exit(-1);
+                        }
+                        benchmark_param[ benchmark_param_count[j]++ ][j] = ( j < 2 ) ? create_hw_param( v ) : safe_strtoull( v );
+                    }
+                    if( 0 == benchmark_param_count[j] ){
+                        printf( "%s:%d:%s Empty <param%zu> in -b/--benchmark (%s).\n", __FILE__, __LINE__, __func__, j + 1, optarg );
+                        exit(-1);
+                    }
+                }
 
                 // Allocate and fill in the structs.
                 for( size_t bch_idx = first_new_benchmark_idx; bch_idx < job->benchmark_count; bch_idx++ ){
@@ -407,10 +1067,9 @@ void parse_options( int argc, char **argv, struct job *job ){
                     current_cpu = get_next_cpu( current_cpu, 255, &all_cpus, NULL );
                     cpu2cpuset( current_cpu++, &(job->benchmarks[ bch_idx ]->execution_cpu) );
 
-                    // Parameters
-                    job->benchmarks[ bch_idx ]->benchmark_param1 = benchmark_param1;
-                    job->benchmarks[ bch_idx ]->benchmark_param2 = benchmark_param2;
-                    job->benchmarks[ bch_idx ]->benchmark_param3 = benchmark_param3;
+                    // Parameters; fill_phase_params() spreads single values over every phase.
+                    memcpy( job->benchmarks[ bch_idx ]->phase_param,       benchmark_param,       sizeof( benchmark_param ) );
+                    memcpy( job->benchmarks[ bch_idx ]->phase_param_count, benchmark_param_count, sizeof( benchmark_param_count ) );
 
                 }
 
@@ -476,15 +1135,43 @@ void parse_options( int argc, char **argv, struct job *job ){
                 }
 
                 // Fill in the struct
+                char *source = strchr( pll_msr_str, '@' );
+                if( source ){
+                    *source++ = '\0';
+                    if( strcmp( source, "powercap" ) ){
+                        printf( "%s:%d:%s Unknown poll source (%s) in (%s).\n",
+                                __FILE__, __LINE__, __func__, source, pll->local_optarg );
+                        exit(-1);
+                    }
+                    pll->powercap = true;
+                }
                 pll->msr = (uint32_t)safe_strtoull( pll_msr_str );
                 pll->flags = str2flags( pll_flags_str );
-                str2timespec( pll_timespec_str, &pll->interval );
+                // A delta needs the value it's a delta of.
+                if( pll->flags & DELTA_TSC    ){ pll->flags |= OP_TSC;    }
+                if( pll->flags & DELTA_MPERF  ){ pll->flags |= OP_MPERF;  }
+                if( pll->flags & DELTA_APERF  ){ pll->flags |= OP_APERF;  }
+                if( pll->flags & DELTA_THERM  ){ pll->flags |= OP_THERM;  }
+                if( pll->flags & DELTA_PTHERM ){ pll->flags |= OP_PTHERM; }
+                if( 0 == strcmp( pll_timespec_str, "auto" ) ){
+                    // Measured by calibrate_poll_cadences(), which times OP_POLL.
+                    if( !( pll->flags & OP_POLL ) ){
+                        printf( "%s:%d:%s An auto interval needs OP_POLL (%s).\n",
+                                __FILE__, __LINE__, __func__, pll->local_optarg );
+                        exit(-1);
+                    }
+                    pll->auto_interval    = true;
+                    pll->interval.tv_sec  = 0;
+                    pll->interval.tv_nsec = 1'000'000L;
+                }else{
+                    str2timespec( pll_timespec_str, &pll->interval );
+                }
                 if( pll->interval.tv_sec == 0 && pll->interval.tv_nsec == 0 ){
                     fprintf( stderr, "Polling interval cannot be 0.\n" );
                     exit(-1);
                 }
                 str2cpuset( pll_polled_cpuset_str, &pll->polled_cpu );
-                str2cpuset( pll_control_cpuset_str, &pll->control_cpu );
+                str2control_cpuset( pll_control_cpuset_str, &pll->control_cpu );
                 free(local_optarg);
                 break;
             }
@@ -498,5 +1185,7 @@ void parse_options( int argc, char **argv, struct job *job ){
         }; // switch
     };
 
+    validate_cpusets( job );
+    setup_phase_schedule( job );
     print_options( argc, argv, job );
 }
@@ -1,2 +1,6 @@
 #pragma once
+#include <stdint.h>
+#include "job.h"
 void parse_options( int argc, char **argv, struct job *job );
+void print_summary( struct job *job );
+uint64_t create_hw_param( char *param );
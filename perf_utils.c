@@ -0,0 +1,207 @@
+#define _GNU_SOURCE
+#include <stdlib.h>         // calloc(3), exit(3)
+#include <stdio.h>          // fprintf(3)
+#include <string.h>         // strerror(3)
+#include <errno.h>          // errno
+#include <assert.h>         // assert(3)
+#include <stdint.h>         // uint64_t etc.
+#include <inttypes.h>       // PRIu16 etc.
+#include <sched.h>          // sched_getcpu(3)
+#include <unistd.h>         // syscall(2), read(2), close(2), sysconf(3)
+#include <sys/ioctl.h>      // ioctl(2)
+#include <sys/mman.h>       // mmap(2), munmap(2)
+#include <sys/syscall.h>    // SYS_perf_event_open
+#include <linux/perf_event.h>
+#include <x86intrin.h>      // __rdtsc(), __rdpmc()
+#include "msr_utils.h"      // msr_t, struct msr_batch_array
+#include "perf_utils.h"
+
+static const uint64_t perf_group_configs[ PERF_GROUP_EVENTS ] = {
+    PERF_COUNT_HW_INSTRUCTIONS,     // FIXED_CTR0
+    PERF_COUNT_HW_CPU_CYCLES,       // FIXED_CTR1
+    PERF_COUNT_HW_REF_CPU_CYCLES,   // FIXED_CTR2
+};
+
+// read(2) layout for PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING.
+struct perf_group_read{
+    uint64_t    nr;
+    uint64_t    time_enabled;
+    uint64_t    time_running;
+    uint64_t    values[ PERF_GROUP_EVENTS ];
+};
+
+static int perf_event_open( struct perf_event_attr *attr, int cpu, int group_fd ){
+    return syscall( SYS_perf_event_open, attr, -1, cpu, group_fd, 0 );
+}
+
+void setup_perf_groups( struct job *job ){
+    long page_size = sysconf( _SC_PAGESIZE );
+    for( size_t i = 0; i < job->longitudinal_count; i++ ){
+        struct longitudinal_config *lng = job->longitudinals[i];
+        if( !lng->use_perf ){
+            continue;
+        }
+        lng->perf_group_count = CPU_COUNT( &lng->sample_cpus );
+        lng->perf_groups = calloc( lng->perf_group_count, sizeof( struct perf_group ) );
+        assert( lng->perf_groups );
+        size_t g = 0;
+        for( uint16_t cpu = 0; cpu < CPU_SETSIZE && g < lng->perf_group_count; cpu++ ){
+            if( !CPU_ISSET( cpu, &lng->sample_cpus ) ){
+                continue;
+            }
+            struct perf_group *group = &( lng->perf_groups[ g++ ] );
+            group->cpu = cpu;
+            for( size_t e = 0; e < PERF_GROUP_EVENTS; e++ ){
+                // Same rings as FIXED_CTR_CTRL=0x333:  user and kernel.  The
+                // leader is pinned so the group is never multiplexed out.
+                struct perf_event_attr attr = {
+                    .type        = PERF_TYPE_HARDWARE,
+                    .size        = sizeof( struct perf_event_attr ),
+                    .config      = perf_group_configs[e],
+                    .read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING,
+                    .disabled    = ( 0 == e ),
+                    .pinned      = ( 0 == e ),
+                };
+                group->fd[e] = perf_event_open( &attr, cpu, e ? group->fd[0] : -1 );
+                if( -1 == group->fd[e] ){
+                    fprintf( stderr, "%s:%d:%s perf_event_open for event %zu on cpu %"PRIu16" failed:  (%d) %s.  %sBye!\n",
+                            __FILE__, __LINE__, __func__, e, cpu, errno, strerror( errno ),
+                            ( EACCES == errno || EPERM == errno ) ? "Check /proc/sys/kernel/perf_event_paranoid.  " :
+                            ( ENOENT == errno ) ? "This system exposes no hardware PMU.  " : "" );
+                    exit(-1);
+                }
+                // The mmap page is only needed for rdpmc; carry on without it.
+                group->mmap_page[e] = mmap( NULL, page_size, PROT_READ, MAP_SHARED, group->fd[e], 0 );
+                if( MAP_FAILED == group->mmap_page[e] ){
+                    group->mmap_page[e] = NULL;
+                }
+            }
+        }
+    }
+}
+
+static void control_perf_groups( struct job *job, longitudinal_slot_t slot_idx ){
+    for( size_t i = 0; i < job->longitudinal_count; i++ ){
+        struct longitudinal_config *lng = job->longitudinals[i];
+        if( !lng->use_perf ){
+            continue;
+        }
+        uint64_t first = __rdtsc();
+        for( size_t g = 0; g < lng->perf_group_count; g++ ){
+            int leader = lng->perf_groups[g].fd[0];
+            if( slot_idx == START ){
+                ioctl( leader, PERF_EVENT_IOC_RESET,  PERF_IOC_FLAG_GROUP );
+                ioctl( leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP );
+            }else{
+                ioctl( leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP );
+            }
+        }
+        // No batch to measure, so the spread is how long the ioctls took.
+        lng->spread_tsc[ slot_idx ] = __rdtsc() - first;
+    }
+}
+
+void start_perf_groups( struct job *job ){
+    control_perf_groups( job, START );
+}
+
+void stop_perf_groups( struct job *job ){
+    control_perf_groups( job, STOP );
+}
+
+static bool rdpmc_read( const struct perf_event_mmap_page *pc, uint64_t *value ){
+    // The seqlock protocol from include/uapi/linux/perf_event.h.  index is
+    // zero whenever the event isn't live on a counter (e.g., after STOP).
+    uint32_t seq;
+    do{
+        seq = pc->lock;
+        __atomic_thread_fence( __ATOMIC_ACQUIRE );
+        uint32_t idx = pc->index;
+        if( !pc->cap_user_rdpmc || 0 == idx ){
+            return false;
+        }
+        // Sign-extend the pmc_width-bit counter before adding the offset.
+        uint16_t shift = 64 - pc->pmc_width;
+        int64_t pmc = (int64_t)( (uint64_t)__rdpmc( idx - 1 ) << shift ) >> shift;
+        *value = pc->offset + pmc;
+        __atomic_thread_fence( __ATOMIC_ACQUIRE );
+    }while( pc->lock != seq );
+    return true;
+}
+
+static int32_t read_perf_group( struct perf_group *group, uint64_t values[ PERF_GROUP_EVENTS ] ){
+    // rdpmc only sees the counters of the cpu it runs on.
+    if( sched_getcpu() == group->cpu ){
+        size_t e = 0;
+        while( e < PERF_GROUP_EVENTS && group->mmap_page[e] && rdpmc_read( group->mmap_page[e], &values[e] ) ){
+            e++;
+        }
+        if( e == PERF_GROUP_EVENTS ){
+            return 0;
+        }
+    }
+    struct perf_group_read r;
+    ssize_t n = read( group->fd[0], &r, sizeof( r ) );
+    if( n != sizeof( r ) || r.nr != PERF_GROUP_EVENTS ){
+        return n == -1 ? -errno : -EIO;     // A pinned group that lost its counters reads as EOF.
+    }
+    for( size_t e = 0; e < PERF_GROUP_EVENTS; e++ ){
+        values[e] = r.values[e];
+    }
+    return 0;
+}
+
+int perf_read_batch( struct longitudinal_config *lng, struct msr_batch_array *b ){
+    // Fill in b's FIXED_CTR0..2 ops, and the TSC, MPERF and APERF they ask
+    // for, as if msr-safe had read them.
+    int rc = 0;
+    for( size_t g = 0; g < lng->perf_group_count; g++ ){
+        struct perf_group *group = &( lng->perf_groups[g] );
+        uint64_t values[ PERF_GROUP_EVENTS ] = {};
+        int32_t err = read_perf_group( group, values );
+        uint64_t tsc = __rdtsc();
+        for( size_t op_idx = 0; op_idx < b->numops; op_idx++ ){
+            struct msr_batch_op *o = &( b->ops[ op_idx ] );
+            if( o->cpu != group->cpu || o->msr < FIXED_CTR0 || o->msr >= FIXED_CTR0 + PERF_GROUP_EVENTS ){
+                continue;
+            }
+            o->err     = err;
+            o->msrdata = err ? 0 : values[ o->msr - FIXED_CTR0 ];
+            if( o->op & OP_TSC ){
+                o->tsc = tsc;
+            }
+            // The group's ref-cycles and cycles count what MPERF and APERF do
+            // while the cpu is in C0.
+            if( o->op & OP_MPERF ){
+                o->mperf = err ? 0 : values[ FIXED_CTR2 - FIXED_CTR0 ];
+            }
+            if( o->op & OP_APERF ){
+                o->aperf = err ? 0 : values[ FIXED_CTR1 - FIXED_CTR0 ];
+            }
+        }
+        if( err ){
+            errno = -err;
+            rc = -1;
+        }
+    }
+    return rc;
+}
+
+void teardown_perf_groups( struct job *job ){
+    long page_size = sysconf( _SC_PAGESIZE );
+    for( size_t i = 0; i < job->longitudinal_count; i++ ){
+        struct longitudinal_config *lng = job->longitudinals[i];
+        for( size_t g = 0; g < lng->perf_group_count; g++ ){
+            // Members first, then the leader.
+            for( size_t e = PERF_GROUP_EVENTS; e-- > 0; ){
+                if( lng->perf_groups[g].mmap_page[e] ){
+                    munmap( lng->perf_groups[g].mmap_page[e], page_size );
+                }
+                close( lng->perf_groups[g].fd[e] );
+            }
+        }
+        free( lng->perf_groups );
+        lng->perf_groups = NULL;
+        lng->perf_group_count = 0;
+    }
+}
@@ -0,0 +1,8 @@
+#pragma once
+#include "job.h"
+
+void setup_perf_groups( struct job *job );
+void start_perf_groups( struct job *job );
+void stop_perf_groups( struct job *job );
+int perf_read_batch( struct longitudinal_config *lng, struct msr_batch_array *b );
+void teardown_perf_groups( struct job *job );
@@ -0,0 +1,455 @@
+#define _GNU_SOURCE
+#include <stdio.h>          // fprintf(3), getline(3)
+#include <stdlib.h>         // exit(3), calloc(3)
+#include <string.h>         // strtok_r(3), strdup(3)
+#include <assert.h>         // assert(3)
+#include <errno.h>          // EINTR
+#include <inttypes.h>       // PRIu64 etc.
+#include "int_utils.h"      // safe_strtoull()
+#include "tsc_utils.h"      // tsc2ns(), timespec2tsc()
+#include "phase_utils.h"
+
+// Galois feedback masks for a maximal-length LFSR of each width, from the
+// usual tables (taps n, ... as bits n-1, ...).  Every one has been checked to
+// cycle through all 2^n - 1 nonzero states.
+static const uint32_t lfsr_masks[33] = {
+    [ 2] = 0x3,         [ 3] = 0x6,         [ 4] = 0xC,         [ 5] = 0x14,
+    [ 6] = 0x30,        [ 7] = 0x60,        [ 8] = 0xB8,        [ 9] = 0x110,
+    [10] = 0x240,       [11] = 0x500,       [12] = 0xE08,       [13] = 0x1C80,
+    [14] = 0x3802,      [15] = 0x6000,      [16] = 0xD008,      [17] = 0x12000,
+    [18] = 0x20400,     [19] = 0x72000,     [20] = 0x90000,     [21] = 0x140000,
+    [22] = 0x300000,    [23] = 0x420000,    [24] = 0xE10000,    [25] = 0x1200000,
+    [26] = 0x2000023,   [27] = 0x4000013,   [28] = 0x9000000,   [29] = 0x14000000,
+    [30] = 0x20000029,  [31] = 0x48000000,  [32] = 0x80200003,
+};
+
+static constexpr const uint64_t DEFAULT_SEQUENCE_SEED = 13;
+static constexpr const uint32_t DEFAULT_BALANCED_ROUNDS = 4;    // Times through every phase per block.
+static constexpr const uint64_t MAX_BALANCED_BLOCK = 256 * MAX_PHASES;  // The block is shuffled on the stack.
+
+// -D/--selfTimed:  loops between TSC reads unless -D says otherwise.  An
+// ABXOR loop is 1000 passes over its words; an ABSHIFT loop is one shift.
+static constexpr const uint64_t ABXOR_CHECK_LOOPS   = 1;
+static constexpr const uint64_t ABSHIFT_CHECK_LOOPS = 1024;
+
+static uint64_t timespec2ns( const struct timespec *t ){
+    return (uint64_t)t->tv_sec * 1'000'000'000ULL + (uint64_t)t->tv_nsec;
+}
+
+static uint64_t splitmix64( uint64_t *state ){
+    uint64_t z = ( *state += 0x9E3779B97F4A7C15ULL );
+    z = ( z ^ ( z >> 30 ) ) * 0xBF58476D1CE4E5B9ULL;
+    z = ( z ^ ( z >> 27 ) ) * 0x94D049BB133111EBULL;
+    return z ^ ( z >> 31 );
+}
+
+static struct phase_schedule* get_schedule( struct job *job ){
+    if( NULL == job->schedule ){
+        job->schedule = calloc( 1, sizeof( struct phase_schedule ) );
+        assert( job->schedule );
+        job->schedule->sequence = SEQUENCE_ALTERNATE;
+        job->schedule->seed     = DEFAULT_SEQUENCE_SEED;
+    }
+    return job->schedule;
+}
+
+void configure_phase_sequence( struct job *job, const char *spec ){
+    struct phase_schedule *s = get_schedule( job );
+    char *local_spec = strdup( spec );
+    assert( local_spec );
+    char *saveptr = NULL;
+    char *name  = strtok_r( local_spec, ":", &saveptr );
+    char *first  = strtok_r( NULL, ":", &saveptr );
+    char *second = strtok_r( NULL, ":", &saveptr );
+    char *should_be_null = strtok_r( NULL, ":", &saveptr );
+
+    sequence_t q = 0;
+    while( name && q < NUM_SEQUENCES && strcmp( sequence2str[q], name ) ){
+        q++;
+    }
+    if( NULL == name || NUM_SEQUENCES == q ){
+        printf( "%s:%d:%s Unknown a|b sequence (%s).\n", __FILE__, __LINE__, __func__, spec );
+        exit(-1);
+    }
+    if( should_be_null
+     || ( second && ( SEQUENCE_ALTERNATE == q || SEQUENCE_BERNOULLI == q || SEQUENCE_REPLAY == q ) )
+     || ( first  && SEQUENCE_ALTERNATE == q ) ){
+        printf( "%s:%d:%s Extra parameters in a|b sequence (%s).\n", __FILE__, __LINE__, __func__, spec );
+        exit(-1);
+    }
+    s->sequence = q;
+    s->seed     = DEFAULT_SEQUENCE_SEED;
+    s->block    = 0;
+    s->bits     = 0;
+    free( s->replay );
+    s->replay   = NULL;
+    switch( q ){
+        case SEQUENCE_BERNOULLI:
+            s->seed = first ? safe_strtoull( first ) : s->seed;
+            break;
+        case SEQUENCE_BALANCED:
+        {
+            uint64_t block = first ? safe_strtoull( first ) : s->block;
+            if( first && ( 0 == block || block > MAX_BALANCED_BLOCK ) ){
+                printf( "%s:%d:%s A balanced block needs 1 to %"PRIu64" phases (%s).\n",
+                        __FILE__, __LINE__, __func__, MAX_BALANCED_BLOCK, spec );
+                exit(-1);
+            }
+            s->block = (uint32_t)block;
+            s->seed  = second ? safe_strtoull( second ) : s->seed;
+            break;
+        }
+        case SEQUENCE_LFSR:
+        {
+            uint64_t bits = first ? safe_strtoull( first ) : 0;
+            if( first && ( bits < 2 || bits > 32 ) ){
+                printf( "%s:%d:%s An LFSR needs 2 to 32 bits (%s).\n", __FILE__, __LINE__, __func__, spec );
+                exit(-1);
+            }
+            s->bits = (uint32_t)bits;
+            s->seed = second ? safe_strtoull( second ) : s->seed;
+            break;
+        }
+        case SEQUENCE_REPLAY:
+            if( NULL == first ){
+                printf( "%s:%d:%s replay needs a schedule file (%s).\n", __FILE__, __LINE__, __func__, spec );
+                exit(-1);
+            }
+            s->replay = strdup( first );
+            assert( s->replay );
+            break;
+        default:
+            break;
+    }
+    free( local_spec );
+}
+
+static void read_replay( struct phase_schedule *s ){
+    FILE *fp = fopen( s->replay, "r" );
+    if( NULL == fp ){
+        perror("");
+        printf( "%s:%d:%s Unable to open schedule %s.\n", __FILE__, __LINE__, __func__, s->replay );
+        exit(-1);
+    }
+    char *line = NULL;
+    size_t len = 0;
+    bool ended = false;
+    while( !ended && -1 != getline( &line, &len, fp ) ){
+        char *saveptr = NULL;
+        char *phase    = strtok_r( line, " \t\n", &saveptr );
+        char *selector = strtok_r( NULL, " \t\n", &saveptr );
+        char *offset   = strtok_r( NULL, " \t\n", &saveptr );
+        if( NULL == phase || '#' == phase[0] || 0 == strcmp( phase, "phase" ) ){
+            continue;
+        }
+        if( NULL == selector || NULL == offset ){
+            printf( "%s:%d:%s Short line in schedule %s.\n", __FILE__, __LINE__, __func__, s->replay );
+            exit(-1);
+        }
+        ended = ( 0 == strcmp( phase, "end" ) );
+        s->offset_ns = reallocarray( s->offset_ns, s->phase_count + 1, sizeof( uint64_t ) );
+        assert( s->offset_ns );
+        s->offset_ns[ s->phase_count ] = safe_strtoull( offset );
+        if( s->phase_count && s->offset_ns[ s->phase_count ] < s->offset_ns[ s->phase_count - 1 ] ){
+            printf( "%s:%d:%s Offsets in schedule %s go backwards.\n", __FILE__, __LINE__, __func__, s->replay );
+            exit(-1);
+        }
+        if( !ended ){
+            s->selector = reallocarray( s->selector, s->phase_count + 1, sizeof( uint8_t ) );
+            assert( s->selector );
+            uint64_t k = safe_strtoull( selector );
+            if( k > UINT8_MAX ){
+                printf( "%s:%d:%s Phase %s in schedule %s is out of range.\n", __FILE__, __LINE__, __func__, selector, s->replay );
+                exit(-1);
+            }
+            s->selector[ s->phase_count++ ] = (uint8_t)k;
+        }
+    }
+    free( line );
+    fclose( fp );
+    if( !ended || 0 == s->phase_count ){
+        printf( "%s:%d:%s Schedule %s has no phases or no end line.\n", __FILE__, __LINE__, __func__, s->replay );
+        exit(-1);
+    }
+    s->tsc = calloc( s->phase_count + 1, sizeof( uint64_t ) );
+    assert( s->tsc );
+}
+
+static void count_phases( struct job *job ){
+    // As many phases as the longest list of benchmark parameters, and at
+    // least A and B.
+    job->phases = 2;
+    for( size_t i = 0; i < job->benchmark_count; i++ ){
+        for( size_t j = 0; j < 3; j++ ){
+            size_t n = job->benchmarks[i]->phase_param_count[j];
+            job->phases = n > job->phases ? n : job->phases;
+        }
+    }
+    for( size_t i = 0; i < job->benchmark_count; i++ ){
+        for( size_t j = 0; j < 3; j++ ){
+            size_t n = job->benchmarks[i]->phase_param_count[j];
+            if( n > 1 && n != job->phases ){
+                printf( "%s:%d:%s Benchmark %zu has %zu values for <param%zu>; it needs 1 or %zu.\n",
+                        __FILE__, __LINE__, __func__, i + 1, n, j + 1, job->phases );
+                exit(-1);
+            }
+        }
+    }
+}
+
+void fill_phase_params( struct job *job ){
+    // A parameter given once is the same in every phase, except that ABSHIFT
+    // shifts <param1> in A and that phase's <param2> in every other phase
+    // unless it's given a <param1> per phase.
+    for( size_t i = 0; i < job->benchmark_count; i++ ){
+        struct benchmark_config *b = job->benchmarks[i];
+        for( size_t j = 0; j < 3; j++ ){
+            for( size_t k = 1; k < job->phases && 1 == b->phase_param_count[j]; k++ ){
+                b->phase_param[k][j] = b->phase_param[0][j];
+            }
+        }
+        if( ABSHIFT == b->benchmark_type && 1 == b->phase_param_count[0] ){
+            for( size_t k = 1; k < job->phases; k++ ){
+                b->phase_param[k][0] = b->phase_param[k][1];
+            }
+        }
+    }
+}
+
+void setup_phase_schedule( struct job *job ){
+    // End of parse_options(), so that job.out has the phases and the duration
+    // a replayed schedule sets.
+    struct phase_schedule *s = get_schedule( job );
+    count_phases( job );
+    fill_phase_params( job );
+    if( SEQUENCE_BALANCED == s->sequence ){
+        s->block = s->block ? s->block : DEFAULT_BALANCED_ROUNDS * job->phases;
+        if( s->block % job->phases ){
+            printf( "%s:%d:%s A balanced block of %"PRIu32" phases can't hold each of %zu equally often.\n",
+                    __FILE__, __LINE__, __func__, s->block, job->phases );
+            exit(-1);
+        }
+    }
+    if( SEQUENCE_LFSR == s->sequence && job->phases > 2 ){
+        printf( "%s:%d:%s An LFSR sequence only has two phases, not %zu.\n", __FILE__, __LINE__, __func__, job->phases );
+        exit(-1);
+    }
+    if( SEQUENCE_REPLAY == s->sequence ){
+        read_replay( s );
+        for( size_t k = 0; k < s->phase_count; k++ ){
+            if( s->selector[k] >= job->phases ){
+                printf( "%s:%d:%s Phase %zu in schedule %s is %"PRIu8", but the benchmarks only have %zu phases.\n",
+                        __FILE__, __LINE__, __func__, k, s->replay, s->selector[k], job->phases );
+                exit(-1);
+            }
+        }
+        uint64_t end = s->offset_ns[ s->phase_count ];
+        job->duration.tv_sec  = (time_t)( end / 1'000'000'000ULL );
+        job->duration.tv_nsec = (long)( end % 1'000'000'000ULL );
+        fprintf( stderr, "%s:%d:%s Replaying %zu phases from %s.\n", __FILE__, __LINE__, __func__, s->phase_count, s->replay );
+    }
+}
+
+size_t max_phase_count( const struct job *job ){
+    // For the job as it stands; with -w/--sweep that's the envelope.
+    if( SEQUENCE_REPLAY == job->schedule->sequence ){
+        return job->schedule->phase_count;
+    }
+    uint64_t ab = timespec2ns( &job->ab_duration );
+    assert( ab );
+    return ( timespec2ns( &job->duration ) + ab - 1 ) / ab;
+}
+
+static uint32_t lfsr_width( const struct phase_schedule *s ){
+    // Wide enough that the sequence doesn't repeat during the run.
+    uint32_t n = s->bits ? s->bits : 2;
+    while( !s->bits && n < 32 && ( ( 1ULL << n ) - 1 ) < s->phase_count ){
+        n++;
+    }
+    return n;
+}
+
+static void convert_offsets( struct phase_schedule *s ){
+    // For -D/--selfTimed, worked out before the run rather than by each thread.
+    free( s->offset_tsc );
+    s->offset_tsc = calloc( s->phase_count + 1, sizeof( uint64_t ) );
+    assert( s->offset_tsc );
+    for( size_t k = 0; k <= s->phase_count; k++ ){
+        struct timespec t = {
+            .tv_sec  = (time_t)( s->offset_ns[k] / 1'000'000'000ULL ),
+            .tv_nsec = (long)( s->offset_ns[k] % 1'000'000'000ULL ),
+        };
+        s->offset_tsc[k] = timespec2tsc( &t );
+    }
+}
+
+void build_phase_schedule( struct job *job ){
+    struct phase_schedule *s = job->schedule;
+    if( SEQUENCE_REPLAY == s->sequence ){
+        memset( s->tsc, 0, ( s->phase_count + 1 ) * sizeof( uint64_t ) );
+        convert_offsets( s );
+        return;
+    }
+    free( s->selector );
+    free( s->offset_ns );
+    free( s->offset_tsc );
+    free( s->tsc );
+    s->phase_count = max_phase_count( job );
+    s->selector  = calloc( s->phase_count + 1, sizeof( uint8_t ) );
+    s->offset_ns = calloc( s->phase_count + 1, sizeof( uint64_t ) );
+    s->tsc       = calloc( s->phase_count + 1, sizeof( uint64_t ) );
+    s->offset_tsc = NULL;
+    assert( s->selector && s->offset_ns && s->tsc );
+
+    uint64_t ab = timespec2ns( &job->ab_duration );
+    for( size_t k = 0; k < s->phase_count; k++ ){
+        s->offset_ns[k] = k * ab;
+    }
+    s->offset_ns[ s->phase_count ] = timespec2ns( &job->duration );
+
+    // Every trial gets the same sequence from the same seed.
+    uint64_t state = s->seed;
+    size_t n = job->phases;
+    switch( s->sequence ){
+        case SEQUENCE_ALTERNATE:
+            // B first, as the old loop flipped the selector before the first phase.
+            for( size_t k = 0; k < s->phase_count; k++ ){
+                s->selector[k] = (uint8_t)( ( k + 1 ) % n );
+            }
+            break;
+        case SEQUENCE_BERNOULLI:
+            // The top 32 bits scaled to [0,n); with two phases, the top bit.
+            for( size_t k = 0; k < s->phase_count; k++ ){
+                s->selector[k] = (uint8_t)( ( ( splitmix64( &state ) >> 32 ) * n ) >> 32 );
+            }
+            break;
+        case SEQUENCE_BALANCED:
+            // Fisher-Yates within each block; a final partial block is the
+            // front of a full one.
+            for( size_t first = 0; first < s->phase_count; first += s->block ){
+                uint8_t block[ s->block ];
+                for( uint32_t j = 0; j < s->block; j++ ){
+                    block[j] = (uint8_t)( j % n );
+                }
+                for( uint32_t j = s->block - 1; j > 0; j-- ){
+                    uint32_t r = (uint32_t)( splitmix64( &state ) % ( j + 1 ) );
+                    uint8_t tmp = block[j];
+                    block[j] = block[r];
+                    block[r] = tmp;
+                }
+                for( uint32_t j = 0; j < s->block && first + j < s->phase_count; j++ ){
+                    s->selector[ first + j ] = block[j];
+                }
+            }
+            break;
+        case SEQUENCE_LFSR:
+        {
+            uint32_t w = lfsr_width( s );
+            uint32_t mask = lfsr_masks[w];
+            uint32_t reg  = (uint32_t)( s->seed & ( w == 32 ? UINT32_MAX : ( 1U << w ) - 1 ) );
+            reg = reg ? reg : 1;
+            for( size_t k = 0; k < s->phase_count; k++ ){
+                s->selector[k] = reg & 1;
+                reg = ( reg >> 1 ) ^ ( ( reg & 1 ) ? mask : 0 );
+            }
+            break;
+        }
+        default:
+            break;
+    }
+    convert_offsets( s );
+}
+
+void setup_self_timed_benchmark( struct job *job, struct benchmark_config *b ){
+    // Main thread, before the benchmark thread starts:  have the kernel read
+    // the phase its cursor keeps rather than job.phase.
+    b->phase = &b->cursor.phase;
+    b->check_loops = job->check_loops ? job->check_loops
+                   : ( ABSHIFT == b->benchmark_type ) ? ABSHIFT_CHECK_LOOPS : ABXOR_CHECK_LOOPS;
+}
+
+void start_phase_cursor( struct benchmark_config *b, const struct phase_schedule *s, uint64_t base_tsc ){
+    // Benchmark thread, just out of the start barrier:  phase 0 starts now.
+    b->cursor = (struct phase_cursor){
+        .offset_tsc = s->offset_tsc,
+        .selector   = s->selector,
+        .count      = s->phase_count,
+        .base_tsc   = base_tsc,
+        .next_tsc   = base_tsc + s->offset_tsc[0],
+    };
+    advance_phase_cursor( &b->cursor );
+}
+
+void sleep_until_phase( const struct timespec *start, uint64_t offset_ns ){
+    uint64_t ns = (uint64_t)start->tv_nsec + offset_ns;
+    struct timespec deadline = {
+        .tv_sec  = start->tv_sec + (time_t)( ns / 1'000'000'000ULL ),
+        .tv_nsec = (long)( ns % 1'000'000'000ULL ),
+    };
+    while( EINTR == clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL ) );
+}
+
+void fprintf_phase_sequence( FILE *fp, const struct job *job ){
+    const struct phase_schedule *s = job->schedule;
+    fprintf( fp, "%s", sequence2str[ s->sequence ] );
+    switch( s->sequence ){
+        case SEQUENCE_BERNOULLI:    fprintf( fp, " seed %"PRIu64, s->seed );                        break;
+        case SEQUENCE_BALANCED:     fprintf( fp, " block %"PRIu32" seed %"PRIu64, s->block, s->seed ); break;
+        case SEQUENCE_LFSR:
+            // The width isn't known until the first schedule is built.
+            if( s->bits || s->phase_count ){
+                fprintf( fp, " bits %"PRIu32" seed %"PRIu64, lfsr_width( s ), s->seed );
+            }else{
+                fprintf( fp, " bits auto seed %"PRIu64, s->seed );
+            }
+            break;
+        case SEQUENCE_REPLAY:       fprintf( fp, " %s", s->replay );                                break;
+        default:                                                                                    break;
+    }
+}
+
+void dump_phase_schedule( const struct job *job ){
+    // late_ns is how long after its planned offset the main thread started
+    // each phase, measured from the TSC it read just before the run's start
+    // time.
+    const struct phase_schedule *s = job->schedule;
+    FILE *fp = fopen( "./schedule.out", "w" );
+    assert( NULL != fp );
+    fprintf( fp, "# sequence " );
+    fprintf_phase_sequence( fp, job );
+    fprintf( fp, "\nphase\tselector\toffset_ns\ttsc\tlate_ns\n" );
+    for( size_t k = 0; k <= s->phase_count; k++ ){
+        if( k < s->phase_count ){
+            fprintf( fp, "%zu\t%"PRIu8, k, s->selector[k] );
+        }else{
+            fprintf( fp, "end\t-" );
+        }
+        int64_t late = s->tsc[k] ? (int64_t)tsc2ns( s->tsc[k] - job->main_start_tsc ) - (int64_t)s->offset_ns[k] : 0;
+        fprintf( fp, "\t%"PRIu64"\t%"PRIu64"\t%"PRId64"\n", s->offset_ns[k], s->tsc[k], late );
+    }
+    fclose( fp );
+}
+
+void fprintf_phase_params( FILE *fp, const struct job *job, const struct benchmark_config *b ){
+    // <param1..3> as -b/--benchmark takes them:  a list where they differ by phase.
+    for( size_t j = 0; j < 3; j++ ){
+        fprintf( fp, j ? ", " : "" );
+        for( size_t k = 0; k < ( b->phase_param_count[j] > 1 ? job->phases : 1 ); k++ ){
+            fprintf( fp, k ? ",%#"PRIx64 : "%#"PRIx64, b->phase_param[k][j] );
+        }
+    }
+}
+
+void teardown_phase_schedule( struct job *job ){
+    struct phase_schedule *s = job->schedule;
+    if( NULL == s ){
+        return;
+    }
+    free( s->selector );
+    free( s->offset_ns );
+    free( s->offset_tsc );
+    free( s->tsc );
+    free( s->replay );
+    free( s );
+    job->schedule = NULL;
+}
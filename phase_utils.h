@@ -0,0 +1,88 @@
+#pragma once
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <x86intrin.h>      // __rdtsc()
+#include "job.h"
+
+// The phase schedule.  There are as many distinct phases (A, B, C, ...; at
+// most MAX_PHASES) as the longest list of per-phase benchmark parameters, and
+// at least two.  Before each run the whole sequence of phases is generated,
+// and phase k starts k * ab_duration after the run does, on an
+// absolute CLOCK_MONOTONIC deadline; the run ends at exactly duration, the
+// last phase cut short if need be.  What actually ran (planned offsets and
+// the TSC at which the main thread got to each) is written to schedule.out,
+// which -A replay:<file> reads back to run the same phases at the same
+// offsets.
+//
+//   alternate                          B, C, ..., A, B, C, ...
+//   bernoulli[:<seed>]                 Each phase equally likely.
+//   balanced[:<block>[:<seed>]]        Each <block> phases (default four per
+//                                      phase, at most 256 per possible phase)
+//                                      hold each phase equally often, shuffled.
+//   lfsr[:<bits>[:<seed>]]             A and B only:  the output of a
+//                                      maximal-length <bits>-bit Galois LFSR;
+//                                      by default the smallest that doesn't
+//                                      repeat in the run.
+//   replay:<file>                      The phases in a schedule.out, which
+//                                      also set the duration of the run.
+//
+// Seeds default to 13; -R no longer reproduces the random() order of earlier
+// versions.
+//
+// Normally the main thread sleeps until each phase and then writes job.phase,
+// which every benchmark thread reads; each sees the change after its own
+// cache-line transfer.  With -D/--selfTimed the offsets are converted to TSC
+// ticks before the run, and each benchmark thread reads the TSC every
+// check_loops times round its loop and switches itself once the next phase's
+// deadline (the start barrier's release TSC plus the offset) has passed, so
+// they all switch within one check of each other.  The main thread keeps
+// job.phase, the transition log and the poll tags in step by spinning to the
+// same deadlines.
+
+typedef enum{                                SEQUENCE_ALTERNATE, SEQUENCE_BERNOULLI, SEQUENCE_BALANCED, SEQUENCE_LFSR, SEQUENCE_REPLAY, NUM_SEQUENCES } sequence_t;
+static const char * const sequence2str[] = { "alternate",        "bernoulli",        "balanced",        "lfsr",        "replay"                       };
+
+struct phase_schedule{
+    sequence_t                  sequence;
+    uint64_t                    seed;
+    uint32_t                    block;          // BALANCED:  phases per block; 0 until chosen.
+    uint32_t                    bits;           // LFSR:  register width; 0 until chosen.
+    char                        *replay;        // REPLAY:  the schedule.out being replayed.
+
+    // Built by build_phase_schedule() before each run (read once for REPLAY).
+    size_t                      phase_count;
+    uint8_t                     *selector;      // [ phase_count ]
+    uint64_t                    *offset_ns;     // [ phase_count + 1 ] from the start of the run;
+                                                //   the last is the end of the run.
+    uint64_t                    *offset_tsc;    // [ phase_count + 1 ] the same in TSC ticks.
+    uint64_t                    *tsc;           // [ phase_count + 1 ] when the main thread got there.
+};
+
+// Benchmark threads, -D/--selfTimed:  start any phases whose deadlines have
+// passed.  The transitions are counted as the main thread counts them (only
+// actual changes), so that both index the same phase_tsc entries.
+static inline void advance_phase_cursor( struct phase_cursor *c ){
+    uint64_t now = __rdtsc();
+    while( now >= c->next_tsc ){
+        if( c->selector[ c->next ] != c->phase ){
+            c->phase = c->selector[ c->next ];
+            c->transitions++;
+        }
+        c->next++;
+        c->next_tsc = ( c->next < c->count ) ? c->base_tsc + c->offset_tsc[ c->next ] : UINT64_MAX;
+    }
+}
+
+void configure_phase_sequence( struct job *job, const char *spec );
+void setup_phase_schedule( struct job *job );
+void fill_phase_params( struct job *job );
+size_t max_phase_count( const struct job *job );
+void build_phase_schedule( struct job *job );
+void sleep_until_phase( const struct timespec *start, uint64_t offset_ns );
+void setup_self_timed_benchmark( struct job *job, struct benchmark_config *b );
+void start_phase_cursor( struct benchmark_config *b, const struct phase_schedule *s, uint64_t base_tsc );
+void dump_phase_schedule( const struct job *job );
+void fprintf_phase_sequence( FILE *fp, const struct job *job );
+void fprintf_phase_params( FILE *fp, const struct job *job, const struct benchmark_config *b );
+void teardown_phase_schedule( struct job *job );
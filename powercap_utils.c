@@ -0,0 +1,170 @@
+#define _GNU_SOURCE
+#include <stdlib.h>         // strtoull(3), exit(3)
+#include <inttypes.h>       // PRIx32
+#include <stdio.h>          // snprintf(3), fprintf(3)
+#include <string.h>         // strncmp(3), strcspn(3), strdup(3)
+#include <errno.h>          // errno
+#include <fcntl.h>          // open(2)
+#include <unistd.h>         // pread(2), close(2)
+#include <dirent.h>         // opendir(3), readdir(3)
+#include <x86intrin.h>      // __rdtsc()
+#include "msr_utils.h"      // msr_t, struct msr_batch_op
+#include "cpuset_utils.h"   // get_next_cpu()
+#include "topology_utils.h" // cpu2package()
+#include "powercap_utils.h"
+
+// A --poll on <msr_address>@powercap reads the intel-rapl powercap zone that
+// corresponds to the RAPL MSR instead of the MSR itself.  Counts are in uJ
+// and wrap at max_energy_range_uj.
+
+static const char * msr2zone( uint32_t msr ){
+    switch( msr ){
+        case PKG_ENERGY_STATUS:         return "package-";  // Followed by the package id.
+        case DRAM_ENERGY_STATUS:        return "dram";
+        case PP0_ENERGY_STATUS:         return "core";
+        case PP1_ENERGY_STATUS:         return "uncore";
+        case PLATFORM_ENERGY_COUNTER:   return "psys";
+        default:                        return NULL;
+    }
+}
+
+static bool read_sysfs_string( const char *dir, const char *file, char *buf, size_t len ){
+    static char path[4096];
+    snprintf( path, sizeof( path ), "%s/%s", dir, file );
+    FILE *fp = fopen( path, "r" );
+    if( NULL == fp ){
+        return false;
+    }
+    bool ok = NULL != fgets( buf, len, fp );
+    fclose( fp );
+    buf[ strcspn( buf, "\n" ) ] = '\0';
+    return ok;
+}
+
+static char * find_zone( const char *root, uint32_t msr, unsigned int package ){
+    // Package zones are intel-rapl:<n> named package-<id>; their subzones are
+    // intel-rapl:<n>:<m>.  psys is a top-level zone of its own.
+    static char want[64], name[64], dir[4096];
+    const char *zone = msr2zone( msr );
+    if( NULL == zone ){
+        return NULL;
+    }
+    snprintf( want, sizeof( want ), "package-%u", package );
+
+    DIR *d = opendir( root );
+    if( NULL == d ){
+        return NULL;
+    }
+    char package_zone[256] = "";
+    for( struct dirent *e = readdir( d ); e && '\0' == package_zone[0]; e = readdir( d ) ){
+        if( strncmp( e->d_name, "intel-rapl:", 11 ) || strchr( e->d_name + 11, ':' ) ){
+            continue;
+        }
+        snprintf( dir, sizeof( dir ), "%s/%s", root, e->d_name );
+        if( read_sysfs_string( dir, "name", name, sizeof( name ) ) && 0 == strcmp( name, want ) ){
+            snprintf( package_zone, sizeof( package_zone ), "%s", e->d_name );
+        }
+    }
+
+    char *found = NULL;
+    rewinddir( d );
+    for( struct dirent *e = readdir( d ); e && NULL == found; e = readdir( d ) ){
+        if( strncmp( e->d_name, "intel-rapl:", 11 ) ){
+            continue;
+        }
+        bool top_level = NULL == strchr( e->d_name + 11, ':' );
+        if( msr == PKG_ENERGY_STATUS ){
+            if( top_level && 0 == strcmp( e->d_name, package_zone ) ){
+                snprintf( dir, sizeof( dir ), "%s/%s", root, e->d_name );
+                found = strdup( dir );
+            }
+            continue;
+        }
+        if( msr != PLATFORM_ENERGY_COUNTER ){
+            // Subzones must belong to this package's zone.
+            size_t n = strlen( package_zone );
+            if( top_level || 0 == n || strncmp( e->d_name, package_zone, n ) || ':' != e->d_name[n] ){
+                continue;
+            }
+        }
+        snprintf( dir, sizeof( dir ), "%s/%s", root, e->d_name );
+        if( read_sysfs_string( dir, "name", name, sizeof( name ) ) && 0 == strcmp( name, zone ) ){
+            found = strdup( dir );
+        }
+    }
+    closedir( d );
+    return found;
+}
+
+void setup_powercap_polls( struct job *job ){
+    for( size_t i = 0; i < job->poll_count; i++ ){
+        struct poll_config *pll = job->polls[i];
+        if( !pll->powercap ){
+            continue;
+        }
+        unsigned int cpu = get_next_cpu( 0, CPU_SETSIZE, &( pll->polled_cpu ), NULL );
+        pll->powercap_zone = find_zone( job->powercap_root, pll->msr, cpu2package( cpu ) );
+        if( NULL == pll->powercap_zone ){
+            fprintf( stderr, "%s:%d:%s No powercap zone under %s for msr %#"PRIx32" on cpu %u.  Bye!\n",
+                    __FILE__, __LINE__, __func__, job->powercap_root, pll->msr, cpu );
+            exit(-1);
+        }
+        static char buf[64];
+        if( !read_sysfs_string( pll->powercap_zone, "max_energy_range_uj", buf, sizeof( buf ) ) ){
+            fprintf( stderr, "%s:%d:%s Unable to read %s/max_energy_range_uj.  Bye!\n",
+                    __FILE__, __LINE__, __func__, pll->powercap_zone );
+            exit(-1);
+        }
+        pll->powercap_max_range = strtoull( buf, NULL, 10 );
+
+        static char path[4096];
+        snprintf( path, sizeof( path ), "%s/energy_uj", pll->powercap_zone );
+        pll->powercap_fd = open( path, O_RDONLY );
+        if( -1 == pll->powercap_fd ){
+            perror("");
+            fprintf( stderr, "%s:%d:%s Unable to open %s.  Bye!\n", __FILE__, __LINE__, __func__, path );
+            exit(-1);
+        }
+    }
+}
+
+void teardown_powercap_polls( struct job *job ){
+    for( size_t i = 0; i < job->poll_count; i++ ){
+        if( job->polls[i]->powercap ){
+            close( job->polls[i]->powercap_fd );
+            free( job->polls[i]->powercap_zone );
+            job->polls[i]->powercap_zone = NULL;
+        }
+    }
+}
+
+static int read_energy_uj( int fd, __u64 *uj ){
+    char buf[32];
+    ssize_t n = pread( fd, buf, sizeof( buf ) - 1, 0 );
+    if( n <= 0 ){
+        return n == 0 ? -EIO : -errno;
+    }
+    buf[n] = '\0';
+    *uj = strtoull( buf, NULL, 10 );
+    return 0;
+}
+
+int read_powercap_op( int fd, struct msr_batch_op *o ){
+    // Fills in the same fields msr-safe would for an energy MSR, with the
+    // exception of the MPERF/APERF/THERM modifiers, which stay zero.
+    o->err = read_energy_uj( fd, &( o->msrdata ) );
+    if( 0 == o->err && ( o->op & OP_POLL ) ){
+        o->msrdata2 = o->msrdata;
+        for( uint32_t p = 0; p < o->poll_max && 0 == o->err && o->msrdata2 == o->msrdata; p++ ){
+            o->err = read_energy_uj( fd, &( o->msrdata2 ) );
+        }
+    }
+    if( o->op & OP_TSC ){
+        o->tsc = __rdtsc();
+    }
+    if( o->err ){
+        errno = -o->err;
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,6 @@
+#pragma once
+#include "job.h"
+
+void setup_powercap_polls( struct job *job );
+void teardown_powercap_polls( struct job *job );
+int read_powercap_op( int fd, struct msr_batch_op *o );
@@ -0,0 +1,74 @@
+#include <stdio.h>          // fprintf(3)
+#include <stdlib.h>         // exit(3)
+#include <string.h>         // memset(3)
+#include <assert.h>         // assert(3)
+#include "sample_utils.h"
+#include "msr_utils.h"      // UNUSED_OP
+#include "memory_utils.h"   // measurement_alloc()
+#include "timespec_utils.h" // timespec_division()
+
+size_t poll_sample_capacity( const struct timespec *duration, const struct poll_config *p ){
+    size_t n = timespec_division( duration, &p->interval );
+    // An auto interval is only the mean time between updates; leave room for
+    // a run of early ones.
+    return p->auto_interval ? n + n / 64 + 2 : n;
+}
+
+static uint64_t* alloc_column( struct poll_config *p, bool zero_fault ){
+    uint64_t *c = measurement_alloc( p->total_ops * sizeof( uint64_t ), &p->control_cpu, zero_fault );
+    if( NULL == c ){
+        fprintf( stderr, "%s:%d:%s Unable to allocate %zu samples for poll %s.  Bye!\n",
+                __FILE__, __LINE__, __func__, p->total_ops, p->local_optarg );
+        exit(-1);
+    }
+    return c;
+}
+
+void setup_poll_samples( struct poll_config *p, bool zero_fault ){
+    // msrdata is always written; everything else only if the flags ask for it.
+    struct poll_samples *s = &p->samples;
+    memset( s, 0, sizeof( struct poll_samples ) );
+    s->msrdata = alloc_column( p, zero_fault );
+    if( p->flags & OP_POLL   ){ s->msrdata2 = alloc_column( p, zero_fault ); }
+    if( p->flags & OP_TSC    ){ s->tsc      = alloc_column( p, zero_fault ); }
+    if( p->flags & OP_MPERF  ){ s->mperf    = alloc_column( p, zero_fault ); }
+    if( p->flags & OP_APERF  ){ s->aperf    = alloc_column( p, zero_fault ); }
+    if( p->flags & OP_THERM  ){ s->therm    = alloc_column( p, zero_fault ); }
+    if( p->flags & OP_PTHERM ){ s->ptherm   = alloc_column( p, zero_fault ); }
+    s->tag = measurement_alloc( p->total_ops * sizeof( uint8_t ), &p->control_cpu, zero_fault );
+    assert( s->tag );
+}
+
+void teardown_poll_samples( struct poll_config *p ){
+    struct poll_samples *s = &p->samples;
+    measurement_free( s->msrdata  );
+    measurement_free( s->msrdata2 );
+    measurement_free( s->tsc      );
+    measurement_free( s->mperf    );
+    measurement_free( s->aperf    );
+    measurement_free( s->therm    );
+    measurement_free( s->ptherm   );
+    measurement_free( s->tag      );
+    memset( s, 0, sizeof( struct poll_samples ) );
+}
+
+void load_poll_sample( const struct poll_config *p, size_t b, struct msr_batch_op *o ){
+    // Rebuild the op as msr-safe returned it.  Columns that weren't kept read as 0,
+    // which is what msr-safe leaves in fields the flags didn't ask for.  Samples
+    // past the end of the run come back as UNUSED_OP.
+    const struct poll_samples *s = &p->samples;
+    *o = *(p->poll_op);
+    if( b >= s->count ){
+        o->err = UNUSED_OP;
+        return;
+    }
+    o->err      = 0;    // The poll thread exits on any error.
+    o->msrdata  = s->msrdata[b];
+    o->msrdata2 = s->msrdata2 ? s->msrdata2[b] : 0;
+    o->tsc      = s->tsc      ? s->tsc[b]      : 0;
+    o->mperf    = s->mperf    ? s->mperf[b]    : 0;
+    o->aperf    = s->aperf    ? s->aperf[b]    : 0;
+    o->therm    = s->therm    ? s->therm[b]    : 0;
+    o->ptherm   = s->ptherm   ? s->ptherm[b]   : 0;
+    o->tag      = s->tag[b];
+}
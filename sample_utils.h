@@ -0,0 +1,25 @@
+#pragma once
+#include "job.h"
+#define MSR_SAFE_USERSPACE
+#include "msr_safe.h"
+#undef MSR_SAFE_USERSPACE
+
+size_t poll_sample_capacity( const struct timespec *duration, const struct poll_config *p );
+void setup_poll_samples( struct poll_config *p, bool zero_fault );
+void teardown_poll_samples( struct poll_config *p );
+void load_poll_sample( const struct poll_config *p, size_t b, struct msr_batch_op *o );
+
+// Called by the poll thread after every sample, so keep it cheap:  copy only
+// the columns the flags asked for.  The cpu, msr, flags, etc. never change and
+// stay in the poll's template op.
+static inline void store_poll_sample( struct poll_samples *s, size_t b, const struct msr_batch_op *o, uint8_t tag ){
+    s->msrdata[b] = o->msrdata;
+    if( s->msrdata2 ){ s->msrdata2[b] = o->msrdata2; }
+    if( s->tsc      ){ s->tsc[b]      = o->tsc;      }
+    if( s->mperf    ){ s->mperf[b]    = o->mperf;    }
+    if( s->aperf    ){ s->aperf[b]    = o->aperf;    }
+    if( s->therm    ){ s->therm[b]    = o->therm;    }
+    if( s->ptherm   ){ s->ptherm[b]   = o->ptherm;   }
+    s->tag[b] = tag;
+    s->count  = b + 1;
+}
@@ -0,0 +1,196 @@
+#define _GNU_SOURCE
+#include <stdlib.h>         // exit(3)
+#include <stdio.h>          // fopen(3), fprintf(3)
+#include <string.h>         // strerror(3), strrchr(3), strcspn(3)
+#include <ctype.h>          // isdigit(3)
+#include <errno.h>          // errno
+#include <assert.h>         // assert(3)
+#include <unistd.h>         // getpid(2)
+#include <dirent.h>         // opendir(3), readdir(3)
+#include <pthread.h>        // pthread_setschedparam(3)
+#include <sched.h>          // SCHED_FIFO
+#include "cpuset_utils.h"   // str2cpuset(), fprintf_cpuset()
+#include "topology_utils.h" // get_isolated_cpus(), get_nohz_full_cpus()
+#include "sched_utils.h"
+
+void set_fifo_priority( int priority, const char *thread ){
+    // Called by each thread on itself, after it has been pinned.
+    struct sched_param param = { .sched_priority = priority };
+    int rc = pthread_setschedparam( pthread_self(), SCHED_FIFO, &param );
+    if( rc ){
+        fprintf( stderr, "%s:%d:%s Unable to run the %s thread as SCHED_FIFO priority %d:  %s.  "
+                "Needs CAP_SYS_NICE or a large enough RLIMIT_RTPRIO.  Bye!\n",
+                __FILE__, __LINE__, __func__, thread, priority, strerror( rc ) );
+        exit(-1);
+    }
+}
+
+static bool read_proc_cpulist( const char *filename, cpu_set_t *cpus ){
+    static char cpulist[4096];
+    CPU_ZERO( cpus );
+    FILE *fp = fopen( filename, "r" );
+    if( NULL == fp ){
+        return false;
+    }
+    bool ok = NULL != fgets( cpulist, sizeof( cpulist ), fp );
+    fclose( fp );
+    cpulist[ strcspn( cpulist, "\n" ) ] = '\0';
+    if( ok && isdigit( (unsigned char)cpulist[0] ) ){
+        str2cpuset( cpulist, cpus );
+    }
+    return ok;
+}
+
+static size_t warn_cpus( FILE *fp, cpu_set_t *cpus, cpu_set_t *good, const char *role, const char *what ){
+    // Warn about the cpus in cpus that aren't in good.
+    cpu_set_t bad;
+    CPU_XOR( &bad, cpus, good );
+    CPU_AND( &bad, &bad, cpus );
+    if( 0 == CPU_COUNT( &bad ) ){
+        return 0;
+    }
+    fprintf( fp, "WARNING %s cpu ", role );
+    fprintf_cpuset( fp, &bad );
+    fprintf( fp, " %s\n", what );
+    return 1;
+}
+
+static size_t check_irqs( FILE *fp, cpu_set_t *cpus ){
+    // Any interrupt that may be delivered to one of our cpus.  The effective
+    // affinity, where the kernel exposes it, is what the hardware was told.
+    size_t warnings = 0;
+    static char filename[512];
+    cpu_set_t irq_cpus, overlap;
+    if( read_proc_cpulist( "/proc/irq/default_smp_affinity_list", &irq_cpus ) ){
+        CPU_AND( &overlap, &irq_cpus, cpus );
+        if( CPU_COUNT( &overlap ) ){
+            fprintf( fp, "WARNING new irqs default to cpus including " );
+            fprintf_cpuset( fp, &overlap );
+            fprintf( fp, " (/proc/irq/default_smp_affinity_list)\n" );
+            warnings++;
+        }
+    }
+    DIR *dir = opendir( "/proc/irq" );
+    for( struct dirent *d = dir ? readdir( dir ) : NULL; d; d = readdir( dir ) ){
+        if( !isdigit( (unsigned char)d->d_name[0] ) ){
+            continue;
+        }
+        snprintf( filename, sizeof( filename ), "/proc/irq/%s/effective_affinity_list", d->d_name );
+        if( !read_proc_cpulist( filename, &irq_cpus ) || 0 == CPU_COUNT( &irq_cpus ) ){
+            snprintf( filename, sizeof( filename ), "/proc/irq/%s/smp_affinity_list", d->d_name );
+            read_proc_cpulist( filename, &irq_cpus );
+        }
+        CPU_AND( &overlap, &irq_cpus, cpus );
+        if( CPU_COUNT( &overlap ) ){
+            fprintf( fp, "WARNING irq %s can be delivered to cpu ", d->d_name );
+            fprintf_cpuset( fp, &overlap );
+            fprintf( fp, "\n" );
+            warnings++;
+        }
+    }
+    if( dir ){
+        closedir( dir );
+    }
+    return warnings;
+}
+
+static size_t check_runnable_tasks( FILE *fp, cpu_set_t *cpus ){
+    // Threads of other processes that are runnable right now and last ran on
+    // one of our cpus.  A snapshot, so absence proves little, but a busy cpu
+    // shows up.
+    size_t warnings = 0;
+    static char filename[1024], stat[1024];
+    pid_t self = getpid();
+    DIR *procs = opendir( "/proc" );
+    for( struct dirent *p = procs ? readdir( procs ) : NULL; p; p = readdir( procs ) ){
+        if( !isdigit( (unsigned char)p->d_name[0] ) || atoi( p->d_name ) == self ){
+            continue;
+        }
+        snprintf( filename, sizeof( filename ), "/proc/%s/task", p->d_name );
+        DIR *tasks = opendir( filename );
+        for( struct dirent *t = tasks ? readdir( tasks ) : NULL; t; t = readdir( tasks ) ){
+            if( !isdigit( (unsigned char)t->d_name[0] ) ){
+                continue;
+            }
+            snprintf( filename, sizeof( filename ), "/proc/%s/task/%s/stat", p->d_name, t->d_name );
+            FILE *sfp = fopen( filename, "r" );
+            if( NULL == sfp ){
+                continue;   // Exited since readdir.
+            }
+            bool ok = NULL != fgets( stat, sizeof( stat ), sfp );
+            fclose( sfp );
+            // The comm field may hold spaces and parentheses; the fields after
+            // the last ')' are "state ppid ..." with processor 36 fields on.
+            char *close = ok ? strrchr( stat, ')' ) : NULL;
+            char state;
+            int processor;
+            if( NULL == close || 2 != sscanf( close + 1,
+                        " %c %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s"
+                        " %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %d",
+                        &state, &processor ) ){
+                continue;
+            }
+            if( 'R' == state && processor >= 0 && processor < CPU_SETSIZE && CPU_ISSET( processor, cpus ) ){
+                *close = '\0';
+                fprintf( fp, "WARNING task %s (%s) is runnable on cpu %d\n", t->d_name, strchr( stat, '(' ) + 1, processor );
+                warnings++;
+            }
+        }
+        if( tasks ){
+            closedir( tasks );
+        }
+    }
+    if( procs ){
+        closedir( procs );
+    }
+    return warnings;
+}
+
+void check_isolation( struct job *job ){
+    // Written to isolation.out before any thread starts.  Nothing here is
+    // fatal; it's a record of what could have disturbed the run.
+    FILE *fp = fopen( "isolation.out", "w" );
+    assert( NULL != fp );
+
+    cpu_set_t measured, control, all, isolated, nohz_full;
+    CPU_ZERO( &measured );
+    CPU_ZERO( &control );
+    for( size_t i = 0; i < job->benchmark_count; i++ ){
+        CPU_OR( &measured, &measured, &job->benchmarks[i]->execution_cpu );
+    }
+    CPU_OR( &control, &control, &job->main_cpu );
+    for( size_t i = 0; i < job->poll_count; i++ ){
+        CPU_OR( &control, &control, &job->polls[i]->control_cpu );
+    }
+    CPU_OR( &all, &measured, &control );
+    get_isolated_cpus( &isolated );
+    get_nohz_full_cpus( &nohz_full );
+
+    fprintf( fp, "# benchmark cpus:  " );
+    fprintf_cpuset( fp, &measured );
+    fprintf( fp, "\n# control cpus:    " );
+    fprintf_cpuset( fp, &control );
+    fprintf( fp, "\n# isolated:        " );
+    fprintf_cpuset( fp, &isolated );
+    fprintf( fp, "\n# nohz_full:       " );
+    fprintf_cpuset( fp, &nohz_full );
+    fprintf( fp, "\n# scheduling:      %s\n", job->fifo ? "SCHED_FIFO" : "SCHED_OTHER" );
+
+    size_t warnings = 0;
+    warnings += warn_cpus( fp, &measured, &isolated,  "benchmark", "not in isolcpus=" );
+    warnings += warn_cpus( fp, &measured, &nohz_full, "benchmark", "not in nohz_full=" );
+    // Poll control cpus benefit from the same treatment; main mostly sleeps.
+    for( size_t i = 0; i < job->poll_count; i++ ){
+        warnings += warn_cpus( fp, &job->polls[i]->control_cpu, &isolated,  "poll control", "not in isolcpus=" );
+        warnings += warn_cpus( fp, &job->polls[i]->control_cpu, &nohz_full, "poll control", "not in nohz_full=" );
+    }
+    warnings += check_irqs( fp, &all );
+    warnings += check_runnable_tasks( fp, &all );
+    fprintf( fp, "# %zu warning%s\n", warnings, warnings == 1 ? "" : "s" );
+    fclose( fp );
+
+    if( warnings ){
+        fprintf( stderr, "%s:%d:%s %zu isolation warning%s; see isolation.out.\n",
+                __FILE__, __LINE__, __func__, warnings, warnings == 1 ? "" : "s" );
+    }
+}
@@ -0,0 +1,5 @@
+#pragma once
+#include "job.h"
+
+void set_fifo_priority( int priority, const char *thread );
+void check_isolation( struct job *job );
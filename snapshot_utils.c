@@ -0,0 +1,188 @@
+#define _GNU_SOURCE
+#include <stdlib.h>         // calloc(3)
+#include <string.h>         // memcpy(3)
+#include <assert.h>         // assert(3)
+#include <stdint.h>         // uint64_t etc.
+#include <inttypes.h>       // PRIu64 etc.
+#include <stdio.h>          // fprintf(3)
+#include <time.h>           // clock_nanosleep(2)
+#include <pthread.h>        // pthread_[create|join](3p)
+#include <sched.h>          // sched_setaffinity(2)
+#include "msr_utils.h"      // struct msr_batch_array
+#include "msr_backend.h"    // msr_batch()
+#include "timespec_utils.h" // timespec_division()
+#include "perf_utils.h"     // perf_read_batch()
+#include "memory_utils.h"   // measurement_alloc()
+#include "snapshot_utils.h"
+
+static bool snapshotting( struct longitudinal_config *lng ){
+    return lng->snapshot_interval.tv_sec || lng->snapshot_interval.tv_nsec;
+}
+
+static void* snapshot_thread_start( void *v ){
+
+    struct longitudinal_config *lng = v;
+    assert( 0 == sched_setaffinity( 0, sizeof( cpu_set_t ), &( lng->snapshot_cpu ) ) );
+
+    int fd = -1;
+    if( !lng->use_perf ){
+        fd = msr_batch_open();
+        assert( -1 != fd );
+    }
+
+    // Absolute deadlines, so the time spent in the ioctl doesn't accumulate.
+    struct timespec deadline;
+    assert( 0 == clock_gettime( CLOCK_MONOTONIC, &deadline ) );
+    while( !(lng->snapshot_halt) && lng->snapshot_count < lng->snapshot_max ){
+        size_t row = lng->snapshot_count;
+        // Ignore the return code; ops that fail here failed at READ as well.
+        if( lng->use_perf ){
+            perf_read_batch( lng, lng->snapshot_batch );
+        }else{
+            msr_batch( fd, lng->snapshot_batch );
+        }
+        for( size_t c = 0; c < lng->snapshot_series_count; c++ ){
+            struct snapshot_series *s = &( lng->snapshot_series[c] );
+            s->tsc[ row ] = lng->snapshot_batch->ops[ s->op_idx[0] ].tsc;
+            for( size_t k = 0; k < s->nops; k++ ){
+                s->values[ row * s->nops + k ] = lng->snapshot_batch->ops[ s->op_idx[k] ].msrdata;
+            }
+        }
+        lng->snapshot_count++;
+
+        deadline.tv_nsec += lng->snapshot_interval.tv_nsec;
+        deadline.tv_sec  += lng->snapshot_interval.tv_sec + deadline.tv_nsec / 1'000'000'000L;
+        deadline.tv_nsec %= 1'000'000'000L;
+        clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL );
+    }
+    if( -1 != fd ){
+        msr_batch_close( fd );
+    }
+    return NULL;
+}
+
+void setup_snapshots( struct job *job ){
+    // Everything is allocated and touched here, well before START, so the
+    // snapshot thread never faults in a page.
+    for( size_t i = 0; i < job->longitudinal_count; i++ ){
+        struct longitudinal_config *lng = job->longitudinals[i];
+        if( !snapshotting( lng ) || NULL == lng->batches[ READ ] ){
+            continue;
+        }
+        size_t n = lng->batches[ READ ]->numops;
+        lng->snapshot_batch = calloc( 1, sizeof( struct msr_batch_array ) );
+        assert( lng->snapshot_batch );
+        lng->snapshot_batch->numops  = n;
+        lng->snapshot_batch->version = lng->batches[ READ ]->version;
+        lng->snapshot_batch->ops     = calloc( n, sizeof( struct msr_batch_op ) );
+        assert( lng->snapshot_batch->ops );
+        memcpy( lng->snapshot_batch->ops, lng->batches[ READ ]->ops, n * sizeof( struct msr_batch_op ) );
+
+        // One row per interval, plus the first read at START and slack for the end.
+        lng->snapshot_max   = timespec_division( &job->duration, &lng->snapshot_interval ) + 2;
+        lng->snapshot_count = 0;
+
+        lng->snapshot_series_count = CPU_COUNT( &lng->sample_cpus );
+        lng->snapshot_series = calloc( lng->snapshot_series_count, sizeof( struct snapshot_series ) );
+        assert( lng->snapshot_series );
+        size_t c = 0;
+        for( uint16_t cpu = 0; cpu < CPU_SETSIZE && c < lng->snapshot_series_count; cpu++ ){
+            if( !CPU_ISSET( cpu, &lng->sample_cpus ) ){
+                continue;
+            }
+            struct snapshot_series *s = &( lng->snapshot_series[ c++ ] );
+            s->cpu = cpu;
+            s->op_idx = calloc( n, sizeof( size_t ) );
+            assert( s->op_idx );
+            for( size_t k = 0; k < n; k++ ){
+                if( lng->snapshot_batch->ops[k].cpu == cpu ){
+                    s->op_idx[ s->nops++ ] = k;
+                }
+            }
+            assert( s->nops > 0 );
+            // Prefaulted on snapshot_cpu so the snapshot thread doesn't take
+            // page faults between START and STOP.
+            s->tsc    = measurement_alloc( lng->snapshot_max * sizeof( uint64_t ), &( lng->snapshot_cpu ), true );
+            s->values = measurement_alloc( lng->snapshot_max * s->nops * sizeof( uint64_t ), &( lng->snapshot_cpu ), true );
+        }
+    }
+}
+
+void start_snapshots( struct job *job ){
+    for( size_t i = 0; i < job->longitudinal_count; i++ ){
+        struct longitudinal_config *lng = job->longitudinals[i];
+        if( NULL == lng->snapshot_batch ){
+            continue;
+        }
+        lng->snapshot_halt  = false;
+        lng->snapshot_count = 0;    // Once per -w/--sweep trial.
+        assert( 0 == pthread_create( &( lng->snapshot_thread ), NULL, snapshot_thread_start, lng ) );
+    }
+}
+
+void stop_snapshots( struct job *job ){
+    for( size_t i = 0; i < job->longitudinal_count; i++ ){
+        struct longitudinal_config *lng = job->longitudinals[i];
+        if( NULL == lng->snapshot_batch ){
+            continue;
+        }
+        lng->snapshot_halt = true;
+        assert( 0 == pthread_join( lng->snapshot_thread, NULL ) );
+    }
+}
+
+void dump_snapshots( struct job *job ){
+    for( size_t i = 0; i < job->longitudinal_count; i++ ){
+        struct longitudinal_config *lng = job->longitudinals[i];
+        if( NULL == lng->snapshot_batch ){
+            continue;
+        }
+        static char filename[2048];
+        snprintf( filename, 2047, "./longitudinal_%zu_%s_SNAPSHOTS.out", i, longitudinaltype2str[ lng->longitudinal_type ] );
+        FILE *fp = fopen( filename, "w" );
+        if( fp == NULL ){
+            perror("");
+            fprintf( stderr, "%s:%d:%s Error opening file %s.  Bye!\n", __FILE__, __LINE__, __func__, filename );
+            exit(-1);
+        }
+        fprintf( fp, "# %zu of %zu snapshots every ", lng->snapshot_count, lng->snapshot_max );
+        fprintf_timespec( fp, &( lng->snapshot_interval ) );
+        fprintf( fp, "\n" );
+        // Every sample cpu runs the same recipe, so the first series names the columns.
+        fprintf( fp, "cpu snapshot tsc" );
+        for( size_t k = 0; k < lng->snapshot_series[0].nops; k++ ){
+            fprintf( fp, " %#"PRIx32, (uint32_t)lng->snapshot_batch->ops[ lng->snapshot_series[0].op_idx[k] ].msr );
+        }
+        fprintf( fp, "\n" );
+        for( size_t c = 0; c < lng->snapshot_series_count; c++ ){
+            struct snapshot_series *s = &( lng->snapshot_series[c] );
+            for( size_t row = 0; row < lng->snapshot_count; row++ ){
+                fprintf( fp, "%"PRIu16" %zu %"PRIu64, s->cpu, row, s->tsc[ row ] );
+                for( size_t k = 0; k < s->nops; k++ ){
+                    fprintf( fp, " %"PRIu64, s->values[ row * s->nops + k ] );
+                }
+                fprintf( fp, "\n" );
+            }
+        }
+        fclose( fp );
+    }
+}
+
+void teardown_snapshots( struct job *job ){
+    for( size_t i = 0; i < job->longitudinal_count; i++ ){
+        struct longitudinal_config *lng = job->longitudinals[i];
+        if( NULL == lng->snapshot_batch ){
+            continue;
+        }
+        for( size_t c = 0; c < lng->snapshot_series_count; c++ ){
+            free( lng->snapshot_series[c].op_idx );
+            measurement_free( lng->snapshot_series[c].tsc );
+            measurement_free( lng->snapshot_series[c].values );
+        }
+        free( lng->snapshot_series );
+        free( lng->snapshot_batch->ops );
+        free( lng->snapshot_batch );
+        lng->snapshot_series = NULL;
+        lng->snapshot_batch  = NULL;
+    }
+}
@@ -0,0 +1,8 @@
+#pragma once
+#include "job.h"
+
+void setup_snapshots( struct job *job );
+void start_snapshots( struct job *job );
+void stop_snapshots( struct job *job );
+void dump_snapshots( struct job *job );
+void teardown_snapshots( struct job *job );
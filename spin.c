@@ -1,15 +1,61 @@
 /* spin.c */
-#define _XOPEN_SOURCE 500 // for random(3)
-#define _POSIX_C_SOURCE 200112L // for posix_memalign(3)
+#define _GNU_SOURCE     // random(3), posix_memalign(3), sched_setaffinity(2)
 #include <assert.h>
 #include <stdlib.h>     // posix_memalign(3), random(3)
 #include <stdio.h>
+#include <string.h>     // memcpy(3), memset(3)
 #include <unistd.h>     // sysconf(3)
+#include <sched.h>      // sched_setaffinity(2)
+#include <pthread.h>    // pthread_[create|join](3p)
+#include <stdatomic.h>  // atomic_store_explicit()
+#include <x86intrin.h>  // __rdtsc()
+#include "cpuset_utils.h"       // get_next_cpu()
+#include "topology_utils.h"     // cpu2node()
+#include "memory_utils.h"       // bind_to_node()
+#include "phase_utils.h"        // advance_phase_cursor()
 #include "spin.h"
+
+// Called by a benchmark thread the first time it sees a new phase value.
+// The main thread bumps the transition count before flipping the selector, so
+// the count is already current by the time the new selector is visible here.
+// A self-timed thread has its own count.
+static inline void record_phase_observation( struct benchmark_config *b ){
+    size_t idx = b->cursor.selector ? b->cursor.transitions : *(b->phase_transition_count);
+    if( idx && b->phase_tsc && !(b->phase_tsc[ idx - 1 ]) ){
+        b->phase_tsc[ idx - 1 ] = __rdtsc();
+    }
+}
+
+// -L/--live:  SPIN and ABSHIFT loops are too short to publish every time, so
+// they publish once every LIVE_LOOPS_MASK + 1 loops.  Nobody else writes the
+// benchmark's row, so the store is all it costs.
+static constexpr const uint64_t LIVE_LOOPS_MASK = ( 1ULL << 20 ) - 1;
+
+static inline void publish_loops( _Atomic uint64_t *live, size_t k, uint64_t loops ){
+    if( live ){
+        atomic_store_explicit( &live[k], loops, memory_order_relaxed );
+    }
+}
+
+// At the start of a trial, executed_loops is zero, so this also clears the
+// counts the last -w/--sweep trial left behind.
+static void publish_executed_loops( struct benchmark_config *b ){
+    for( size_t k = 0; k < MAX_PHASES; k++ ){
+        publish_loops( b->live_loops, k, b->executed_loops[k] );
+    }
+}
+
 void run_spin( struct benchmark_config *b ){
+    _Atomic uint64_t *live = b->live_loops;
     uint64_t accumulator = 0;
-    for( ; ! (*(b->halt)); accumulator++ );
+    publish_executed_loops( b );
+    for( ; ! (*(b->halt)); accumulator++ ){
+        if( 0 == ( accumulator & LIVE_LOOPS_MASK ) ){
+            publish_loops( live, 0, b->executed_loops[ 0 ] + accumulator );
+        }
+    }
     b->executed_loops[ 0 ] += accumulator;
+    publish_executed_loops( b );
 }
 
 void run_abshift( struct benchmark_config *b ){
@@ -17,65 +63,185 @@ void run_abshift( struct benchmark_config *b ){
     // If you touch this code, make sure to check to see if the compiler
     // optimized away the actual shift instructions.  Some of what's going
     // on here is relatively subtle.
-    uint64_t accumulator[2] = {};
-    uint64_t to_be_shifted[2] = { b->benchmark_param1, b->benchmark_param2 };
-    uint64_t shift_amount     = b->benchmark_param3;
-
-    for( ; ! (*(b->halt)); accumulator[*(b->ab_selector)]++ ){
-        bool idx = *(b->ab_selector);
-        to_be_shifted[ idx ] = ( to_be_shifted[ idx ] << shift_amount ) >> shift_amount;
-    }
-    b->benchmark_param1 = to_be_shifted[ 0 ];   // forces the shifts to be executed, as
-    b->benchmark_param2 = to_be_shifted[ 1 ];   // the results are externally visible.
-    b->executed_loops[ 0 ] += accumulator[ 0 ];
-    b->executed_loops[ 1 ] += accumulator[ 1 ];
+    uint64_t accumulator[ MAX_PHASES ] = {};
+    uint64_t to_be_shifted[ MAX_PHASES ];
+    uint64_t shift_amount[ MAX_PHASES ];
+    for( size_t k = 0; k < MAX_PHASES; k++ ){
+        to_be_shifted[k] = b->phase_param[k][0];   // See fill_phase_params().
+        shift_amount[k]  = b->phase_param[k][2];
+    }
+    uint8_t last_idx = *(b->phase);
+    record_phase_observation( b );
+    publish_executed_loops( b );
+
+    const bool self_timed = b->cursor.selector;
+    _Atomic uint64_t *live = b->live_loops;
+    uint64_t countdown = b->check_loops;
+    for( ; ! (*(b->halt)); accumulator[*(b->phase)]++ ){
+        if( self_timed && 0 == --countdown ){
+            countdown = b->check_loops;
+            advance_phase_cursor( &b->cursor );
+        }
+        uint8_t idx = *(b->phase);
+        if( idx != last_idx ){
+            record_phase_observation( b );
+            publish_loops( live, last_idx, b->executed_loops[ last_idx ] + accumulator[ last_idx ] );
+            last_idx = idx;
+        }
+        if( 0 == ( accumulator[ idx ] & LIVE_LOOPS_MASK ) ){
+            publish_loops( live, idx, b->executed_loops[ idx ] + accumulator[ idx ] );
+        }
+        to_be_shifted[ idx ] = ( to_be_shifted[ idx ] << shift_amount[ idx ] ) >> shift_amount[ idx ];
+    }
+    for( size_t k = 0; k < MAX_PHASES; k++ ){
+        b->phase_param[k][0] = to_be_shifted[k];    // forces the shifts to be executed, as
+                                                    // the results are externally visible.
+        b->executed_loops[k] += accumulator[k];
+    }
+    publish_executed_loops( b );
 }
 
 #define NR (size_t)( 1024ull * 1024ull * 1024ull )
-static uint64_t *R; // Shared across all abxor threads.
 
-void setup_abxor( void ){
+// One copy of the table per NUMA node with ABXOR threads, so that no thread
+// streams it across the socket interconnect.  Every replica holds the same
+// values (R[0] is the key) in the same order.
+struct abxor_replica{
+    unsigned int        node;
+    cpu_set_t           cpus;       // The ABXOR cpus on this node; the builder runs here.
+    uint64_t            *R;
+    const uint64_t      *source;    // Copy from here, or NULL to generate.
+    pthread_t           thread;
+};
+static struct abxor_replica *replicas;
+static size_t replica_count;
+
+static void* build_replica( void *v ){
+    struct abxor_replica *r = v;
+    assert( 0 == sched_setaffinity( 0, sizeof( cpu_set_t ), &( r->cpus ) ) );
     // Allocate page-aligned space for 1B uint64_t.
-    fprintf( stderr, "Starting random number generation...\n" );
-    assert( 0 == posix_memalign( (void**)(&R), sysconf(_SC_PAGESIZE), NR * sizeof(uint64_t) ) );
+    assert( 0 == posix_memalign( (void**)(&r->R), sysconf(_SC_PAGESIZE), NR * sizeof(uint64_t) ) );
+    bind_to_node( r->R, NR * sizeof(uint64_t), r->node );
+    if( r->source ){
+        memcpy( r->R, r->source, NR * sizeof(uint64_t) );
+        return NULL;
+    }
     for( size_t i = 0; i < NR; i++ ){
         // FIXME several ways to optimize this, but for now I'm still mad.
-        R[i] = // because random() returns a 64-bit integer containing 31 random bits.
+        r->R[i] = // because random() returns a 64-bit integer containing 31 random bits.
                   ((uint64_t)(random()))                        // bits  0-30
             | ( ( ((uint64_t)(random())) & 1ull ) << 31ull )    // bit     31
             | ( ( ((uint64_t)(random()))        ) << 32ull )    // bits 32-62
             | ( ( ((uint64_t)(random())) & 1ull ) << 63ull );   // bit     63
     }
+    return NULL;
+}
+
+void setup_abxor( struct job *job ){
+
+    // Group the ABXOR threads by node.
+    for( size_t i = 0; i < job->benchmark_count; i++ ){
+        struct benchmark_config *b = job->benchmarks[i];
+        if( b->benchmark_type != ABXOR ){
+            continue;
+        }
+        unsigned int cpu = get_next_cpu( 0, CPU_SETSIZE, &( b->execution_cpu ), NULL );
+        unsigned int node = cpu2node( cpu );
+        size_t r = 0;
+        while( r < replica_count && replicas[r].node != node ){
+            r++;
+        }
+        if( r == replica_count ){
+            replicas = reallocarray( replicas, ++replica_count, sizeof( struct abxor_replica ) );
+            assert( replicas );
+            memset( &replicas[r], 0, sizeof( struct abxor_replica ) );
+            replicas[r].node = node;
+        }
+        CPU_SET( cpu, &( replicas[r].cpus ) );
+    }
+    if( 0 == replica_count ){
+        return;
+    }
+
+    // random() is sequential, so the first replica is generated on its own
+    // and the rest are copied from it concurrently, each on its own node.
+    // Builders are threads so the main thread's affinity is left alone.
+    fprintf( stderr, "Starting random number generation...\n" );
+    assert( 0 == pthread_create( &( replicas[0].thread ), NULL, build_replica, &replicas[0] ) );
+    assert( 0 == pthread_join( replicas[0].thread, NULL ) );
     fprintf( stderr, "Random number generation complete.\n");
+    for( size_t r = 1; r < replica_count; r++ ){
+        replicas[r].source = replicas[0].R;
+        assert( 0 == pthread_create( &( replicas[r].thread ), NULL, build_replica, &replicas[r] ) );
+    }
+    for( size_t r = 1; r < replica_count; r++ ){
+        assert( 0 == pthread_join( replicas[r].thread, NULL ) );
+    }
+    if( replica_count > 1 ){
+        fprintf( stderr, "Replicated the ABXOR table on %zu nodes.\n", replica_count );
+    }
+
+    for( size_t i = 0; i < job->benchmark_count; i++ ){
+        struct benchmark_config *b = job->benchmarks[i];
+        if( b->benchmark_type != ABXOR ){
+            continue;
+        }
+        unsigned int node = cpu2node( get_next_cpu( 0, CPU_SETSIZE, &( b->execution_cpu ), NULL ) );
+        for( size_t r = 0; r < replica_count; r++ ){
+            if( replicas[r].node == node ){
+                b->abxor_table = replicas[r].R;
+            }
+        }
+    }
 }
 
 uint64_t local; // Make global so run_abxor has to use it.
 void run_abxor( struct benchmark_config *b ){
 
+    const uint64_t *R = b->abxor_table;    // This node's replica.
     b->key = R[0];
 
-    uint64_t accumulator[2] = {};
+    uint64_t accumulator[ MAX_PHASES ] = {};
     size_t Ridx = 1;    // 0 is for the key.
-    bool local_ab_selector = *(b->ab_selector);
-    for( ; ! (*(b->halt)); accumulator[local_ab_selector]++ ){
-        if( local_ab_selector != *(b->ab_selector) ){
-            local_ab_selector = *(b->ab_selector);
-            if( Ridx + b->benchmark_param1 < NR - b->benchmark_param1 ){
-                Ridx += b->benchmark_param1;
+    uint8_t local_phase = *(b->phase);
+    uint64_t words = b->phase_param[ local_phase ][0];
+    record_phase_observation( b );
+    publish_executed_loops( b );
+    const bool self_timed = b->cursor.selector;
+    _Atomic uint64_t *live = b->live_loops;
+    uint64_t countdown = b->check_loops;
+    for( ; ! (*(b->halt)); accumulator[local_phase]++ ){
+        if( self_timed && 0 == --countdown ){
+            countdown = b->check_loops;
+            advance_phase_cursor( &b->cursor );
+        }
+        if( local_phase != *(b->phase) ){
+            local_phase = *(b->phase);
+            record_phase_observation( b );
+            if( Ridx + words < NR - words ){
+                Ridx += words;
             }else{
                 Ridx = 1;
             }
+            words = b->phase_param[ local_phase ][0];
+            if( Ridx + words >= NR - words ){
+                Ridx = 1;
+            }
         }
         for( size_t i = 0; i < 1000; i++ ){
             local = 0;
-            for( uint64_t i = 0; i < b->benchmark_param1; i++ ){
+            for( uint64_t i = 0; i < words; i++ ){
                 local ^= R[ Ridx + i ];
             }
             local ^= R[ 0 ];
             b->single_output = local;
         }
+        // A thousand passes over the table dwarf one store.
+        publish_loops( live, local_phase, accumulator[ local_phase ] + 1 );
+    }
+    for( size_t k = 0; k < MAX_PHASES; k++ ){
+        b->executed_loops[k] = accumulator[k];
     }
-    b->executed_loops[0] = accumulator[0];
-    b->executed_loops[1] = accumulator[1];
+    publish_executed_loops( b );
 }
 
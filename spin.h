@@ -3,5 +3,5 @@
 
 void run_spin( struct benchmark_config *b );
 void run_abshift( struct benchmark_config *b );
-void setup_abxor( void );
+void setup_abxor( struct job *job );
 void run_abxor( struct benchmark_config *b );
@@ -0,0 +1,345 @@
+#define _GNU_SOURCE
+#include <stdio.h>          // printf(3), getline(3)
+#include <stdlib.h>         // exit(3), calloc(3)
+#include <string.h>         // strtok_r(3), strdup(3)
+#include <assert.h>         // assert(3)
+#include <errno.h>          // errno
+#include <fcntl.h>          // openat(2)
+#include <unistd.h>         // fchdir(2), close(2)
+#include <sys/stat.h>       // mkdirat(2)
+#include <inttypes.h>       // PRIx64
+#include "int_utils.h"      // safe_strtoull()
+#include "timespec_utils.h" // str2timespec()
+#include "options.h"        // create_hw_param()
+#include "sample_utils.h"   // poll_sample_capacity()
+#include "phase_utils.h"    // SEQUENCE_REPLAY, fill_phase_params()
+#include "sweep_utils.h"
+
+static bool timespec_less( const struct timespec *a, const struct timespec *b ){
+    return a->tv_sec < b->tv_sec || ( a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec );
+}
+
+static void set_sweep_param( struct sweep_trial *t, const char *name, const char *value, const char *spec ){
+    sweep_param_t p = 0;
+    while( p < NUM_SWEEP_PARAMS && strcmp( sweepparam2str[p], name ) ){
+        p++;
+    }
+    if( NUM_SWEEP_PARAMS == p ){
+        printf( "%s:%d:%s Unknown parameter (%s) in -w/--sweep (%s).\n", __FILE__, __LINE__, __func__, name, spec );
+        exit(-1);
+    }
+    if( '\0' == *value ){
+        printf( "%s:%d:%s Parameter (%s) in -w/--sweep (%s) has no value.\n", __FILE__, __LINE__, __func__, name, spec );
+        exit(-1);
+    }
+    char *v = strdup( value );
+    assert( v );
+    switch( p ){
+        case SWEEP_ABTIME:      str2timespec( v, &t->ab_duration );                 break;
+        case SWEEP_TIME:        str2timespec( v, &t->duration );                    break;
+        case SWEEP_INTERVAL:
+            str2timespec( v, &t->interval );
+            if( 0 == t->interval.tv_sec && 0 == t->interval.tv_nsec ){
+                printf( "%s:%d:%s Polling interval cannot be 0 (%s).\n", __FILE__, __LINE__, __func__, spec );
+                exit(-1);
+            }
+            break;
+        case SWEEP_PARAM1:
+        case SWEEP_PARAM2:      t->param[ p - SWEEP_PARAM1 ] = create_hw_param( v ); break;
+        case SWEEP_PARAM3:      t->param[2] = safe_strtoull( v );                   break;
+        default:                                                                    break;
+    }
+    free( t->values[p] );
+    t->values[p] = v;
+    t->set |= 1U << p;
+}
+
+static struct sweep_trial* add_trial( struct sweep *s ){
+    s->trials = reallocarray( s->trials, s->trial_count + 1, sizeof( struct sweep_trial ) );
+    assert( s->trials );
+    memset( &s->trials[ s->trial_count ], 0, sizeof( struct sweep_trial ) );
+    return &s->trials[ s->trial_count++ ];
+}
+
+static void parse_sweep_assignment( struct sweep_trial *t, char *token, const char *spec ){
+    char *value = strchr( token, '=' );
+    if( NULL == value ){
+        printf( "%s:%d:%s Expected <parameter>=<value>, not (%s), in -w/--sweep (%s).\n",
+                __FILE__, __LINE__, __func__, token, spec );
+        exit(-1);
+    }
+    *value++ = '\0';
+    set_sweep_param( t, token, value, spec );
+}
+
+static void parse_sweep_file( struct sweep *s, const char *filename ){
+    // One trial per line, as whitespace-separated <parameter>=<value>s.
+    // Everything after a # is ignored, and so are blank lines.
+    FILE *fp = fopen( filename, "r" );
+    if( NULL == fp ){
+        perror("");
+        printf( "%s:%d:%s Unable to open sweep file %s.\n", __FILE__, __LINE__, __func__, filename );
+        exit(-1);
+    }
+    char *line = NULL;
+    size_t len = 0;
+    while( -1 != getline( &line, &len, fp ) ){
+        char *comment = strchr( line, '#' );
+        if( comment ){
+            *comment = '\0';
+        }
+        char *saveptr = NULL;
+        char *token = strtok_r( line, " \t\r\n", &saveptr );
+        if( NULL == token ){
+            continue;
+        }
+        struct sweep_trial *t = add_trial( s );
+        for( ; token; token = strtok_r( NULL, " \t\r\n", &saveptr ) ){
+            parse_sweep_assignment( t, token, filename );
+        }
+    }
+    free( line );
+    fclose( fp );
+}
+
+static void parse_sweep_list( struct sweep *s, const char *spec ){
+    // <parameter>=<value>[,<value>...][/<parameter>=<value>[,<value>...]...]
+    // is every combination, the last parameter changing fastest.
+    char *local_spec = strdup( spec );
+    assert( local_spec );
+    char *names[ NUM_SWEEP_PARAMS ];
+    char **values[ NUM_SWEEP_PARAMS ];
+    size_t value_count[ NUM_SWEEP_PARAMS ];
+    size_t axis_count = 0, trial_count = 1;
+
+    char *saveptr = NULL;
+    for( char *axis = strtok_r( local_spec, "/", &saveptr ); axis; axis = strtok_r( NULL, "/", &saveptr ) ){
+        if( NUM_SWEEP_PARAMS == axis_count ){
+            printf( "%s:%d:%s Too many parameters in -w/--sweep (%s).\n", __FILE__, __LINE__, __func__, spec );
+            exit(-1);
+        }
+        char *list = strchr( axis, '=' );
+        if( NULL == list ){
+            printf( "%s:%d:%s Expected <parameter>=<values>, not (%s), in -w/--sweep (%s).\n",
+                    __FILE__, __LINE__, __func__, axis, spec );
+            exit(-1);
+        }
+        *list++ = '\0';
+        names[ axis_count ] = axis;
+        values[ axis_count ] = NULL;
+        value_count[ axis_count ] = 0;
+        char *saveptr2 = NULL;
+        for( char *v = strtok_r( list, ",", &saveptr2 ); v; v = strtok_r( NULL, ",", &saveptr2 ) ){
+            values[ axis_count ] = reallocarray( values[ axis_count ], value_count[ axis_count ] + 1, sizeof( char* ) );
+            assert( values[ axis_count ] );
+            values[ axis_count ][ value_count[ axis_count ]++ ] = v;
+        }
+        if( 0 == value_count[ axis_count ] ){
+            printf( "%s:%d:%s Parameter (%s) in -w/--sweep (%s) has no values.\n", __FILE__, __LINE__, __func__, axis, spec );
+            exit(-1);
+        }
+        trial_count *= value_count[ axis_count ];
+        axis_count++;
+    }
+
+    for( size_t k = 0; k < trial_count; k++ ){
+        struct sweep_trial *t = add_trial( s );
+        size_t idx = k;
+        for( size_t a = axis_count; a-- > 0; ){
+            set_sweep_param( t, names[a], values[a][ idx % value_count[a] ], spec );
+            idx /= value_count[a];
+        }
+    }
+    for( size_t a = 0; a < axis_count; a++ ){
+        free( values[a] );
+    }
+    free( local_spec );
+}
+
+static void write_sweep_summary( const struct sweep *s ){
+    // "-" is the command line's value.
+    FILE *fp = fopen( "sweep.out", "w" );
+    assert( NULL != fp );
+    fprintf( fp, "trial\tdirectory" );
+    for( sweep_param_t p = 0; p < NUM_SWEEP_PARAMS; p++ ){
+        fprintf( fp, "\t%s", sweepparam2str[p] );
+    }
+    fprintf( fp, "\n" );
+    for( size_t k = 0; k < s->trial_count; k++ ){
+        fprintf( fp, "%zu\ttrial_%03zu", k, k );
+        for( sweep_param_t p = 0; p < NUM_SWEEP_PARAMS; p++ ){
+            fprintf( fp, "\t%s", s->trials[k].values[p] ? s->trials[k].values[p] : "-" );
+        }
+        fprintf( fp, "\n" );
+    }
+    fclose( fp );
+}
+
+void setup_sweep( struct job *job ){
+    job->trial_count = 1;
+    if( NULL == job->sweep_spec ){
+        return;
+    }
+    struct sweep *s = calloc( 1, sizeof( struct sweep ) );
+    assert( s );
+    if( '@' == job->sweep_spec[0] ){
+        parse_sweep_file( s, &job->sweep_spec[1] );
+    }else{
+        parse_sweep_list( s, job->sweep_spec );
+    }
+    if( 0 == s->trial_count ){
+        printf( "%s:%d:%s No trials in -w/--sweep (%s).\n", __FILE__, __LINE__, __func__, job->sweep_spec );
+        exit(-1);
+    }
+
+    // Remember the command line's values...
+    s->ab_duration = job->ab_duration;
+    s->duration    = job->duration;
+    s->interval    = calloc( job->poll_count + 1, sizeof( struct timespec ) );
+    s->param       = calloc( job->benchmark_count + 1, sizeof( uint64_t[ MAX_PHASES ][3] ) );
+    assert( s->interval && s->param );
+    for( size_t i = 0; i < job->poll_count; i++ ){
+        s->interval[i] = job->polls[i]->interval;
+    }
+    for( size_t i = 0; i < job->benchmark_count; i++ ){
+        memcpy( s->param[i], job->benchmarks[i]->phase_param, sizeof( s->param[i] ) );
+    }
+
+    // ...then leave the job at the envelope of all the trials, so that
+    // everything sized from it during setup fits any one of them.
+    for( size_t k = 0; k < s->trial_count; k++ ){
+        const struct sweep_trial *t = &s->trials[k];
+        if( ( t->set & ( 1U << SWEEP_INTERVAL ) ) && 0 == job->poll_count ){
+            printf( "%s:%d:%s -w/--sweep sets interval, but there are no polls.\n", __FILE__, __LINE__, __func__ );
+            exit(-1);
+        }
+        if( ( t->set & ( ( 1U << SWEEP_PARAM1 ) | ( 1U << SWEEP_PARAM2 ) | ( 1U << SWEEP_PARAM3 ) ) ) && 0 == job->benchmark_count ){
+            printf( "%s:%d:%s -w/--sweep sets a benchmark parameter, but there are no benchmarks.\n", __FILE__, __LINE__, __func__ );
+            exit(-1);
+        }
+        if( ( t->set & ( ( 1U << SWEEP_TIME ) | ( 1U << SWEEP_ABTIME ) ) ) && SEQUENCE_REPLAY == job->schedule->sequence ){
+            printf( "%s:%d:%s -w/--sweep can't set time or abTime when replaying a schedule.\n", __FILE__, __LINE__, __func__ );
+            exit(-1);
+        }
+        if( ( t->set & ( 1U << SWEEP_TIME ) ) && timespec_less( &job->duration, &t->duration ) ){
+            job->duration = t->duration;
+        }
+        if( ( t->set & ( 1U << SWEEP_ABTIME ) ) && timespec_less( &t->ab_duration, &job->ab_duration ) ){
+            job->ab_duration = t->ab_duration;
+        }
+        for( size_t i = 0; i < job->poll_count; i++ ){
+            if( job->polls[i]->auto_interval ){
+                continue;
+            }
+            if( ( t->set & ( 1U << SWEEP_INTERVAL ) ) && timespec_less( &t->interval, &job->polls[i]->interval ) ){
+                job->polls[i]->interval = t->interval;
+            }
+        }
+    }
+
+    s->dir_fd = open( ".", O_RDONLY | O_DIRECTORY );
+    assert( -1 != s->dir_fd );
+    write_sweep_summary( s );
+    job->sweep       = s;
+    job->trial_count = s->trial_count;
+    fprintf( stderr, "%s:%d:%s %zu sweep trials.\n", __FILE__, __LINE__, __func__, s->trial_count );
+}
+
+void apply_sweep_trial( struct job *job, size_t k ){
+    // Everything a trial doesn't set goes back to the command line's value;
+    // ABSHIFT overwrites its parameters, for one.
+    struct sweep *s = job->sweep;
+    if( NULL == s ){
+        return;
+    }
+    const struct sweep_trial *t = &s->trials[k];
+    job->ab_duration = ( t->set & ( 1U << SWEEP_ABTIME ) ) ? t->ab_duration : s->ab_duration;
+    job->duration    = ( t->set & ( 1U << SWEEP_TIME   ) ) ? t->duration    : s->duration;
+    for( size_t i = 0; i < job->poll_count; i++ ){
+        struct poll_config *p = job->polls[i];
+        if( !p->auto_interval ){    // That one stays at the measured period.
+            p->interval = ( t->set & ( 1U << SWEEP_INTERVAL ) ) ? t->interval : s->interval[i];
+        }
+        // No larger than the envelope total_ops the samples were allocated for.
+        p->total_ops = poll_sample_capacity( &job->duration, p );
+    }
+    for( size_t i = 0; i < job->benchmark_count; i++ ){
+        struct benchmark_config *b = job->benchmarks[i];
+        // A trial's value goes to every phase.
+        for( size_t k = 0; k < MAX_PHASES; k++ ){
+            for( size_t j = 0; j < 3; j++ ){
+                b->phase_param[k][j] = ( t->set & ( 1U << ( SWEEP_PARAM1 + j ) ) ) ? t->param[j] : s->param[i][k][j];
+            }
+        }
+    }
+    fill_phase_params( job );
+}
+
+void enter_sweep_trial( struct job *job, size_t k ){
+    // Make trial_<k>/ the working directory and start its job.out with the
+    // values this trial ran with; print_summary() appends the rest.
+    struct sweep *s = job->sweep;
+    if( NULL == s ){
+        return;
+    }
+    static char dirname[64];
+    snprintf( dirname, sizeof( dirname ), "trial_%03zu", k );
+    if( -1 == mkdirat( s->dir_fd, dirname, 0755 ) && EEXIST != errno ){
+        perror("");
+        fprintf( stderr, "%s:%d:%s Unable to create %s.  Bye!\n", __FILE__, __LINE__, __func__, dirname );
+        exit(-1);
+    }
+    int fd = openat( s->dir_fd, dirname, O_RDONLY | O_DIRECTORY );
+    if( -1 == fd || -1 == fchdir( fd ) ){
+        perror("");
+        fprintf( stderr, "%s:%d:%s Unable to change to %s.  Bye!\n", __FILE__, __LINE__, __func__, dirname );
+        exit(-1);
+    }
+    close( fd );
+
+    FILE *fp = fopen( "job.out", "w" );
+    assert( NULL != fp );
+    fprintf( fp, "# Sweep trial %zu of %zu; ../job.out has the rest of the options.\n", k + 1, s->trial_count );
+    fprintf(          fp, "#\t%-20s", "duration: " );
+    fprintf_timespec( fp, &job->duration );
+    fprintf(          fp, "\n#\t%-20s", "a|b duration: " );
+    fprintf_timespec( fp, &job->ab_duration );
+    fprintf(          fp, "\n" );
+    for( size_t i = 0; i < job->poll_count; i++ ){
+        fprintf(          fp, "#\tpoll %zu %-13s", i + 1, "interval: " );
+        fprintf_timespec( fp, &job->polls[i]->interval );
+        fprintf(          fp, "\n" );
+    }
+    for( size_t i = 0; i < job->benchmark_count; i++ ){
+        fprintf( fp, "#\tbenchmark %zu parameters:  ", i + 1 );
+        fprintf_phase_params( fp, job, job->benchmarks[i] );
+        fprintf( fp, "\n" );
+    }
+    fprintf( fp, "#\n" );
+    fclose( fp );
+}
+
+void leave_sweep_trial( struct job *job ){
+    if( NULL == job->sweep ){
+        return;
+    }
+    assert( 0 == fchdir( job->sweep->dir_fd ) );
+}
+
+void teardown_sweep( struct job *job ){
+    struct sweep *s = job->sweep;
+    if( NULL == s ){
+        return;
+    }
+    for( size_t k = 0; k < s->trial_count; k++ ){
+        for( sweep_param_t p = 0; p < NUM_SWEEP_PARAMS; p++ ){
+            free( s->trials[k].values[p] );
+        }
+    }
+    free( s->trials );
+    free( s->interval );
+    free( s->param );
+    close( s->dir_fd );
+    free( s );
+    job->sweep = NULL;
+}
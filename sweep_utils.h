@@ -0,0 +1,42 @@
+#pragma once
+#include <stdint.h>
+#include <time.h>
+#include "job.h"
+
+// -w/--sweep runs the job once per trial, back to back, in one process:  the
+// poll and benchmark threads, the ABXOR table, the batches and the sample
+// buffers are set up once and reused.  A trial may set any of the parameters
+// below; everything else, including thread counts and cpus, comes from the
+// command line.  Buffers are sized for the longest trial at the shortest
+// intervals.  Trial <k>'s output goes in trial_<k>/, and sweep.out lists what
+// each trial set.
+
+typedef enum{                                 SWEEP_ABTIME, SWEEP_TIME, SWEEP_INTERVAL, SWEEP_PARAM1, SWEEP_PARAM2, SWEEP_PARAM3, NUM_SWEEP_PARAMS } sweep_param_t;
+static const char * const sweepparam2str[] = { "abTime",     "time",     "interval",     "param1",     "param2",     "param3"                       };
+
+struct sweep_trial{
+    uint32_t                    set;                        // 1 << sweep_param_t for each parameter given.
+    char                        *values[ NUM_SWEEP_PARAMS ];// As given, for sweep.out.
+    struct timespec             ab_duration;
+    struct timespec             duration;
+    struct timespec             interval;                   // Every poll without an auto interval.
+    uint64_t                    param[3];                   // Every benchmark.
+};
+
+struct sweep{
+    size_t                      trial_count;
+    struct sweep_trial          *trials;
+    int                         dir_fd;                     // Where trial_<k>/ are made.
+
+    // The command line's values, for whatever a trial leaves unset.
+    struct timespec             ab_duration;
+    struct timespec             duration;
+    struct timespec             *interval;                  // Per poll.
+    uint64_t                    (*param)[ MAX_PHASES ][3];  // Per benchmark, per phase.
+};
+
+void setup_sweep( struct job *job );
+void apply_sweep_trial( struct job *job, size_t t );
+void enter_sweep_trial( struct job *job, size_t t );
+void leave_sweep_trial( struct job *job );
+void teardown_sweep( struct job *job );
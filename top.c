@@ -0,0 +1,196 @@
+// var-top:  watch a run started with var -L/--live.
+#define _GNU_SOURCE
+#include <stdio.h>          // printf(3)
+#include <stdlib.h>         // exit(3), calloc(3)
+#include <stdint.h>         // uint64_t etc.
+#include <inttypes.h>       // PRIu64 etc.
+#include <string.h>         // memcmp(3)
+#include <time.h>           // nanosleep(2), clock_gettime(2)
+#include <fcntl.h>          // O_RDONLY
+#include <unistd.h>         // close(2)
+#include <errno.h>          // errno
+#include <signal.h>         // kill(2)
+#include <sys/mman.h>       // shm_open(3), mmap(2)
+#include <sys/stat.h>       // fstat(2)
+#include <assert.h>         // assert(3)
+#include <x86intrin.h>      // __rdtsc()
+#include "timespec_utils.h" // str2timespec()
+#include "msr_utils.h"      // OP_THERM, OP_PTHERM
+#include "live_utils.h"
+
+static const char usage[] =
+    "Usage:  var-top <name> [<timespec>]\n"
+    "  Attach to the shared memory object <name> published by var -L and,\n"
+    "  every <timespec> (default 1s), print the a|b phase, each benchmark's\n"
+    "  loops per phase and loop rate and, for each poll, the sample rate,\n"
+    "  watts (energy counters only) and the temperature (OP_THERM/OP_PTHERM\n"
+    "  only).  Exits when the run does, or when var has gone away.\n";
+
+static struct live_header* attach_live( const char *name ){
+    int fd = shm_open( name, O_RDONLY, 0 );
+    if( -1 == fd ){
+        perror("");
+        fprintf( stderr, "%s:%d:%s Unable to open shared memory object %s.  Bye!\n", __FILE__, __LINE__, __func__, name );
+        exit(-1);
+    }
+    struct stat st;
+    assert( 0 == fstat( fd, &st ) );
+    if( (size_t)st.st_size < sizeof( struct live_header ) ){
+        fprintf( stderr, "%s:%d:%s %s is too small to be a var live object.  Bye!\n", __FILE__, __LINE__, __func__, name );
+        exit(-1);
+    }
+    struct live_header *h = mmap( NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+    if( MAP_FAILED == h ){
+        perror("");
+        fprintf( stderr, "%s:%d:%s Unable to map %s.  Bye!\n", __FILE__, __LINE__, __func__, name );
+        exit(-1);
+    }
+    close( fd );
+    if( 0 != memcmp( h->magic, LIVE_MAGIC, sizeof( LIVE_MAGIC ) ) || LIVE_VERSION != h->version ){
+        fprintf( stderr, "%s:%d:%s %s is not a version %"PRIu32" var live object.  Bye!\n",
+                __FILE__, __LINE__, __func__, name, LIVE_VERSION );
+        exit(-1);
+    }
+    atomic_thread_fence( memory_order_acquire );
+    if( h->poll_offset + (uint64_t)h->poll_count * h->poll_stride > (uint64_t)st.st_size ){
+        fprintf( stderr, "%s:%d:%s %s is truncated.  Bye!\n", __FILE__, __LINE__, __func__, name );
+        exit(-1);
+    }
+    return h;
+}
+
+static void read_live_status( const struct live_header *h, struct live_header *status, uint64_t *observed ){
+    // Seqlock read; the main thread only writes a few times a second.
+    for(;;){
+        uint64_t seq = atomic_load_explicit( &h->seq, memory_order_acquire );
+        if( seq & 1 ){
+            continue;
+        }
+        status->start_tsc         = h->start_tsc;
+        status->phase_tsc         = h->phase_tsc;
+        status->phase_transitions = h->phase_transitions;
+        status->phase             = h->phase;
+        status->halted            = h->halted;
+        for( uint32_t b = 0; b < h->benchmark_count; b++ ){
+            observed[b] = h->observed[b];
+        }
+        atomic_thread_fence( memory_order_acquire );
+        if( seq == atomic_load_explicit( &h->seq, memory_order_relaxed ) ){
+            return;
+        }
+    }
+}
+
+static bool read_newest_sample( const struct live_poll *p, struct live_slot *s ){
+    // The poll thread may lap us between reading head and reading the slot;
+    // just try again with the new head.
+    for( int attempt = 0; attempt < 8; attempt++ ){
+        uint64_t head = atomic_load_explicit( &p->head, memory_order_acquire );
+        if( 0 == head ){
+            return false;
+        }
+        if( read_live_sample( p, head - 1, s ) ){
+            return true;
+        }
+    }
+    return false;
+}
+
+static double now( void ){
+    struct timespec t;
+    clock_gettime( CLOCK_MONOTONIC, &t );
+    return (double)t.tv_sec + 1e-9 * (double)t.tv_nsec;
+}
+
+int main( int argc, char **argv ){
+    if( argc < 2 || argc > 3 || 0 == strcmp( argv[1], "-h" ) ){
+        printf( "%s", usage );
+        exit( argc < 2 ? -1 : 0 );
+    }
+    struct timespec interval = { .tv_sec = 1, .tv_nsec = 0 };
+    if( 3 == argc ){
+        str2timespec( argv[2], &interval );
+    }
+
+    const struct live_header *h = attach_live( argv[1] );
+    printf( "# var pid %"PRIu64", %"PRIu32" polls, %"PRIu32" benchmarks, TSC %.3f GHz\n",
+            h->pid, h->poll_count, h->benchmark_count, h->tsc_hz / 1e9 );
+
+    struct live_header status;
+    uint64_t *observed   = calloc( h->benchmark_count + 1, sizeof( uint64_t ) );
+    uint64_t *last_loops = calloc( h->benchmark_count + 1, sizeof( uint64_t ) );
+    uint64_t *last_head  = calloc( h->poll_count + 1, sizeof( uint64_t ) );
+    struct live_slot *last = calloc( h->poll_count + 1, sizeof( struct live_slot ) );
+    bool *have_last      = calloc( h->poll_count + 1, sizeof( bool ) );
+    assert( observed && last_loops && last_head && last && have_last );
+    double last_wall = now();
+
+    do{
+        nanosleep( &interval, NULL );
+        double wall = now();
+        read_live_status( h, &status, observed );
+
+        double elapsed = status.start_tsc ? (double)( __rdtsc() - status.start_tsc ) / (double)h->tsc_hz : 0.0;
+        printf( "%8.1fs/%.0fs  phase %c  transitions %"PRIu64"\n", elapsed, h->duration_ns / 1e9,
+                status.start_tsc ? (char)( 'A' + status.phase ) : '-', status.phase_transitions );
+
+        for( uint32_t b = 0; b < h->benchmark_count; b++ ){
+            // Each count is stored whole, so no seqlock; the row may just lag.
+            const _Atomic uint64_t *loops = get_live_loops( h, b );
+            uint64_t total = 0;
+            printf( "  benchmark %-3"PRIu32" seen %-6"PRIu64" loops", b, observed[b] );
+            for( uint64_t k = 0; k < h->phases && k < MAX_PHASES; k++ ){
+                uint64_t n = atomic_load_explicit( &loops[k], memory_order_relaxed );
+                printf( "  %c %"PRIu64, (char)( 'A' + k ), n );
+                total += n;
+            }
+            // A new -w/--sweep trial starts the counts over.
+            printf( "  %12.0f loops/s\n", total >= last_loops[b] ? ( total - last_loops[b] ) / ( wall - last_wall ) : 0.0 );
+            last_loops[b] = total;
+        }
+
+        for( uint32_t i = 0; i < h->poll_count; i++ ){
+            const struct live_poll *p = get_live_poll( h, i );
+            uint64_t head = atomic_load_explicit( &p->head, memory_order_acquire );
+            printf( "  poll %"PRIu32" %#06"PRIx32" cpu %-4"PRIu16" %9.0f samples/s",
+                    i, p->msr, p->cpu, ( head - last_head[i] ) / ( wall - last_wall ) );
+            last_head[i] = head;
+
+            struct live_slot s;
+            if( !read_newest_sample( p, &s ) ){
+                printf( "\n" );
+                continue;
+            }
+            if( p->joules_per_count > 0.0 && have_last[i] && s.tsc > last[i].tsc ){
+                uint64_t counts = s.msrdata - last[i].msrdata;
+                if( p->wrap && s.msrdata < last[i].msrdata ){
+                    counts += p->wrap;
+                }
+                printf( "  %8.2f W", counts * p->joules_per_count / ( (double)( s.tsc - last[i].tsc ) / (double)h->tsc_hz ) );
+            }else if( p->joules_per_count <= 0.0 ){
+                printf( "  msrdata %#"PRIx64, s.msrdata );
+            }
+            // Bits 22:16 are degrees C below TjMax.
+            if( p->flags & OP_THERM ){
+                printf( "  core TjMax-%"PRIu64"C", ( s.therm >> 16 ) & 0x7f );
+            }
+            if( p->flags & OP_PTHERM ){
+                printf( "  package TjMax-%"PRIu64"C", ( s.ptherm >> 16 ) & 0x7f );
+            }
+            printf( "\n" );
+            last[i] = s;
+            have_last[i] = true;
+        }
+        last_wall = wall;
+        fflush( stdout );
+
+        // var may have died without ever setting halted.
+        if( !status.halted && -1 == kill( (pid_t)h->pid, 0 ) && ESRCH == errno ){
+            fprintf( stderr, "%s:%d:%s var (pid %"PRIu64") exited without finishing the run.  Bye!\n",
+                    __FILE__, __LINE__, __func__, h->pid );
+            exit(-1);
+        }
+    }while( !status.halted );
+
+    return 0;
+}
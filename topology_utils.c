@@ -0,0 +1,320 @@
+#define _GNU_SOURCE
+#include <stdio.h>          // fopen(3), fscanf(3)
+#include <stdlib.h>         // exit(3), calloc(3)
+#include <string.h>         // strcspn(3)
+#include <ctype.h>          // isdigit(3)
+#include <assert.h>         // assert(3)
+#include <sched.h>          // cpu_set_t
+#include <dirent.h>         // opendir(3), readdir(3)
+#include "cpuset_utils.h"   // str2cpuset()
+#include "topology_utils.h"
+
+// Everything below is read once from <sysfs_root>/devices/system/cpu (plus
+// <sysfs_root>/devices/system/node and <sysfs_root>/devices/cpu_atom) the
+// first time it's needed.
+struct cpu_topology{
+    unsigned int    package;
+    unsigned int    die;
+    unsigned int    core;
+    unsigned int    node;       // NUMA node; 0 if the kernel has no NUMA support.
+    cpu_set_t       siblings;   // SMT siblings, including this cpu.
+};
+
+static const char           *sysfs_root = "/sys";
+static bool                 topology_initialized;
+static cpu_set_t            online_cpus;
+static cpu_set_t            isolated_cpus;
+static cpu_set_t            nohz_full_cpus;
+static cpu_set_t            atom_cpus;
+static struct cpu_topology  *topology;      // CPU_SETSIZE entries; only online cpus are filled in.
+
+// auto placement, computed on first use.
+static bool                 placement_initialized;
+static cpu_set_t            auto_measured_cpus;
+static unsigned int         *auto_control_cores;   // One cpu per control core.
+static size_t               auto_control_core_count;
+static size_t               auto_control_next;
+
+static bool read_cpulist( const char *filename, cpu_set_t *cpus ){
+    // Missing files and empty lists both leave cpus empty.
+    static char cpulist[4096];
+    CPU_ZERO( cpus );
+    FILE *fp = fopen( filename, "r" );
+    if( NULL == fp ){
+        return false;
+    }
+    if( NULL != fgets( cpulist, sizeof( cpulist ), fp ) ){
+        cpulist[ strcspn( cpulist, "\n" ) ] = '\0';
+        // An empty nohz_full reads as "(null)" on some kernels.
+        if( isdigit( (unsigned char)cpulist[0] ) ){
+            str2cpuset( cpulist, cpus );
+        }
+    }
+    fclose( fp );
+    return true;
+}
+
+static bool read_cpu_uint( unsigned int cpu, const char *field, unsigned int *value ){
+    static char filename[2048];
+    snprintf( filename, 2047, "%s/devices/system/cpu/cpu%u/topology/%s", sysfs_root, cpu, field );
+    FILE *fp = fopen( filename, "r" );
+    if( NULL == fp ){
+        return false;
+    }
+    bool ok = ( 1 == fscanf( fp, "%u", value ) );
+    fclose( fp );
+    return ok;
+}
+
+static void read_topology( void ){
+    if( topology_initialized ){
+        return;
+    }
+    topology_initialized = true;
+    topology = calloc( CPU_SETSIZE, sizeof( struct cpu_topology ) );
+    assert( topology );
+
+    static char filename[2048];
+    snprintf( filename, 2047, "%s/devices/system/cpu/online", sysfs_root );
+    if( !read_cpulist( filename, &online_cpus ) || 0 == CPU_COUNT( &online_cpus ) ){
+        fprintf( stderr, "%s:%d:%s Unable to read the online cpus from %s.  Bye!\n",
+                __FILE__, __LINE__, __func__, filename );
+        exit(-1);
+    }
+    snprintf( filename, 2047, "%s/devices/system/cpu/isolated", sysfs_root );
+    read_cpulist( filename, &isolated_cpus );
+    snprintf( filename, 2047, "%s/devices/system/cpu/nohz_full", sysfs_root );
+    read_cpulist( filename, &nohz_full_cpus );
+    // /sys/devices/cpu_atom only exists on hybrid parts.
+    snprintf( filename, 2047, "%s/devices/cpu_atom/cpus", sysfs_root );
+    read_cpulist( filename, &atom_cpus );
+
+    for( unsigned int cpu = 0; cpu < CPU_SETSIZE; cpu++ ){
+        if( !CPU_ISSET( cpu, &online_cpus ) ){
+            continue;
+        }
+        struct cpu_topology *t = &( topology[ cpu ] );
+        if( !read_cpu_uint( cpu, "physical_package_id", &t->package ) || !read_cpu_uint( cpu, "core_id", &t->core ) ){
+            fprintf( stderr, "%s:%d:%s Unable to read the package and core ids of cpu %u under %s/devices/system/cpu.  Bye!\n",
+                    __FILE__, __LINE__, __func__, cpu, sysfs_root );
+            exit(-1);
+        }
+        // die_id appeared in 5.2; older kernels have one die per package.
+        if( !read_cpu_uint( cpu, "die_id", &t->die ) ){
+            t->die = 0;
+        }
+        // core_cpus_list replaced thread_siblings_list in 5.7.
+        snprintf( filename, 2047, "%s/devices/system/cpu/cpu%u/topology/core_cpus_list", sysfs_root, cpu );
+        if( !read_cpulist( filename, &t->siblings ) ){
+            snprintf( filename, 2047, "%s/devices/system/cpu/cpu%u/topology/thread_siblings_list", sysfs_root, cpu );
+            read_cpulist( filename, &t->siblings );
+        }
+        CPU_SET( cpu, &t->siblings );
+    }
+
+    // Each <sysfs_root>/devices/system/node/node<N>/cpulist names its cpus.
+    snprintf( filename, 2047, "%s/devices/system/node", sysfs_root );
+    DIR *dir = opendir( filename );
+    for( struct dirent *d = dir ? readdir( dir ) : NULL; d; d = readdir( dir ) ){
+        unsigned int node;
+        if( 1 != sscanf( d->d_name, "node%u", &node ) ){
+            continue;
+        }
+        static char cpulist_filename[2048];
+        cpu_set_t node_cpus;
+        snprintf( cpulist_filename, 2047, "%s/devices/system/node/%s/cpulist", sysfs_root, d->d_name );
+        read_cpulist( cpulist_filename, &node_cpus );
+        for( unsigned int cpu = 0; cpu < CPU_SETSIZE; cpu++ ){
+            if( CPU_ISSET( cpu, &node_cpus ) ){
+                topology[ cpu ].node = node;
+            }
+        }
+    }
+    if( dir ){
+        closedir( dir );
+    }
+}
+
+void set_sysfs_root( const char *root ){
+    // Must be called before anything reads the topology.
+    if( topology_initialized ){
+        printf( "%s:%d:%s -s/--sysfsRoot must precede options that read the topology.\n", __FILE__, __LINE__, __func__ );
+        exit(-1);
+    }
+    sysfs_root = root;
+}
+
+const char * get_sysfs_root( void ){
+    return sysfs_root;
+}
+
+void get_online_cpus( cpu_set_t *cpus ){
+    read_topology();
+    *cpus = online_cpus;
+}
+
+void get_isolated_cpus( cpu_set_t *cpus ){
+    read_topology();
+    *cpus = isolated_cpus;
+}
+
+void get_nohz_full_cpus( cpu_set_t *cpus ){
+    read_topology();
+    *cpus = nohz_full_cpus;
+}
+
+bool cpu_is_online( unsigned int cpu ){
+    read_topology();
+    return cpu < CPU_SETSIZE && CPU_ISSET( cpu, &online_cpus );
+}
+
+static const struct cpu_topology * cpu2topology( unsigned int cpu, const char *caller ){
+    if( !cpu_is_online( cpu ) ){
+        fprintf( stderr, "%s:%d:%s cpu %u is not online according to %s/devices/system/cpu/online.  Bye!\n",
+                __FILE__, __LINE__, caller, cpu, sysfs_root );
+        exit(-1);
+    }
+    return &( topology[ cpu ] );
+}
+
+unsigned int cpu2package( unsigned int cpu ){
+    return cpu2topology( cpu, __func__ )->package;
+}
+
+unsigned int cpu2die( unsigned int cpu ){
+    return cpu2topology( cpu, __func__ )->die;
+}
+
+unsigned int cpu2core( unsigned int cpu ){
+    return cpu2topology( cpu, __func__ )->core;
+}
+
+unsigned int cpu2node( unsigned int cpu ){
+    return cpu2topology( cpu, __func__ )->node;
+}
+
+void get_core_siblings( unsigned int cpu, cpu_set_t *siblings ){
+    *siblings = cpu2topology( cpu, __func__ )->siblings;
+}
+
+cpu_type_t cpu2type( unsigned int cpu ){
+    read_topology();
+    return CPU_ISSET( cpu, &atom_cpus ) ? CPU_TYPE_ATOM : CPU_TYPE_CORE;
+}
+
+bool cpusets_share_core( cpu_set_t *a, cpu_set_t *b ){
+    read_topology();
+    for( unsigned int cpu = 0; cpu < CPU_SETSIZE; cpu++ ){
+        if( CPU_ISSET( cpu, a ) && CPU_ISSET( cpu, &online_cpus ) ){
+            cpu_set_t both;
+            CPU_AND( &both, &( topology[ cpu ].siblings ), b );
+            if( CPU_COUNT( &both ) ){
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static void add_core_siblings( cpu_set_t *cpus ){
+    // Grow cpus to whole cores.
+    cpu_set_t grown;
+    CPU_ZERO( &grown );
+    for( unsigned int cpu = 0; cpu < CPU_SETSIZE; cpu++ ){
+        if( CPU_ISSET( cpu, cpus ) ){
+            CPU_OR( &grown, &grown, &( topology[ cpu ].siblings ) );
+        }
+    }
+    *cpus = grown;
+}
+
+static void compute_auto_placement( void ){
+    if( placement_initialized ){
+        return;
+    }
+    placement_initialized = true;
+    read_topology();
+
+    // The measured package is the one with the most isolated cpus.  Ties go
+    // to the highest package id, as package 0 usually carries the
+    // housekeeping work (and all of it when nothing is isolated).
+    unsigned int best_package = 0;
+    int best_isolated = -1;
+    for( unsigned int cpu = 0; cpu < CPU_SETSIZE; cpu++ ){
+        if( !CPU_ISSET( cpu, &online_cpus ) ){
+            continue;
+        }
+        unsigned int package = topology[ cpu ].package;
+        int isolated = 0;
+        for( unsigned int c = 0; c < CPU_SETSIZE; c++ ){
+            if( CPU_ISSET( c, &online_cpus ) && topology[c].package == package && CPU_ISSET( c, &isolated_cpus ) ){
+                isolated++;
+            }
+        }
+        if( isolated > best_isolated || ( isolated == best_isolated && package > best_package ) ){
+            best_package = package;
+            best_isolated = isolated;
+        }
+    }
+
+    // Benchmarks fill the measured package:  its isolated cpus, or all of it.
+    CPU_ZERO( &auto_measured_cpus );
+    for( unsigned int cpu = 0; cpu < CPU_SETSIZE; cpu++ ){
+        if( CPU_ISSET( cpu, &online_cpus ) && topology[ cpu ].package == best_package
+                && ( 0 == best_isolated || CPU_ISSET( cpu, &isolated_cpus ) ) ){
+            CPU_SET( cpu, &auto_measured_cpus );
+        }
+    }
+
+    // Control threads get whole cores that share nothing with the measured
+    // cpus, preferably on another package.
+    cpu_set_t measured_cores = auto_measured_cpus, control, other_package;
+    add_core_siblings( &measured_cores );
+    CPU_XOR( &control, &online_cpus, &measured_cores );
+    CPU_AND( &control, &control, &online_cpus );
+    CPU_ZERO( &other_package );
+    for( unsigned int cpu = 0; cpu < CPU_SETSIZE; cpu++ ){
+        if( CPU_ISSET( cpu, &control ) && topology[ cpu ].package != best_package ){
+            CPU_SET( cpu, &other_package );
+        }
+    }
+    if( CPU_COUNT( &other_package ) ){
+        control = other_package;
+    }
+    if( 0 == CPU_COUNT( &control ) ){
+        // A single package with nothing isolated:  give up the first core.
+        unsigned int first = get_next_cpu( 0, CPU_SETSIZE, &auto_measured_cpus, NULL );
+        control = topology[ first ].siblings;
+        CPU_AND( &control, &control, &online_cpus );
+        CPU_XOR( &auto_measured_cpus, &auto_measured_cpus, &control );
+        CPU_AND( &auto_measured_cpus, &auto_measured_cpus, &online_cpus );
+    }
+    if( 0 == CPU_COUNT( &auto_measured_cpus ) ){
+        fprintf( stderr, "%s:%d:%s auto placement needs at least two cores.  Bye!\n",
+                __FILE__, __LINE__, __func__ );
+        exit(-1);
+    }
+
+    // One cpu per control core; main gets the first, polls and snapshots the
+    // rest, wrapping around if there are more of them than cores.
+    auto_control_cores = calloc( CPU_COUNT( &control ), sizeof( unsigned int ) );
+    assert( auto_control_cores );
+    cpu_set_t taken;
+    CPU_ZERO( &taken );
+    for( unsigned int cpu = 0; cpu < CPU_SETSIZE; cpu++ ){
+        if( CPU_ISSET( cpu, &control ) && !CPU_ISSET( cpu, &taken ) ){
+            auto_control_cores[ auto_control_core_count++ ] = cpu;
+            CPU_OR( &taken, &taken, &( topology[ cpu ].siblings ) );
+        }
+    }
+}
+
+void get_auto_measured_cpus( cpu_set_t *cpus ){
+    compute_auto_placement();
+    *cpus = auto_measured_cpus;
+}
+
+unsigned int get_auto_control_cpu( void ){
+    compute_auto_placement();
+    return auto_control_cores[ auto_control_next++ % auto_control_core_count ];
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include <sched.h>          // cpu_set_t
+
+// Hybrid parts expose their P- and E-cores as separate PMUs; everything else is CORE.
+typedef enum{                              CPU_TYPE_CORE,   CPU_TYPE_ATOM, NUM_CPU_TYPES } cpu_type_t;
+static const char * const cputype2str[] = { "CPU_TYPE_CORE", "CPU_TYPE_ATOM"                };
+
+void set_sysfs_root( const char *root );
+const char * get_sysfs_root( void );
+void get_online_cpus( cpu_set_t *cpus );
+void get_isolated_cpus( cpu_set_t *cpus );
+void get_nohz_full_cpus( cpu_set_t *cpus );
+bool cpu_is_online( unsigned int cpu );
+unsigned int cpu2package( unsigned int cpu );
+unsigned int cpu2die( unsigned int cpu );
+unsigned int cpu2core( unsigned int cpu );
+unsigned int cpu2node( unsigned int cpu );
+void get_core_siblings( unsigned int cpu, cpu_set_t *siblings );
+cpu_type_t cpu2type( unsigned int cpu );
+bool cpusets_share_core( cpu_set_t *a, cpu_set_t *b );
+
+// auto placement:  benchmarks fill the most isolated package; control threads
+// get whole cores elsewhere.
+void get_auto_measured_cpus( cpu_set_t *cpus );
+unsigned int get_auto_control_cpu( void );
@@ -0,0 +1,79 @@
+#define _GNU_SOURCE
+#include <assert.h>     // assert(3)
+#include <stdint.h>     // uint64_t
+#include <time.h>       // clock_gettime(2), nanosleep(2)
+#include <x86intrin.h>  // __rdtsc(), _mm_pause()
+#include "tsc_utils.h"
+
+// The TSC is invariant on everything we run on, so a single calibration against
+// CLOCK_MONOTONIC_RAW is good enough for converting deadlines.  It only needs
+// to be close; everything that matters is expressed in ticks.
+uint64_t get_tsc_hz( void ){
+    static uint64_t hz;
+    if( !hz ){
+        const struct timespec calibration_interval = { .tv_sec = 0, .tv_nsec = 50'000'000L };
+        struct timespec t0, t1;
+        assert( 0 == clock_gettime( CLOCK_MONOTONIC_RAW, &t0 ) );
+        uint64_t tsc0 = __rdtsc();
+        nanosleep( &calibration_interval, NULL );
+        assert( 0 == clock_gettime( CLOCK_MONOTONIC_RAW, &t1 ) );
+        uint64_t tsc1 = __rdtsc();
+        uint64_t ns = ( t1.tv_sec - t0.tv_sec ) * 1'000'000'000ULL + t1.tv_nsec - t0.tv_nsec;
+        hz = (uint64_t)( (unsigned __int128)( tsc1 - tsc0 ) * 1'000'000'000ULL / ns );
+        assert( hz );
+    }
+    return hz;
+}
+
+uint64_t timespec2tsc( const struct timespec * const t ){
+    unsigned __int128 ns = (unsigned __int128)t->tv_sec * 1'000'000'000ULL + t->tv_nsec;
+    return (uint64_t)( ns * get_tsc_hz() / 1'000'000'000ULL );
+}
+
+uint64_t tsc2ns( uint64_t ticks ){
+    return (uint64_t)( (unsigned __int128)ticks * 1'000'000'000ULL / get_tsc_hz() );
+}
+
+void spin_until_tsc( uint64_t deadline ){
+    while( __rdtsc() < deadline ){
+        _mm_pause();
+    }
+}
+
+// Sleep most of the way and spin the rest, for waits too long to spin through
+// but that need to end on the tick.
+void sleep_until_tsc( uint64_t deadline ){
+    const struct timespec margin = { .tv_sec = 0, .tv_nsec = 200'000L };
+    uint64_t now = __rdtsc(), spin = timespec2tsc( &margin );
+    if( deadline > now + spin ){
+        uint64_t ns = tsc2ns( deadline - now - spin );
+        struct timespec t = { .tv_sec = (time_t)( ns / 1'000'000'000ULL ), .tv_nsec = (long)( ns % 1'000'000'000ULL ) };
+        nanosleep( &t, NULL );
+    }
+    spin_until_tsc( deadline );
+}
+
+// Each participating thread announces itself and then spins until the main
+// thread publishes a release TSC and that TSC arrives.  Spinning (rather than
+// sleeping on a futex) means every thread is already running when the deadline
+// passes, so the start skew is bounded by rdtsc resolution and cache-line
+// propagation rather than by wakeup latency.
+void start_barrier_wait( struct start_barrier *sb, uint64_t *start_tsc ){
+    __atomic_fetch_add( &sb->arrived, 1, __ATOMIC_SEQ_CST );
+    while( 0 == __atomic_load_n( &sb->release_tsc, __ATOMIC_ACQUIRE ) ){
+        _mm_pause();
+    }
+    spin_until_tsc( sb->release_tsc );
+    *start_tsc = __rdtsc();
+}
+
+// Wait for <expected> threads to arrive, then set the release deadline <lead> in
+// the future.  Returns the deadline.
+uint64_t start_barrier_release( struct start_barrier *sb, size_t expected, const struct timespec * const lead ){
+    while( __atomic_load_n( &sb->arrived, __ATOMIC_ACQUIRE ) < expected ){
+        _mm_pause();
+    }
+    uint64_t deadline = __rdtsc() + timespec2tsc( lead );
+    __atomic_store_n( &sb->release_tsc, deadline, __ATOMIC_RELEASE );
+    return deadline;
+}
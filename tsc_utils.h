@@ -0,0 +1,13 @@
+#pragma once
+#include <stdint.h>
+#include <time.h>
+#include <x86intrin.h>  // __rdtsc(), _mm_pause()
+#include "job.h"
+
+uint64_t get_tsc_hz( void );
+uint64_t timespec2tsc( const struct timespec * const t );
+uint64_t tsc2ns( uint64_t ticks );
+void spin_until_tsc( uint64_t deadline );
+void sleep_until_tsc( uint64_t deadline );
+void start_barrier_wait( struct start_barrier *sb, uint64_t *start_tsc );
+uint64_t start_barrier_release( struct start_barrier *sb, size_t expected, const struct timespec * const lead );